@@ -4,11 +4,13 @@
 
 #include "sokol_gfx.h"
 #include "flextgl/flextGL.h"
+#include "leGpuProfile.h"
 
 
 //using namespace le4;
 
 void SokolGl3Renderer::init() {
+    LE_PROFILE_SCOPE("SokolGl3Renderer::init");
     flextInit();
     /* setup sokol_gfx */
     sg_desc desc = {0};
@@ -78,6 +80,8 @@ void SokolGl3Renderer::init() {
 }
 
 void SokolGl3Renderer::draw(int w, int h) {
+    LE_PROFILE_SCOPE("SokolGl3Renderer::draw");
+    LE_GPU_PROFILE_SCOPE("SokolGl3Renderer pass");
     sg_begin_default_pass(&pass_action, w, h);
     sg_apply_pipeline(pip);
     sg_apply_bindings(&bind);
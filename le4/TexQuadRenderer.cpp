@@ -2,11 +2,13 @@
 
 #include "sokol_gfx.h"
 #include "flextgl/flextGL.h"
+#include "leGpuProfile.h"
 
 
 //using namespace le4;
 
 void TexQuadRenderer::init() {
+    LE_PROFILE_SCOPE("TexQuadRenderer::init");
     flextInit();
     /* setup sokol_gfx */
     sg_desc desc = {0};
@@ -76,6 +78,8 @@ void TexQuadRenderer::init() {
 }
 
 void TexQuadRenderer::draw(int w, int h) {
+    LE_PROFILE_SCOPE("TexQuadRenderer::draw");
+    LE_GPU_PROFILE_SCOPE("TexQuadRenderer pass");
     sg_begin_default_pass(&pass_action, w, h);
     sg_apply_pipeline(pip);
     sg_apply_bindings(&bind);
@@ -1,5 +1,15 @@
 #include "le4.h"
-
+#include "leJobs.h"
+#include "leMetrics.h"
+#include "leProfile.h"
+
+// route stb allocations through SDL, so they show up in the memory stats
+#define STBI_MALLOC(sz) SDL_malloc(sz)
+#define STBI_REALLOC(p, newsz) SDL_realloc(p, newsz)
+#define STBI_FREE(p) SDL_free(p)
+#define STBIW_MALLOC(sz) SDL_malloc(sz)
+#define STBIW_REALLOC(p, newsz) SDL_realloc(p, newsz)
+#define STBIW_FREE(p) SDL_free(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -7,64 +17,89 @@
 
 namespace le4 {
 
-    void leLog(const char* file, int line, const char* func, ...) {
-        const char* filename = SDL_strrchr(file, '/');
-        if(!filename) {
-          filename = file;
-        }
-        else {
-          filename++;
-        }
+    void Zone::init(size_t inBlockSize) {
+        blockSize = inBlockSize;
+        allocated = 0;
+        highWater = 0;
+        numBlocks = 0;
+        first = NULL;
+        current = NULL;
+    }
 
-        va_list va;
+    void Zone::deinit() {
+        ZoneBlock* block = first;
+        while(block) {
+            ZoneBlock* next = block->next;
+            SDL_free(block);
+            block = next;
+        }
+        first = NULL;
+        current = NULL;
+        allocated = 0;
+        numBlocks = 0;
+    }
 
-        va_start(va, func);
-        const char* fmt = va_arg(va, const char*);
+    void* Zone::allocSlow(size_t size, size_t align) {
+        // reserve enough to align the allocation anywhere in a fresh block
+        size_t needed = size + align - 1;
 
-        char* logmsg;
-        vasprintf(&logmsg, fmt, va);
-        printf("%8d - %s:%d : %s : %s\n", SDL_GetTicks(), filename, line, func, logmsg);
-        free(logmsg);
-        va_end(va);
-    }
+        // the rest of the current block is wasted, count it so allocated stays in sync with rewind()
+        if(current) {
+            allocated += current->size - current->used;
+            current->used = current->size;
+        }
 
-    // le memory functions are only intended as optional indirection layers for SDL_memory functions.
-    // use the SDL ones rather than these.
-    static u32 numMalloc = 0;
-    static u32 numCalloc = 0;
-    static u32 numRealloc = 0;
-    static u32 numFree = 0;
+        ZoneBlock* next = current ? current->next : first;
+        if(!next || (next->size < needed)) {
+            size_t sz = needed > blockSize ? needed : blockSize;
+            ZoneBlock* block = (ZoneBlock*)SDL_malloc(sizeof(ZoneBlock) + sz);
+            LEASSERTM(block != NULL, "zone out of memory, requested %zu bytes", size);
+            block->size = sz;
+            block->next = next;
+            if(current) {
+                current->next = block;
+            } else {
+                first = block;
+            }
+            numBlocks++;
+            next = block;
+        }
+        next->used = 0;
+        current = next;
 
-    void* leMalloc(size_t size) {
-        numMalloc++;
-        return malloc(size);
+        return alloc(size, align);
     }
 
-    void* leCalloc(size_t count, size_t size) {
-        numCalloc++;
-        return calloc(count, size);
+    char* Zone::strdup(const char* str) {
+        size_t sz = SDL_strlen(str) + 1;
+        char* result = (char*)alloc(sz, 1);
+        SDL_memcpy(result, str, sz);
+        return result;
     }
 
-    void* leRealloc(void* ptr, size_t size) {
-        numRealloc++;
-        return realloc(ptr, size);
+    ZoneMarker Zone::mark() const {
+        ZoneMarker result;
+        result.block = current;
+        result.used = current ? current->used : 0;
+        result.allocated = allocated;
+        return result;
     }
 
-    void leFree(void* ptr) {
-        numFree++;
-        free(ptr);
+    void Zone::rewind(const ZoneMarker& marker) {
+        current = marker.block;
+        if(current) {
+            current->used = marker.used;
+        }
+        allocated = marker.allocated;
     }
 
-    void dumpMemoryLog() {
-        LELOG("mallocs: %d", numMalloc);
-        LELOG("callocs: %d", numCalloc);
-        LELOG("reallocs: %d", numRealloc);
-        LELOG("frees: %d", numFree);
-        LELOG("num allocs: %d", SDL_GetNumAllocations());
+    void Zone::reset() {
+        current = NULL;
+        allocated = 0;
     }
 
-    void patchSDLMemoryFuncs() {
-        SDL_SetMemoryFunctions(leMalloc, leCalloc, leRealloc, leFree);
+    void Zone::logStats(const char* name) {
+        LELOG("zone %s: high water %zu bytes, %d blocks of %zu bytes", name, highWater, numBlocks, blockSize);
     }
 
     Data* Data::init(const u8* inBytes, u32 inSize) {
@@ -119,6 +154,135 @@ namespace le4 {
         return result;
     }
 
+    char* pathCat(Zone& zone, const char* l, const char* r)
+    {
+        LEASSERT(l);
+        LEASSERT(r);
+
+        size_t lsz = SDL_strlen(l);
+        size_t rsz = SDL_strlen(r);
+        size_t sepsz = SDL_strlen(sep);
+        size_t sz = lsz + rsz + sepsz+1;
+
+        char* result = (char*)zone.alloc(sz, 1);
+        SDL_memcpy(result, l, lsz);
+        SDL_memcpy(result+lsz, sep, sepsz);
+        SDL_memcpy(result+lsz+sepsz, r, rsz+1);
+
+        return result;
+    }
+
+    char* concat(Zone& zone, const char* l, const char* r) {
+        size_t ll = SDL_strlen(l);
+        size_t lr = SDL_strlen(r);
+        char* result = (char*)zone.alloc(ll+lr+1, 1);
+        SDL_memcpy(result, l, ll);
+        SDL_memcpy(result+ll, r, lr+1);
+        return result;
+    }
+
+#pragma mark - String interning -
+
+    struct InternedString {
+        StringId    id;
+        u32         length;
+        const char* chars; // NULL for empty slots
+    };
+
+    #define LE_INTERN_CHUNK_SIZE (64*1024)
+
+    static SDL_SpinLock internLock = 0;
+    static InternedString* internSlots = NULL; // open addressing, capacity is a power of 2
+    static u32 internCapacity = 0;
+    static u32 internCount = 0;
+    static char* internChars = NULL; // current chunk, chunks are never freed
+    static size_t internCharsLeft = 0;
+
+    // must be called with internLock held
+    static InternedString* internFind(StringId id) {
+        if(!internCapacity) {
+            return NULL;
+        }
+        u32 i = id & (internCapacity - 1);
+        while(internSlots[i].chars) {
+            if(internSlots[i].id == id) {
+                return &internSlots[i];
+            }
+            i = (i + 1) & (internCapacity - 1);
+        }
+        return &internSlots[i];
+    }
+
+    static void internGrow() {
+        InternedString* oldSlots = internSlots;
+        u32 oldCapacity = internCapacity;
+        internCapacity = oldCapacity ? oldCapacity * 2 : 256;
+        internSlots = (InternedString*)SDL_calloc(internCapacity, sizeof(InternedString));
+        for(u32 i=0; i<oldCapacity; ++i) {
+            if(oldSlots[i].chars) {
+                *internFind(oldSlots[i].id) = oldSlots[i];
+            }
+        }
+        SDL_free(oldSlots);
+    }
+
+    static const char* internCopy(const char* s, size_t length) {
+        if(length + 1 > internCharsLeft) {
+            // oversized strings get a chunk of their own
+            size_t size = length + 1 > LE_INTERN_CHUNK_SIZE ? length + 1 : LE_INTERN_CHUNK_SIZE;
+            internChars = (char*)SDL_malloc(size);
+            internCharsLeft = size;
+        }
+        char* result = internChars;
+        SDL_memcpy(result, s, length + 1);
+        internChars += length + 1;
+        internCharsLeft -= length + 1;
+        return result;
+    }
+
+    bool stringTryIntern(const char* s, StringId* result) {
+        LEASSERT(s);
+        StringId id = hashDjb2(s);
+        size_t length = SDL_strlen(s);
+
+        SDL_AtomicLock(&internLock);
+        if((internCount + 1) * 4 > internCapacity * 3) {
+            internGrow();
+        }
+        InternedString* slot = internFind(id);
+        bool interned = true;
+        if(slot->chars) {
+            interned = (slot->length == length) && !SDL_memcmp(slot->chars, s, length);
+            if(!interned) {
+                LELOG_WARNING(LogCategoryGeneral, "string id collision: '%s' and '%s' both hash to %08x", slot->chars, s, id);
+            }
+        } else {
+            slot->id = id;
+            slot->length = (u32)length;
+            slot->chars = internCopy(s, length);
+            internCount++;
+            LE_GAUGE_SET(InternedStrings, internCount);
+        }
+        SDL_AtomicUnlock(&internLock);
+        *result = id;
+        return interned;
+    }
+
+    StringId stringIntern(const char* s) {
+        StringId id;
+        bool interned = stringTryIntern(s, &id);
+        LEASSERTM(interned, "'%s' can't be interned, its id is taken", s);
+        return id;
+    }
+
+    const char* stringLookup(StringId id) {
+        SDL_AtomicLock(&internLock);
+        InternedString* slot = internFind(id);
+        const char* result = slot ? slot->chars : NULL;
+        SDL_AtomicUnlock(&internLock);
+        return result;
+    }
+
     static const char* _respath = NULL;
 
     const char* resPath()
@@ -130,6 +294,12 @@ namespace le4 {
         return _respath;
     }
 
+    void setResPath(const char* path)
+    {
+        LEASSERT(path);
+        _respath = path;
+    }
+
     const char* skipResourcePathPrefix(const char* path)
     {
         const char* respath = resPath();
@@ -144,13 +314,18 @@ namespace le4 {
 
     Data fileLoad(const char* spath)
     {
+        LE_PROFILE_SCOPE("fileLoad");
         LEASSERT(spath);
+        MemoryTagScope tag(MemoryTagIO);
+#if LE_METRICS
+        u64 start = SDL_GetPerformanceCounter();
+#endif
 
         FILE* file;
         file = fopen(spath, "rb");
         if(file == NULL)
         {
-          LELOG("couldn't open file %s",spath);
+          LELOG_WARNING(LogCategoryIO, "couldn't open file %s",spath);
           Data result;
           result.bytes = NULL;
           result.size = 0;
@@ -162,48 +337,71 @@ namespace le4 {
         LEASSERTM(size != -1, "couldn't get file pos %s",spath);
         Data result;
         result.init(NULL, (u32)size);
-        LELOG("'%s' [%d bytes]", skipResourcePathPrefix(spath), size);
+        LELOG_DEBUG(LogCategoryIO, "'%s' [%lld bytes]", skipResourcePathPrefix(spath), size);
         LEASSERTM(0 == fseek(file, 0, SEEK_SET), "couldn't seek %s",spath);
         fread(result.bytes, (size_t)size, 1, file);
         LEASSERTM(0 == ferror(file), "couldn't read %s", spath);
         LEASSERTM(0 == fclose(file), "couldn't close %s", spath);
 
+        LE_COUNTER_ADD(FilesLoaded, 1);
+        LE_COUNTER_ADD(BytesLoaded, size);
+        LE_HISTOGRAM_RECORD(FileLoadUs, (SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency());
         return result;
     }
 
-    void fileSave(const char* path, Data data)
+    bool fileSave(const char* path, Data data)
     {
+        LE_PROFILE_SCOPE("fileSave");
         LEASSERT(path);
 
-        LELOG("%s [%d]", skipResourcePathPrefix(path), data.size);
-        FILE* file;
-        LEASSERTM((file = fopen(path, "wb")) != NULL, "couldn't open file: %s", path);
-        size_t written = fwrite(data.bytes, data.size, 1, file);
-        LELOG("wrote: %d", written);
-        LEASSERTM(0 == ferror(file), "couldn't write %s", path);
-        LEASSERTM(0 == fclose(file), "couldn't close %s", path);
+        LELOG_DEBUG(LogCategoryIO, "%s [%d]", skipResourcePathPrefix(path), data.size);
+        FILE* file = fopen(path, "wb");
+        if(file == NULL) {
+            LELOG_WARNING(LogCategoryIO, "couldn't open file %s", path);
+            return false;
+        }
+        bool written = (data.size == 0) || (fwrite(data.bytes, data.size, 1, file) == 1);
+        written = (0 == fclose(file)) && written;
+        if(!written) {
+            LELOG_WARNING(LogCategoryIO, "couldn't write %s", path);
+            return false;
+        }
+        LE_COUNTER_ADD(FilesSaved, 1);
+        LE_COUNTER_ADD(BytesSaved, data.size);
+        return true;
     }
 
-    Data fileLoadResource(const char* relativeFilePath)
+    bool resourcePath(PathString& result, const char* relativeFilePath)
     {
-        const char* resourcePath = resPath();
-        char* absoluteFilePath = pathCat(resourcePath, relativeFilePath);
-
-        Data result = fileLoad(absoluteFilePath);
+        result.clear();
+        if(result.tryAppend(resPath()) && result.tryAppendPath(relativeFilePath)) {
+            return true;
+        }
+        LELOG_WARNING(LogCategoryIO, "path exceeds %u chars: %s/%s", (u32)sizeof(PathString::chars) - 1, resPath(), relativeFilePath);
+        return false;
+    }
 
-        SDL_free(absoluteFilePath);
+    Data fileLoadResource(const char* relativeFilePath)
+    {
+        PathString absoluteFilePath;
+        if(!resourcePath(absoluteFilePath, relativeFilePath)) {
+            Data result;
+            result.bytes = NULL;
+            result.size = 0;
+            return result;
+        }
 
-        return result;
+        return fileLoad(absoluteFilePath);
     }
 
-    void fileSaveResource(const char* relativeFilePath, Data data)
+    bool fileSaveResource(const char* relativeFilePath, Data data)
     {
-        const char* resourcePath = resPath();
-        char* absoluteFilePath = pathCat(resourcePath, relativeFilePath);
-
-        fileSave(absoluteFilePath, data);
+        PathString absoluteFilePath;
+        if(!resourcePath(absoluteFilePath, relativeFilePath)) {
+            return false;
+        }
 
-        SDL_free(absoluteFilePath);
+        return fileSave(absoluteFilePath, data);
     }
 
     u8 bitmapFormatToBytesPerPixel(BitmapFormat v) {
@@ -211,7 +409,7 @@ namespace le4 {
         switch(v) {
             case Undefined:
                 result = 0;
-                LELOG("WARNING: can't determine size for undefined format");
+                LELOG_WARNING(LogCategoryGeneral, "can't determine size for undefined format");
                 break;
             case A:result=1; break;
             case RGB:result=3; break;
@@ -221,6 +419,8 @@ namespace le4 {
     }
 
     void Bitmap::init(u16 inWidth, u16 inHeight, BitmapFormat inFormat) {
+        LE_PROFILE_SCOPE("Bitmap::init");
+        MemoryTagScope tag(MemoryTagBitmap);
         u32 destBytesPerPixel = bitmapFormatToBytesPerPixel(format);
         u32 destSizeInBytes = destBytesPerPixel * width * height;
         data = (u8*)SDL_malloc(destSizeInBytes);
@@ -231,11 +431,13 @@ namespace le4 {
     }
 
     void Bitmap::init(const Data& inData) {
+        LE_PROFILE_SCOPE("Bitmap::decode");
+        MemoryTagScope tag(MemoryTagBitmap);
         int bytesPerPixel, w, h = 0;
         data = stbi_load_from_memory(inData.bytes, (s32)(inData.size), &w, &h, &bytesPerPixel, 0);
         if(!data)
         {
-            LELOG("ERROR: couldn't init image from memory: %s", stbi_failure_reason());
+            LELOG_ERROR(LogCategoryResources, "couldn't init image from memory: %s", stbi_failure_reason());
             LEASSERT(false);
         }
         width = (u16)w;
@@ -246,11 +448,13 @@ namespace le4 {
             case 3:format = RGB;break;
             case 4:format = RGBA;break;
             default:
-            LELOG("ERROR: couldn't init image, don't know what to do with bytesPerPixel: %d", bytesPerPixel);
+            LELOG_ERROR(LogCategoryResources, "couldn't init image, don't know what to do with bytesPerPixel: %d", bytesPerPixel);
                 LEASSERT(false);
                 break;
         }
         loaded = true;
+        LE_COUNTER_ADD(BitmapsDecoded, 1);
+        LE_COUNTER_ADD(BitmapBytesDecoded, (u64)w * (u64)h * (u64)bytesPerPixel);
     }
 
     void Bitmap::deinit() {
@@ -271,13 +475,15 @@ namespace le4 {
     }
 
     void Bitmap::write(const char* path) {
+        LE_PROFILE_SCOPE("Bitmap::write");
         int bpp = bitmapFormatToBytesPerPixel(format);
         if(!stbi_write_png(path, width, height, bpp, data, bpp*width)) {
-            LELOG("screenshot save failed");
+            LELOG_ERROR(LogCategoryIO, "screenshot save failed");
         }
     }
 
     void Bitmap::flip() {
+        LE_PROFILE_SCOPE("Bitmap::flip");
         u16 pixelSizeBytes = bitmapFormatToBytesPerPixel(format);
         // flip vertically because OpenGL returns it the other way round
         u16 lineInBytes = width * pixelSizeBytes;
@@ -296,34 +502,40 @@ namespace le4 {
     }
 
     void Bitmap::premultiply() {
+        LE_PROFILE_SCOPE("Bitmap::premultiply");
         LEASSERTM(format == RGBA, "premutiply only supported for RGBA bitmaps");
         u32* pp = (u32*)data;
         f32 n = 1/255.0f;
-        for(int y=0; y<height; ++y) {
-            for(int x=0; x<width; ++x) {
-                int i = y*width+x;
-                u32 p = pp[i];
-                f32 a = ((f32)((p & 0xff000000)>>24))*n;
-                f32 b = ((f32)((p & 0x00ff0000)>>16))*n;
-                f32 g = ((f32)((p & 0x0000ff00)>>8))*n;
-                f32 r = ((f32)(p & 0x000000ff))*n;
-
-                r*=a;
-                g*=a;
-                b*=a;
-
-                p = (
-                        ((u32)(a*255.0f)<<24) |
-                                ((u32)(b*255.0f)<<16) |
-                                ((u32)(g*255.0f)<<8) |
-                                ((u32)(r*255.0f))
-                );
-                pp[i] = p;
+        u16 w = width;
+        parallelFor(height, 64, [pp, n, w](u32 beginRow, u32 endRow) {
+            LE_PROFILE_SCOPE("Bitmap::premultiply rows");
+            for(u32 y=beginRow; y<endRow; ++y) {
+                for(int x=0; x<w; ++x) {
+                    int i = y*w+x;
+                    u32 p = pp[i];
+                    f32 a = ((f32)((p & 0xff000000)>>24))*n;
+                    f32 b = ((f32)((p & 0x00ff0000)>>16))*n;
+                    f32 g = ((f32)((p & 0x0000ff00)>>8))*n;
+                    f32 r = ((f32)(p & 0x000000ff))*n;
+
+                    r*=a;
+                    g*=a;
+                    b*=a;
+
+                    p = (
+                            ((u32)(a*255.0f)<<24) |
+                                    ((u32)(b*255.0f)<<16) |
+                                    ((u32)(g*255.0f)<<8) |
+                                    ((u32)(r*255.0f))
+                    );
+                    pp[i] = p;
+                }
             }
-        }
+        });
     }
 
     void Bitmap::clear(u32 clearColor) {
+        LE_PROFILE_SCOPE("Bitmap::clear");
         LEASSERTM(format == RGBA, "clear only supported for RGBA bitmaps");
         u32* pp = (u32*)data;
         for(s32 x=0; x<width; ++x) {
@@ -9,6 +9,8 @@
 #include <float.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <atomic>
+#include <type_traits>
 
 namespace le4 {
 
@@ -27,23 +29,210 @@ namespace le4 {
 
 #pragma mark - Log -
 
+  // the first variadic argument is the printf format, which must outlive the call (e.g. a literal)
   void leLog(const char* file, int line, const char* func, ...);
 
 #define LELOG(...) { le4::leLog(__FILE__, __LINE__, __FUNCTION__, __VA_ARGS__); }
 
+  struct LogStats {
+      u64 numMessages;  // logged asynchronously
+      u64 numDropped;   // ring buffer was full
+      u64 bytesWritten;
+      u32 highWater;    // max ring buffer bytes in use
+  };
+
+  // Starts asynchronous logging: LELOG only captures its arguments into a ring buffer of bufferSize
+  // bytes, a background thread formats and prints them. Without it, LELOG prints synchronously.
+  // logDeinit must not race with other threads still logging.
+  void logInit(u32 bufferSize);
+  void logDeinit();
+  void logFlush(); // synchronously prints everything logged so far
+  LogStats logStats();
+
+  // Leveled, categorised logging: LELOG_DEBUG/INFO/WARNING/ERROR(category, fmt, ...).
+  // Levels below LE_LOG_MIN_LEVEL compile to nothing. Disabled categories are rejected before any
+  // argument is evaluated. Each call site logs at most LE_LOG_RATE_LIMIT messages per second and
+  // reports how many it suppressed once it logs again.
+#define LE_LOG_LEVEL_DEBUG   0
+#define LE_LOG_LEVEL_INFO    1
+#define LE_LOG_LEVEL_WARNING 2
+#define LE_LOG_LEVEL_ERROR   3
+
+#ifndef LE_LOG_MIN_LEVEL
+#if DEBUG
+#define LE_LOG_MIN_LEVEL LE_LOG_LEVEL_DEBUG
+#else
+#define LE_LOG_MIN_LEVEL LE_LOG_LEVEL_INFO
+#endif
+#endif
+
+#ifndef LE_LOG_RATE_LIMIT
+#define LE_LOG_RATE_LIMIT 20
+#endif
+
+  enum LogCategory {
+      LogCategoryGeneral,
+      LogCategoryIO,
+      LogCategoryRender,
+      LogCategoryAudio,
+      LogCategoryMemory,
+      LogCategoryResources,
+      LogCategoryApp,
+      LogCategoryCount
+  };
+
+  extern std::atomic<u32> logCategoryMask; // bit per LogCategory, all enabled by default
+
+  const char* logCategoryName(LogCategory category);
+  void logSetCategoryEnabled(LogCategory category, bool enabled);
+
+  // one per call site, counts messages in the current one second window
+  struct LogRateLimit {
+      std::atomic<u32> windowStart; // SDL_GetTicks
+      std::atomic<u32> count;
+      std::atomic<u32> suppressed;
+
+      bool allow(const char* file, int line, const char* func);
+  };
+
+#define LE_LOG_AT(category, prefix, fmt, ...) { \
+    if(le4::logCategoryMask.load(std::memory_order_relaxed) & (1u << (category))) { \
+        static le4::LogRateLimit leLogRateLimit; \
+        if(leLogRateLimit.allow(__FILE__, __LINE__, __FUNCTION__)) { \
+            LELOG(prefix fmt, ##__VA_ARGS__); \
+        } \
+    } }
+
+#if LE_LOG_MIN_LEVEL <= LE_LOG_LEVEL_DEBUG
+#define LELOG_DEBUG(category, fmt, ...) LE_LOG_AT(category, "", fmt, ##__VA_ARGS__)
+#else
+#define LELOG_DEBUG(category, fmt, ...) {}
+#endif
+
+#if LE_LOG_MIN_LEVEL <= LE_LOG_LEVEL_INFO
+#define LELOG_INFO(category, fmt, ...) LE_LOG_AT(category, "", fmt, ##__VA_ARGS__)
+#else
+#define LELOG_INFO(category, fmt, ...) {}
+#endif
+
+#if LE_LOG_MIN_LEVEL <= LE_LOG_LEVEL_WARNING
+#define LELOG_WARNING(category, fmt, ...) LE_LOG_AT(category, "WARNING: ", fmt, ##__VA_ARGS__)
+#else
+#define LELOG_WARNING(category, fmt, ...) {}
+#endif
+
+#if LE_LOG_MIN_LEVEL <= LE_LOG_LEVEL_ERROR
+#define LELOG_ERROR(category, fmt, ...) LE_LOG_AT(category, "ERROR: ", fmt, ##__VA_ARGS__)
+#else
+#define LELOG_ERROR(category, fmt, ...) {}
+#endif
+
 #pragma mark - Assert -
 
-#define LEASSERT(cond) { s64 LOST_ASSERT_COND = (s64)(cond); if(!LOST_ASSERT_COND) {LELOG("%s", #cond); abort();} }
-#define LEASSERTM(cond, ...) { int LOST_ASSERT_COND = (int)(cond); if(!LOST_ASSERT_COND) {LELOG(__VA_ARGS__); abort();} }
+#define LEASSERT(cond) { s64 LOST_ASSERT_COND = (s64)(cond); if(!LOST_ASSERT_COND) {LELOG("%s", #cond); le4::logFlush(); abort();} }
+#define LEASSERTM(cond, ...) { int LOST_ASSERT_COND = (int)(cond); if(!LOST_ASSERT_COND) {LELOG(__VA_ARGS__); le4::logFlush(); abort();} }
 
   // assert without abort
 #define LEVERIFYM(cond, ...) { int LOST_ASSERT_COND = (int)(cond); if(!LOST_ASSERT_COND) {LELOG(__VA_ARGS__);} }
 
+#pragma mark - Hash -
+
+// constexpr, so hashes of literals can be computed at compile time, see LE_SID
+constexpr u32 hashDjb2(const char* data) {
+    u32 hash = 5381;
+
+    for(; *data; ++data)
+    {
+        hash = ((hash << 5) + hash) + (u32)(u8)*data;
+    }
+
+    return hash;
+}
+
 #pragma mark - string -
 
+    struct Zone;
+
     char* pathCat(const char* l, const char* r);
     char* concat(const char* l, const char* r);
 
+    // same as above, but allocated from a zone, so the result must not be freed
+    char* pathCat(Zone& zone, const char* l, const char* r);
+    char* concat(Zone& zone, const char* l, const char* r);
+
+    // Interned strings are identified by the djb2 hash of their contents, which matches the
+    // ResourceId of a resource path. Interning copies the string once into a global table that
+    // lives until the process ends, so ids can be passed around and stored instead of heap strings.
+    // Different strings with the same hash are detected when interning, only the first one gets the id.
+    typedef u32 StringId;
+
+    // id of a string literal, computed at compile time. The string itself is only known to
+    // stringLookup once it has been interned.
+#define LE_SID(literal) (std::integral_constant<le4::StringId, le4::hashDjb2(literal)>::value)
+
+    // false and a warning if another string already has the id, for strings from outside, e.g. paths
+    bool stringTryIntern(const char* s, StringId* id);
+    StringId stringIntern(const char* s); // asserts on a collision, for strings the app controls
+    const char* stringLookup(StringId id); // NULL if no string with that id was interned
+
+    // Fixed capacity string builder on the stack, e.g. for composing file paths without
+    // allocating. Always 0 terminated, asserts if the capacity is exceeded.
+    template<u32 Capacity>
+    struct StackString {
+        char    chars[Capacity];
+        u32     length;
+
+        StackString() { clear(); }
+        explicit StackString(const char* s) { clear(); append(s); }
+
+        void clear() {
+            length = 0;
+            chars[0] = 0;
+        }
+
+        StackString& append(const char* s) { return append(s, (u32)SDL_strlen(s)); }
+
+        StackString& append(const char* s, u32 n) {
+            LEASSERTM(length + n < Capacity, "string exceeds %d chars: %s", Capacity - 1, chars);
+            SDL_memcpy(chars + length, s, n);
+            length += n;
+            chars[length] = 0;
+            return *this;
+        }
+
+        // appends a separator and the path component, like pathCat
+        StackString& appendPath(const char* component) {
+            append("/", 1);
+            return append(component);
+        }
+
+        // same as above, but leave the string unchanged and return false if s doesn't fit
+        bool tryAppend(const char* s) {
+            u32 n = (u32)SDL_strlen(s);
+            if(length + n >= Capacity) {
+                return false;
+            }
+            append(s, n);
+            return true;
+        }
+
+        bool tryAppendPath(const char* component) {
+            u32 n = (u32)SDL_strlen(component);
+            if(length + 1 + n >= Capacity) {
+                return false;
+            }
+            append("/", 1);
+            append(component, n);
+            return true;
+        }
+
+        StringId id() const { return hashDjb2(chars); }
+        const char* str() const { return chars; }
+        operator const char*() const { return chars; }
+    };
+
+    typedef StackString<1024> PathString;
+
 #pragma mark - Math -
 
 #define LE_DEG2RAD_F ((2.f*M_PI)/360.f)
@@ -68,25 +257,225 @@ namespace le4 {
     return clamp(v, 0.f, 1.f);
   }
 
-#pragma mark - Hash -
+#pragma mark - Memory -
 
-inline u32 hashDjb2(const char* data) {
-    u32 hash = 5381;
-    s32 c;
+    enum MemoryAllocator {
+        MemoryAllocatorSystem, // libc malloc
+        MemoryAllocatorSlab    // le4 size class slab allocator, see slabAlloc
+    };
 
-    const unsigned char* str = (const unsigned char*)data;
-    while ((c = *str++))
-    {
-        hash = ((hash << 5) + hash) + (u32)c;
-    }
+    // routes all SDL_malloc/calloc/realloc/free calls through the le4 accounting layer, which
+    // gets its memory from the given allocator.
+    // Must be called before anything is allocated with SDL_malloc, asserts otherwise.
+    // Patching again keeps the allocator of the first call.
+    void patchSDLMemoryFuncs(MemoryAllocator allocator = MemoryAllocatorSystem);
+    void dumpMemoryLog();
 
-    return hash;
-}
+    struct SlabStats {
+        u64 reservedBytes; // mapped for small blocks, never released
+        u64 largeBytes;    // currently mapped for blocks of 2mb or more
+        u32 largeBlocks;
+    };
 
-#pragma mark - Memory -
+    // Size class slab allocator with thread local caches. Frees must pass the size of the
+    // allocation, since blocks carry no header of their own.
+    void* slabAlloc(size_t size);
+    void* slabRealloc(void* ptr, size_t oldSize, size_t newSize);
+    void slabFree(void* ptr, size_t size);
+    SlabStats slabStats();
+
+    enum MemoryTag {
+        MemoryTagGeneral,
+        MemoryTagRender,
+        MemoryTagAudio,
+        MemoryTagIO,
+        MemoryTagBitmap,
+        MemoryTagCount
+    };
 
-    void patchSDLMemoryFuncs();
-    void dumpMemoryLog();
+    // power of 2 buckets, class 0 is up to 16 bytes, the last one collects everything larger
+    #define LE_MEMORY_SIZE_CLASSES 18
+
+    struct MemoryStats {
+        u64 numMalloc;
+        u64 numCalloc;
+        u64 numRealloc;
+        u64 numFree;
+        s64 liveBytes;
+        s64 peakBytes;   // maximum of liveBytes since patchSDLMemoryFuncs
+        s64 liveAllocations;
+        s64 tagLiveBytes[MemoryTagCount];
+        u64 tagAllocations[MemoryTagCount];
+        u64 sizeClasses[LE_MEMORY_SIZE_CLASSES]; // allocation count per size class
+    };
+
+    // allocations and frees of one frame, see memoryFrameSnapshot
+    struct MemoryFrameStats {
+        u64         frame;
+        u64         numAllocations; // mallocs + callocs + reallocs
+        u64         numFrees;
+        s64         bytesDelta;
+        MemoryStats total;          // state at the end of the frame
+    };
+
+    const char* memoryTagName(MemoryTag tag);
+    MemoryTag memorySetTag(MemoryTag tag); // sets the tag of the calling thread, returns the previous one
+    MemoryStats memoryStats(); // sums up the counters of all threads
+    void memoryFrameSnapshot(); // called once per frame by App
+    const MemoryFrameStats& memoryLastFrame();
+
+    // Allocation site tracking for finding leaks and per frame allocation hotspots.
+    // Records the callstack of every sampleRate-th allocation of each thread in a site table.
+    // Can also be enabled with the environment variable LE4_MEMORY_TRACKING=<sampleRate>[,<topN>].
+    #define LE_MEMORY_SITE_FRAMES 8
+
+    struct MemorySite {
+        void*   frames[LE_MEMORY_SITE_FRAMES];
+        u32     numFrames;
+        s64     liveBytes;        // of sampled allocations only
+        s64     liveAllocations;
+        u64     totalAllocations;
+        u64     totalBytes;
+        u64     frameAllocations; // since the last memoryTrackingEndFrame
+        u64     frameBytes;
+    };
+
+    void memoryTrackingEnable(u32 sampleRate, u32 reportTopN); // sampleRate 0 disables, reportTopN 0 doesn't log per frame
+    bool memoryTrackingEnabled();
+    u32 memoryTrackingTopSites(MemorySite* sites, u32 maxSites); // sites of the last frame, most bytes first
+    void memoryTrackingEndFrame(); // called by App once per frame
+    void memoryTrackingDumpLive(); // logs tracked allocations that are still alive, grouped by site
+
+    // Zero allocation checks: counts allocations of the calling thread between memoryGuardBegin
+    // and memoryGuardEnd and keeps the callstack of the first one. App uses this to enforce
+    // allocation free frames, see App::allocationCheck.
+    struct MemoryGuardReport {
+        u64     numAllocations; // mallocs + callocs + reallocs
+        u64     bytes;
+        void*   frames[LE_MEMORY_SITE_FRAMES]; // callstack of the first allocation
+        u32     numFrames;
+    };
+
+    void memoryGuardBegin();
+    MemoryGuardReport memoryGuardEnd();
+    void memoryLogCallstack(void* const* frames, u32 numFrames);
+
+    // tags all allocations of the calling thread until going out of scope
+    struct MemoryTagScope {
+        MemoryTag previous;
+
+        MemoryTagScope(MemoryTag tag) { previous = memorySetTag(tag); }
+        ~MemoryTagScope() { memorySetTag(previous); }
+    };
+
+#pragma mark - Zone -
+
+    struct ZoneBlock {
+        ZoneBlock*  next;
+        size_t      size; // usable bytes following the header
+        size_t      used;
+    };
+
+    struct ZoneMarker {
+        ZoneBlock*  block;
+        size_t      used;
+        size_t      allocated;
+    };
+
+    // Linear allocator for temporary data. Memory is carved from a chain of blocks by bumping a
+    // pointer, individual allocations are never freed. Instead, everything is released at once with
+    // reset(), or back to a previous state with mark()/rewind(). Blocks are kept for reuse.
+    struct Zone {
+        size_t      blockSize;  // size of regular blocks, larger allocations get a dedicated block
+        size_t      allocated;  // bytes currently handed out, including alignment padding
+        size_t      highWater;  // maximum of allocated since init
+        u32         numBlocks;
+
+        void init(size_t inBlockSize);
+        void deinit();
+
+        inline void* alloc(size_t size, size_t align = 16) {
+            LEASSERT((align & (align - 1)) == 0);
+            if(current) {
+                uintptr_t base = (uintptr_t)(current + 1);
+                uintptr_t p = (base + current->used + (align - 1)) & ~(uintptr_t)(align - 1);
+                size_t newUsed = (p - base) + size;
+                if(newUsed <= current->size) {
+                    allocated += newUsed - current->used;
+                    current->used = newUsed;
+                    if(allocated > highWater) {
+                        highWater = allocated;
+                    }
+                    return (void*)p;
+                }
+            }
+            return allocSlow(size, align);
+        }
+
+        template<typename T> T* alloc(u32 count) {
+            return (T*)alloc(sizeof(T) * count, alignof(T));
+        }
+
+        char* strdup(const char* str);
+
+        ZoneMarker mark() const;
+        void rewind(const ZoneMarker& marker); // releases everything allocated after mark()
+        void reset();
+        void logStats(const char* name);
+
+    private:
+        ZoneBlock*  first;
+        ZoneBlock*  current;
+
+        void* allocSlow(size_t size, size_t align);
+    };
+
+    // rewinds the zone to its state at construction when going out of scope
+    struct ZoneScope {
+        Zone&       zone;
+        ZoneMarker  marker;
+
+        ZoneScope(Zone& inZone) : zone(inZone), marker(inZone.mark()) {}
+        ~ZoneScope() { zone.rewind(marker); }
+    };
+
+#pragma mark - Allocators -
+
+    // Allocators for containers, passed by value. They provide
+    //   void* alloc(size_t size, size_t align);
+    //   void free(void* ptr, size_t size);
+    // size is the size passed to alloc, so allocators don't need to store it.
+
+    // SDL heap, accounted like every other SDL allocation. Alignment is limited to 16.
+    struct HeapAllocator {
+        void* alloc(size_t size, size_t align) {
+            LEASSERTM(align <= 16, "heap allocations are only 16 byte aligned, %zu requested", align);
+            return SDL_malloc(size);
+        }
+        void free(void* ptr, size_t) { SDL_free(ptr); }
+    };
+
+    // allocates from a zone, frees are ignored. Containers using it must not outlive the
+    // zone's next reset or rewind.
+    struct ZoneAllocator {
+        Zone* zone;
+
+        ZoneAllocator() : zone(NULL) {}
+        ZoneAllocator(Zone& inZone) : zone(&inZone) {}
+
+        void* alloc(size_t size, size_t align) { return zone->alloc(size, align); }
+        void free(void*, size_t) {}
+    };
+
+    // size class pools of the slab allocator, bypassing the SDL accounting layer.
+    // Cheaper than the heap for small buffers that come and go, e.g. per frame arrays.
+    struct SlabAllocator {
+        void* alloc(size_t size, size_t align) {
+            LEASSERTM(align <= 16, "slab allocations are only 16 byte aligned, %zu requested", align);
+            return slabAlloc(size);
+        }
+        void free(void* ptr, size_t size) { slabFree(ptr, size); }
+    };
 
 
 #pragma mark - Data -
@@ -101,10 +490,16 @@ inline u32 hashDjb2(const char* data) {
 
 #pragma mark - File -
 
+  const char* resPath();
+  void setResPath(const char* path); // instead of the executable's directory, path must stay valid
+  // absolute path of a resource, false and a warning if it doesn't fit into a PathString
+  bool resourcePath(PathString& result, const char* relativeFilePath);
   Data fileLoad(const char* spath);
-  Data fileLoadResource(const char* relativeFilePath);
-  void fileSave(const char* path, Data data);
-  void fileSaveResource(const char* relativeFilePath, Data data);
+  Data fileLoadResource(const char* relativeFilePath); // empty if the path is too long
+  // Blocking, on the calling thread. False and a warning if the file couldn't be written, it may
+  // be left partially written then. FileWriter saves in the background and replaces files atomically.
+  bool fileSave(const char* path, Data data);
+  bool fileSaveResource(const char* relativeFilePath, Data data); // false if the path is too long or the file couldn't be written
 
 #pragma mark - Bitmap -
 
@@ -1,107 +1,505 @@
 #include "leApp.h"
 #include "legl.h"
+#include "leGpuProfile.h"
+#include "leJobs.h"
+#include "leMetrics.h"
+#include "leProfile.h"
 
 namespace le4 {
 
-void App::run(const char* windowName, u16 windowWidth, u16 windowHeight, const char* prefsOrg, const char* prefsProduct) {
+int App::run(const char* windowName, u16 windowWidth, u16 windowHeight, const char* prefsOrg, const char* prefsProduct) {
 
-    patchSDLMemoryFuncs();
+    // before configure(), nothing may be allocated through SDL before patching
+    const char* allocatorEnv = SDL_getenv("LE4_ALLOCATOR");
+    memoryAllocator = allocatorEnv && !SDL_strcmp(allocatorEnv, "slab") ? MemoryAllocatorSlab : MemoryAllocatorSystem;
+    patchSDLMemoryFuncs(memoryAllocator);
+    logInit(256*1024);
+    LELOG_INFO(LogCategoryMemory, "allocator: %s", memoryAllocator == MemoryAllocatorSlab ? "slab" : "system");
     SDL_version version;
     SDL_GetVersion(&version);
     LELOG("SDL version: %d.%d.%d '%s'", version.major, version.minor, version.patch, SDL_GetRevision());
 
-    LEASSERTM(SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO) == 0, SDL_GetError());
+    jobWorkers = jobsDefaultNumWorkers();
+    const char* workers = SDL_getenv("LE4_JOB_WORKERS");
+    if(workers) {
+        jobWorkers = (u32)SDL_atoi(workers);
+    }
+    const char* affinity = SDL_getenv("LE4_JOB_AFFINITY");
+    jobAffinity = affinity && (SDL_atoi(affinity) != 0);
+    const char* pipelinedEnv = SDL_getenv("LE4_PIPELINED");
+    pipelined = pipelinedEnv && (SDL_atoi(pipelinedEnv) != 0);
+    vsync = VSyncOn;
+    const char* vsyncEnv = SDL_getenv("LE4_VSYNC");
+    if(vsyncEnv) {
+        vsync = !SDL_strcmp(vsyncEnv, "off") ? VSyncOff : (!SDL_strcmp(vsyncEnv, "adaptive") ? VSyncAdaptive : VSyncOn);
+    }
+    const char* fps = SDL_getenv("LE4_TARGET_FPS");
+    targetFrameRate = fps ? (f32)SDL_atof(fps) : 0.f;
+    frameTimeWarmup = 60;
+    fixedTimestep = 0;
+    maxFixedSteps = 8;
+    const char* headlessEnv = SDL_getenv("LE4_HEADLESS");
+    headless = headlessEnv && (SDL_atoi(headlessEnv) != 0);
+    const char* frames = SDL_getenv("LE4_FRAMES");
+    maxFrames = frames ? (u64)SDL_strtoull(frames, NULL, 10) : 0;
+    const char* dtEnv = SDL_getenv("LE4_DT");
+    constantDt = dtEnv ? (f32)SDL_atof(dtEnv) : 0.f;
+    exitCode = 0;
+    const char* profileEnv = SDL_getenv("LE4_PROFILE");
+    profile = !profileEnv || (SDL_atoi(profileEnv) != 0);
+    profileTracePath = SDL_getenv("LE4_PROFILE_TRACE");
+    const char* firstFrame = SDL_getenv("LE4_PROFILE_FIRST_FRAME");
+    profileTraceFirstFrame = firstFrame ? (u64)SDL_strtoull(firstFrame, NULL, 10) : ~0ull;
+    const char* traceFrames = SDL_getenv("LE4_PROFILE_FRAMES");
+    profileTraceFrames = traceFrames ? (u32)SDL_atoi(traceFrames) : 120;
+    const char* statsEnv = SDL_getenv("LE4_STATS");
+    statsOverlay = statsEnv && !SDL_strcmp(statsEnv, "overlay");
+    stats = statsOverlay || (statsEnv && (SDL_atoi(statsEnv) != 0));
+    statsCsvPath = SDL_getenv("LE4_STATS_CSV");
+    stats = stats || (statsCsvPath != NULL);
+    metricsPath = SDL_getenv("LE4_METRICS");
+    const char* budgetEnv = SDL_getenv("LE4_FRAME_BUDGET_MS");
+    frameBudgetMs = budgetEnv ? (f32)SDL_atof(budgetEnv) : 0.f;
+    const char* stallFrames = SDL_getenv("LE4_STALL_FRAMES");
+    stallHistoryFrames = stallFrames ? (u32)SDL_atoi(stallFrames) : 8;
+    stallDirectory = SDL_getenv("LE4_STALL_DIR");
+    stallDirectory = stallDirectory ? stallDirectory : ".";
+    const char* hangEnv = SDL_getenv("LE4_HANG_SECONDS");
+    hangSeconds = hangEnv ? (f32)SDL_atof(hangEnv) : 0.f;
+    allocationCheck = AllocationCheckOff;
+    allocationCheckWarmup = 60;
+    const char* check = SDL_getenv("LE4_ALLOCATION_CHECK");
+    if(check) {
+        allocationCheck = !SDL_strcmp(check, "assert") ? AllocationCheckAssert : AllocationCheckLog;
+    }
+    configure();
+    if(profile) {
+        profileInit();
+    }
+    metricsInit();
+    FILE* metricsFile = NULL;
+    if(metricsPath) {
+        metricsFile = fopen(metricsPath, "w");
+        LEVERIFYM(metricsFile != NULL, "couldn't open file %s", metricsPath);
+    }
+    if(headless) {
+        // runs without a display, e.g. on build machines. Events still work.
+        // Environment variables rather than hints, which older SDL versions don't know for drivers.
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+        SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+        constantDt = constantDt > 0 ? constantDt : 1.f / 60.f;
+    }
+
+    LEASSERTM(SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO) == 0, "%s", SDL_GetError());
 
     // FIXME: prefsPath
 
-    // FIXME: SDL GL Setup stuff shouldn't be in App, but we'll keep it here for now for simplicities sake
-    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
-    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
-    SDL_GL_SetAttribute( SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-    SDL_GL_SetAttribute( SDL_GL_RED_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_GREEN_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_BLUE_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_ALPHA_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_DEPTH_SIZE, 32);
-    SDL_GL_SetAttribute( SDL_GL_DOUBLEBUFFER, 1);
-
-    window = SDL_CreateWindow(windowName,
-                              SDL_WINDOWPOS_CENTERED,
-                              SDL_WINDOWPOS_CENTERED,
-                              windowWidth, windowHeight,
+    if(headless) {
+        // no window or GL context, render() is never called
+        window = NULL;
+        glContext = NULL;
+        windowSize = vec2(windowWidth, windowHeight);
+        statsOverlay = false;
+    } else {
+        // FIXME: SDL GL Setup stuff shouldn't be in App, but we'll keep it here for now for simplicities sake
+        SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
+        SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
+        SDL_GL_SetAttribute( SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+        SDL_GL_SetAttribute( SDL_GL_RED_SIZE, 8 );
+        SDL_GL_SetAttribute( SDL_GL_GREEN_SIZE, 8 );
+        SDL_GL_SetAttribute( SDL_GL_BLUE_SIZE, 8 );
+        SDL_GL_SetAttribute( SDL_GL_ALPHA_SIZE, 8 );
+        SDL_GL_SetAttribute( SDL_GL_DEPTH_SIZE, 32);
+        SDL_GL_SetAttribute( SDL_GL_DOUBLEBUFFER, 1);
+#if LEGL_VALIDATION == LEGL_VALIDATION_CALLBACK
+        SDL_GL_SetAttribute( SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+#endif
+
+        window = SDL_CreateWindow(windowName,
+                                  SDL_WINDOWPOS_CENTERED,
+                                  SDL_WINDOWPOS_CENTERED,
+                                  windowWidth, windowHeight,
 //                              SDL_WINDOW_OPENGL|SDL_WINDOW_ALLOW_HIGHDPI|SDL_WINDOW_RESIZABLE|SDL_WINDOW_MAXIMIZED);
-                              SDL_WINDOW_OPENGL|SDL_WINDOW_ALLOW_HIGHDPI|SDL_WINDOW_RESIZABLE);
-    LEASSERTM(window != NULL, SDL_GetError());
+                                  SDL_WINDOW_OPENGL|SDL_WINDOW_ALLOW_HIGHDPI|SDL_WINDOW_RESIZABLE);
+        LEASSERTM(window != NULL, "%s", SDL_GetError());
 
-    glContext = SDL_GL_CreateContext(window);
-    LEASSERTM(glContext != NULL, SDL_GetError());
+        glContext = SDL_GL_CreateContext(window);
+        LEASSERTM(glContext != NULL, "%s", SDL_GetError());
+        LEASSERTM(flextInit(), "couldn't load OpenGL 3.3 functions");
+        leglValidationInit();
+        if(profile) {
+            gpuProfileInit();
+        }
+        if(vsync == VSyncAdaptive && SDL_GL_SetSwapInterval(-1) != 0) {
+            LELOG_INFO(LogCategoryApp, "adaptive vsync not supported, using regular vsync: %s", SDL_GetError());
+            vsync = VSyncOn;
+        }
+        if(vsync != VSyncAdaptive) {
+            LEVERIFYM(SDL_GL_SetSwapInterval(vsync == VSyncOn ? 1 : 0) == 0, "couldn't set swap interval: %s", SDL_GetError());
+        }
 
-    int w, h;
-    SDL_GL_GetDrawableSize(window, &w, &h);
-    LELOG("drawable size: %d %d", w, h);
-    windowSize = vec2(w, h);
+        int w, h;
+        SDL_GL_GetDrawableSize(window, &w, &h);
+        LELOG("drawable size: %d %d", w, h);
+        windowSize = vec2(w, h);
+    }
     dt = 0;
-    tnow = SDL_GetTicks();
+    alpha = 0;
+    tnow = SDL_GetPerformanceCounter();
     tprev = tnow;
+    f64 ticksPerSecond = (f64)SDL_GetPerformanceFrequency();
+    f64 accumulator = 0;
+    frameTimes.init();
+    frameStats.init();
+    SDL_memset(&renderCounters, 0, sizeof(renderCounters));
+    statsOverlayReady = false;
+
+    temp.init(1024*1024);
+    frameData[0].init(256*1024);
+    frameData[1].init(256*1024);
+    simSlot = 0;
+    frameLatency = 0;
+    latencyFrames = 0;
+    latencySum = 0;
+    latencyMax = 0;
+    fileWriter.init(16*1024*1024, 64);
+    jobsInit(jobWorkers, jobAffinity);
+
+    frame = 0;
+    u64 steadyFrames = 0;
+    u64 steadyAllocations = 0;
+    u64 maxFrameAllocations = 0;
+    bool traceWritten = false;
 
-/*    leZoneInit(&app->temp, 1024*1024);
-    le2DRendererInit(&app->r2d, &app->windowSize);
+/*    le2DRendererInit(&app->r2d, &app->windowSize);
     leGuiInit(&app->gui, &app->r2d);
     leInputInit();
     leAudioInit(&app->audio);
     */
-    startup();
+    {
+        LE_PROFILE_SCOPE("App::startup");
+        startup();
+    }
+    if(stats && !headless) {
+        if(!sg_isvalid()) {
+            LELOG_INFO(LogCategoryRender, "frame stats: sokol_gfx isn't set up, no render counters or overlay");
+            statsOverlay = false;
+        } else if(!renderCountersInstall(&renderCounters)) {
+            LELOG_INFO(LogCategoryRender, "frame stats: built without sokol_gfx trace hooks, no render counters");
+        }
+    }
+    renderThread = NULL;
+    if(pipelined) {
+        // the render thread takes over the GL context until shutdown()
+        renderQueue.init(2);
+        slotsFree = SDL_CreateSemaphore(2);
+        if(!headless) {
+            SDL_GL_MakeCurrent(window, NULL);
+        }
+        renderThread = SDL_CreateThread(renderThreadFunc, "le4 Render", this);
+        LEASSERTM(renderThread != NULL, "%s", SDL_GetError());
+    }
+    bool watching = (frameBudgetMs > 0) || (hangSeconds > 0);
+    if(watching) {
+        watchdog.init(frameBudgetMs, stallHistoryFrames, stallDirectory, hangSeconds);
+    }
     SDL_Event e;
     running = true;
     while(running) {
-        tnow = SDL_GetTicks();
-        dt = ((f32)(tnow - tprev))/1000.0f;
+        if(pipelined) {
+            // until the render thread is done with the frame that last used this slot
+            LE_PROFILE_SCOPE("App::waitForRenderSlot");
+            SDL_SemWait(slotsFree);
+        }
+        if(maxFrames && (frame >= maxFrames)) {
+            break;
+        }
+        profileBeginFrame(frame);
+        if(profileTracePath && !traceWritten && (profileTraceFirstFrame != ~0ull) && (frame == profileTraceFirstFrame + profileTraceFrames)) {
+            profileExportChromeTrace(profileTracePath, profileTraceFirstFrame, profileTraceFrames);
+            traceWritten = true;
+        }
+        LE_PROFILE_SCOPE("App::frame");
+        tnow = SDL_GetPerformanceCounter();
+        f64 frameTime = (f64)(tnow - tprev) / ticksPerSecond;
+        dt = constantDt > 0 ? constantDt : (f32)frameTime;
+        if(frame > frameTimeWarmup) {
+            frameTimes.add(frameTime);
+        }
+        if(stats && frame > 0) {
+            // allocations are still the previous frame's until this one ends
+            frameStats.addFrame(frame - 1, (f32)(frameTime * 1000.0), (u32)memoryLastFrame().numAllocations);
+        }
+        if(watching && frame > 0) {
+            // the previous frame's main thread zones are complete, its memory and metrics not
+            // overwritten yet. When pipelined, its render stage may still be running. The snapshot
+            // then has the render zones that ended during the frame, those of the frame before.
+            watchdog.endFrame(frame - 1, (f32)(frameTime * 1000.0));
+        }
+        u64 simStart = tnow;
+        simSlot = (u32)(frame & 1);
+        frameData[simSlot].reset();
 
-        while(SDL_PollEvent(&e))
         {
-          switch(e.type)
-          {
-            case SDL_QUIT:running = false;break;
-            //case SDL_MOUSEMOTION:leInputMouseMoved(e.motion.x, e.motion.y);break;
-            //case SDL_MOUSEBUTTONDOWN:leInputMouseDown(e.button.button, e.button.x, e.button.y);break;
-            //case SDL_MOUSEBUTTONUP:leInputMouseUp(e.button.button, e.button.x, e.button.y);break;
-            //case SDL_KEYDOWN:leInputKeyDown(e.key.keysym.sym);break;
-            //case SDL_KEYUP:leInputKeyUp(e.key.keysym.sym);break;
-            //case SDL_DROPFILE:leInputAddDropPath(e.drop.file);break;
-            case SDL_WINDOWEVENT:
-              switch(e.window.event)
+            LE_PROFILE_SCOPE("App::events");
+            while(SDL_PollEvent(&e))
+            {
+              switch(e.type)
               {
-                case SDL_WINDOWEVENT_RESIZED:
-                  LELOG("resized to %d %d", e.window.data1, e.window.data2);
-                  windowSize.x = e.window.data1;
-                  windowSize.y = e.window.data2;
+                case SDL_QUIT:running = false;break;
+                //case SDL_MOUSEMOTION:leInputMouseMoved(e.motion.x, e.motion.y);break;
+                //case SDL_MOUSEBUTTONDOWN:leInputMouseDown(e.button.button, e.button.x, e.button.y);break;
+                //case SDL_MOUSEBUTTONUP:leInputMouseUp(e.button.button, e.button.x, e.button.y);break;
+                //case SDL_KEYDOWN:leInputKeyDown(e.key.keysym.sym);break;
+                //case SDL_KEYUP:leInputKeyUp(e.key.keysym.sym);break;
+                //case SDL_DROPFILE:leInputAddDropPath(e.drop.file);break;
+                case SDL_WINDOWEVENT:
+                  switch(e.window.event)
+                  {
+                    case SDL_WINDOWEVENT_RESIZED:
+                      LELOG_DEBUG(LogCategoryApp, "resized to %d %d", e.window.data1, e.window.data2);
+                      windowSize.x = e.window.data1;
+                      windowSize.y = e.window.data2;
+                      break;
+                  }
                   break;
-              }
-              break;
-           }
+               }
+            }
+        }
+        bool checkAllocations = (allocationCheck != AllocationCheckOff) && (frame >= allocationCheckWarmup);
+        if(checkAllocations) {
+            memoryGuardBegin();
+        }
+        if(fixedTimestep > 0) {
+            accumulator += dt;
+            u32 steps = 0;
+            while(accumulator >= fixedTimestep && steps < maxFixedSteps) {
+                LE_PROFILE_SCOPE("App::fixedUpdate");
+                fixedUpdate();
+                accumulator -= fixedTimestep;
+                steps++;
+            }
+            if(accumulator >= fixedTimestep) {
+                LELOG_DEBUG(LogCategoryApp, "frame %llu: dropped %.1f ms of fixed updates", frame, (accumulator - fmod(accumulator, fixedTimestep)) * 1000.0);
+                accumulator = fmod(accumulator, fixedTimestep);
+            }
+            alpha = (f32)(accumulator / fixedTimestep);
+        }
+        {
+            LE_PROFILE_SCOPE("App::update");
+            update();
+        }
+        {
+            LE_PROFILE_SCOPE("FileWriter::dispatch");
+            fileWriter.dispatch();
+        }
+        if(checkAllocations) {
+            MemoryGuardReport report = memoryGuardEnd();
+            if(report.numAllocations) {
+                LELOG_WARNING(LogCategoryMemory, "frame %llu: %llu allocations, %llu bytes, first one from:", frame, report.numAllocations, report.bytes);
+                memoryLogCallstack(report.frames, report.numFrames);
+                LEASSERTM(allocationCheck != AllocationCheckAssert, "frame %llu allocated", frame);
+            }
         }
-        glClearColor(0.f, 1.f, 0.f, 1.f);
-        glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-
-        update();
         //leAudioUpdate(&app->audio);
         //leInputReset();
-        SDL_GL_SwapWindow(window);
+        if(statsOverlay) {
+            frameStats.summarize(&statsSummary[simSlot]);
+        }
+        RenderFrame renderData = {frame, simStart, simSlot, windowSize};
+        if(pipelined) {
+            renderQueue.push(renderData);
+        } else {
+            renderFrame(renderData);
+        }
+        if(targetFrameRate > 0) {
+            waitForNextFrame(tnow);
+        }
         tprev = tnow;
-        //leZoneFree(&app->temp);
+        temp.reset();
+        memoryFrameSnapshot();
+        if(memoryTrackingEnabled()) {
+            memoryTrackingEndFrame();
+        }
+        metricsEndFrame(frame);
+        if(metricsFile) {
+            metricsWriteJsonLine(metricsFile);
+        }
+        // all threads, whole frame
+        if(frame >= allocationCheckWarmup) {
+            u64 n = memoryLastFrame().numAllocations;
+            steadyFrames++;
+            steadyAllocations += n;
+            maxFrameAllocations = n > maxFrameAllocations ? n : maxFrameAllocations;
+        }
+        frame++;
+    }
+    if(watching) {
+        watchdog.deinit();
+    }
+    if(pipelined) {
+        RenderFrame stop = {0, 0, ~0u, vec2(0, 0)};
+        renderQueue.push(stop);
+        SDL_WaitThread(renderThread, NULL);
+        renderThread = NULL;
+        renderQueue.deinit();
+        SDL_DestroySemaphore(slotsFree);
+        if(!headless) {
+            SDL_GL_MakeCurrent(window, glContext);
+        }
+    }
+    gpuProfileDeinit();
+    if(statsOverlayReady) {
+        statsOverlayRenderer.deinit();
+        statsOverlayReady = false;
+    }
+    renderCountersUninstall();
+    if(stats) {
+        FrameStatsSummary summary;
+        frameStats.summarize(&summary);
+        LELOG("frame stats over the last %u frames: %.2f ms p50, %.2f ms p95, %.2f ms p99, %.2f ms max",
+              summary.numFrames, summary.p50, summary.p95, summary.p99, summary.max);
+        if(statsCsvPath) {
+            frameStats.writeCsv(statsCsvPath);
+        }
+    }
+    if(profile) {
+        ProfileZoneStats zones[8];
+        u64 statsFrame;
+        u32 numZones = profileFrameStats(zones, 8, &statsFrame);
+        for(u32 i=0; i<numZones; ++i) {
+            LELOG("frame %llu: %s %.3f ms total, %u zones, %.3f ms max", statsFrame, zones[i].name, zones[i].totalMs, zones[i].count, zones[i].maxMs);
+        }
+        if(profileTracePath && !traceWritten) {
+            u64 first = profileTraceFirstFrame;
+            if(first == ~0ull) {
+                first = frame > profileTraceFrames ? frame - profileTraceFrames : 0;
+            }
+            profileExportChromeTrace(profileTracePath, first, profileTraceFrames);
+        }
     }
-    shutdown();
+    metricsDeinit();
+    if(metricsFile) {
+        LEVERIFYM(0 == fclose(metricsFile), "couldn't close %s", metricsPath);
+    }
+    LELOG("%llu steady state frames: %.2f allocations per frame, max %llu",
+          steadyFrames, steadyFrames ? (f64)steadyAllocations / (f64)steadyFrames : 0.0, maxFrameAllocations);
+    LELOG("frame latency (%s): %.2f ms average, %.2f ms max", pipelined ? "pipelined" : "serial",
+          latencyFrames ? latencySum / (f64)latencyFrames * 1000.0 : 0.0, latencyMax * 1000.0);
+    LELOG("frame time over %llu frames: %.3f ms average, %.3f ms standard deviation, %.3f ms min, %.3f ms max",
+          frameTimes.count, frameTimes.mean * 1000.0, sqrt(frameTimes.variance()) * 1000.0, frameTimes.min * 1000.0, frameTimes.max * 1000.0);
+    // callbacks of pending saves still reach the app before it shuts down
+    fileWriter.flush();
+    fileWriter.dispatch();
+    {
+        LE_PROFILE_SCOPE("App::shutdown");
+        shutdown();
+    }
+    jobsDeinit();
+    profileDeinit();
+    fileWriter.deinit();
+    temp.logStats("temp");
+    temp.deinit();
+    frameData[0].deinit();
+    frameData[1].deinit();
     //leAudioDeinit(&app->audio);
     //leGuiDeinit(&app->gui);
     //le2DRendererDeinit(&app->r2d);
     //SDL_free(prefsPath);
     // nothing to deinit for input
 
+    LogStats log = logStats();
+    LELOG("log: %llu messages, %llu dropped, %llu bytes, ring high water %d bytes", log.numMessages, log.numDropped, log.bytesWritten, log.highWater);
+    // the rest is printed synchronously, so the log ring doesn't show up in the memory report
+    logDeinit();
     dumpMemoryLog();
-    LELOG("stopped");
+    LELOG("stopped with exit code %d", exitCode);
     SDL_Quit();
+    return exitCode;
+}
+
+
+void App::renderFrame(const RenderFrame& renderData) {
+    LE_PROFILE_SCOPE("App::renderFrame");
+    // headless frames are done once they get here, there's nothing to draw
+    if(!headless) {
+        gpuProfileBeginFrame(renderData.frame);
+        glClearColor(0.f, 1.f, 0.f, 1.f);
+        glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+        {
+            LE_PROFILE_SCOPE("App::render");
+            render(renderData.slot);
+        }
+        if(stats) {
+            frameStats.addRender(renderData.frame, renderCounters);
+            if(statsOverlay) {
+                LE_PROFILE_SCOPE("App::statsOverlay");
+                if(!statsOverlayReady) {
+                    statsOverlayRenderer.init();
+                    statsOverlayReady = true;
+                }
+                f32 budgetMs = 1000.f / (targetFrameRate > 0 ? targetFrameRate : 60.f);
+                statsOverlayRenderer.draw(statsSummary[renderData.slot], renderCounters, budgetMs, (int)renderData.size.x, (int)renderData.size.y);
+            }
+            // the overlay's own calls aren't counted
+            SDL_memset(&renderCounters, 0, sizeof(renderCounters));
+        }
+        gpuProfileEndFrame();
+        {
+            LE_PROFILE_SCOPE("App::swap");
+            SDL_GL_SwapWindow(window);
+        }
+    }
+
+    f64 latency = (f64)(SDL_GetPerformanceCounter() - renderData.simStart) / (f64)SDL_GetPerformanceFrequency();
+    frameLatency = (f32)latency;
+    latencyFrames++;
+    latencySum += latency;
+    latencyMax = latency > latencyMax ? latency : latencyMax;
+}
+
+// sleeps for most of the remaining frame time, then spins, since sleeps can overshoot by a millisecond or more
+void App::waitForNextFrame(u64 frameStart) {
+    LE_PROFILE_SCOPE("App::waitForNextFrame");
+    const f64 spinSeconds = 0.002;
+    u64 frequency = SDL_GetPerformanceFrequency();
+    u64 deadline = frameStart + (u64)((f64)frequency / targetFrameRate);
+    u64 now = SDL_GetPerformanceCounter();
+    if(now >= deadline) {
+        return;
+    }
+    f64 remaining = (f64)(deadline - now) / (f64)frequency;
+    if(remaining > spinSeconds) {
+        SDL_Delay((u32)((remaining - spinSeconds) * 1000.0));
+    }
+    while(SDL_GetPerformanceCounter() < deadline) {
+        cpuRelax();
+    }
+}
+
+int App::renderThreadFunc(void* userData) {
+    App* app = (App*)userData;
+    if(!app->headless) {
+        SDL_GL_MakeCurrent(app->window, app->glContext);
+    }
+    profileSetThreadName("le4 Render");
+    for(;;) {
+        RenderFrame renderData;
+        app->renderQueue.pop(&renderData);
+        if(renderData.slot == ~0u) {
+            break;
+        }
+        app->renderFrame(renderData);
+        SDL_SemPost(app->slotsFree);
+    }
+    if(!app->headless) {
+        SDL_GL_MakeCurrent(app->window, NULL);
+    }
+    return 0;
 }
 
+void App::configure() {
+}
 
 void App::startup() {
 /*    void* d = leMalloc(4096);
@@ -117,14 +515,21 @@ void App::startup() {
     d3.deinit(); */
 }
 
+void App::fixedUpdate() {
+}
+
 void App::update() {
 
 }
 
+void App::render(u32 slot) {
+}
+
 void App::shutdown() {
 }
 
-void App::quit() {
+void App::quit(int inExitCode) {
+    exitCode = inExitCode;
     running = false;
 }
 
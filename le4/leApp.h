@@ -1,34 +1,183 @@
 #pragma once
 
 #include "le4.h"
+#include "leFileWriter.h"
+#include "leFrameStatsOverlay.h"
+#include "leQueue.h"
+#include "leWatchdog.h"
 
 namespace le4 {
 
+    enum AllocationCheck {
+        AllocationCheckOff,
+        AllocationCheckLog,     // logs frames that allocate, with the callstack of the first allocation
+        AllocationCheckAssert   // asserts on the first frame that allocates
+    };
+
+    enum VSync {
+        VSyncOff,
+        VSyncOn,
+        VSyncAdaptive   // waits for vsync unless the frame is late, then swaps right away and tears
+    };
+
+    // running mean and variance of frame times, after Welford
+    struct FrameTimeStats {
+        u64 count;
+        f64 mean;
+        f64 m2;
+        f64 min;
+        f64 max;
+
+        void init() { count = 0; mean = 0; m2 = 0; min = 0; max = 0; }
+        void add(f64 t) {
+            count++;
+            f64 delta = t - mean;
+            mean += delta / (f64)count;
+            m2 += delta * (t - mean);
+            min = (count == 1) || (t < min) ? t : min;
+            max = t > max ? t : max;
+        }
+        f64 variance() const { return count > 1 ? m2 / (f64)(count - 1) : 0.0; }
+    };
+
+    // handed from the simulation to the render stage
+    struct RenderFrame {
+        u64 frame;
+        u64 simStart; // SDL_GetPerformanceCounter when the frame's simulation started
+        u32 slot;
+        vec2 size;    // windowSize during the frame's simulation
+    };
+
     // FIXME: make App GL specific? use sokol_app?
 struct App {
     SDL_GLContext   glContext;
     SDL_Window*     window;
     vec2            windowSize;
     bool            running;
-    u32             tprev; // SDL_GetTicks
-    u32             tnow;  // SDL_GetTicks
+    u64             tprev; // SDL_GetPerformanceCounter at the start of the previous frame
+    u64             tnow;  // SDL_GetPerformanceCounter at the start of this frame
     f32             dt; // delta time since last frame, in seconds
+    u64             frame; // number of the current frame, starting at 0
+
+    // With a fixed timestep, fixedUpdate() runs as many times per frame as fixedTimestep fits into
+    // the time that passed, carrying the rest over, before update() runs once as usual. alpha is
+    // how far the current time lies between the last two fixed steps, for interpolating state
+    // in update() or render(). At most maxFixedSteps run per frame, the rest of a long stall is dropped.
+    f32             fixedTimestep; // seconds, 0 turns fixed updates off
+    u32             maxFixedSteps;
+    f32             alpha;
+
+    // Frame pacing, read once after configure(). With a target frame rate, each frame sleeps until
+    // shortly before its deadline and spins for the rest. Defaults to vsync on and no target,
+    // or LE4_VSYNC=off|on|adaptive and LE4_TARGET_FPS=<fps>.
+    VSync           vsync;
+    f32             targetFrameRate; // frames per second, 0 for unlimited
+    FrameTimeStats  frameTimes; // time between frame starts in seconds, after frameTimeWarmup frames
+    u32             frameTimeWarmup; // frames left out of frameTimes while things load and caches fill, 60 by default
+
+    // Steady state frames are expected not to allocate on the main thread from the end of event
+    // handling until after update() and the file writer callbacks. Defaults to off or LE4_ALLOCATION_CHECK=log|assert,
+    // set these in configure() or startup() to override. Checking starts after allocationCheckWarmup frames.
+    AllocationCheck allocationCheck;
+    u32             allocationCheckWarmup;
+
+    // Allocator behind SDL_malloc, see patchSDLMemoryFuncs(). Read first thing in run(), before
+    // configure(), so only LE4_ALLOCATOR=system|slab sets it. Defaults to the system allocator.
+    MemoryAllocator memoryAllocator;
+
+    // Job system settings, read once after configure(). Defaults to one worker per core besides
+    // the main thread's, or LE4_JOB_WORKERS=<n>. LE4_JOB_AFFINITY=1 pins each thread to a core.
+    u32             jobWorkers;
+    bool            jobAffinity;
+
+    // With pipelining, update() of frame N+1 runs while a render thread that owns the GL context
+    // submits frame N with render() and swaps. The two stages overlap, at the cost of one frame
+    // of latency. Without it, render() directly follows update() on the main thread.
+    // Data for render() goes into frame slot simSlot during update(). There are two slots, so
+    // render() can read slot N while update() writes slot N+1. Defaults to off or LE4_PIPELINED=1,
+    // read once after configure().
+    bool            pipelined;
+    u32             simSlot;        // slot written by the current update(), frame & 1
+    Zone            frameData[2];   // per slot memory for render(), reset before update() reuses the slot
+    std::atomic<f32> frameLatency;  // seconds from the start of a frame's simulation until it was swapped, or done when headless, last frame
+
+    // Headless apps run the same loop without a window or GL context, through SDL's dummy video
+    // driver, and never call render(). When pipelined, the render thread still takes each frame
+    // over, it just doesn't draw. Meant for benchmarks, tests and servers on machines
+    // without a display or GPU. Defaults to LE4_HEADLESS=1, read once after configure().
+    bool            headless;
+    u64             maxFrames;  // quits after this many frames, 0 for no limit. Defaults to LE4_FRAMES=<n>.
+    f32             constantDt; // dt of every frame if > 0, for deterministic runs. Defaults to LE4_DT, 1/60 when headless.
+    int             exitCode;   // returned by run(), see quit()
+
+    // CPU profiler, see leProfile.h, read once after configure(). Records unless LE4_PROFILE=0.
+    // With LE4_PROFILE_TRACE=<path>, the zones of profileTraceFrames frames (LE4_PROFILE_FRAMES,
+    // 120 by default) from profileTraceFirstFrame (LE4_PROFILE_FIRST_FRAME) on are written there
+    // as a Chrome trace once they're done. Without a first frame, the last ones before exit are.
+    bool            profile;
+    const char*     profileTracePath;
+    u64             profileTraceFirstFrame; // ~0 for the last frames before exit
+    u32             profileTraceFrames;
+
+    // Frame statistics, see leFrameStats.h, read once after configure(). Off by default,
+    // LE4_STATS=1 records them, LE4_STATS=overlay also draws them over every frame. With
+    // LE4_STATS_CSV=<path>, the recorded frames are written there at exit.
+    bool            stats;
+    bool            statsOverlay;
+    const char*     statsCsvPath;
+    FrameStats      frameStats;
+
+    // Counters, gauges and histograms, see leMetrics.h, flushed at the end of every frame. With
+    // LE4_METRICS=<path>, each frame's values are appended there as a line of JSON.
+    const char*     metricsPath;
+
+    // Frame watchdog, see leWatchdog.h, read once after configure(). With LE4_FRAME_BUDGET_MS=<ms>,
+    // every frame that takes longer leaves a snapshot of itself and the stallHistoryFrames frames
+    // before it (LE4_STALL_FRAMES, 8 by default) in stallDirectory (LE4_STALL_DIR, the working
+    // directory by default). With LE4_HANG_SECONDS=<s>, a watchdog thread dumps the main thread's
+    // callstack once no frame finished for that long.
+    f32             frameBudgetMs;
+    u32             stallHistoryFrames;
+    const char*     stallDirectory;
+    f32             hangSeconds;
+    FrameWatchdog   watchdog;
 
     char*           prefsPath;
+    Zone            temp; // per frame scratch memory, reset after each update()
+    FileWriter      fileWriter; // asynchronous file saving, callbacks are dispatched once per frame
 
-    // call this to actually run the app and start the main loop
-    void run(const char* windowName,
+    // call this to actually run the app and start the main loop. Returns exitCode.
+    int run(const char* windowName,
              u16 windowWidth,
              u16 windowHeight,
              const char* prefsOrg,
              const char* prefsProduct);
 
     // override these to customise
+    virtual void configure(); // called before anything is set up, to change the settings above
     virtual void startup();
+    virtual void fixedUpdate(); // advances the simulation by fixedTimestep
     virtual void update();
+    virtual void render(u32 slot); // draws the frame data update() left in slot. Runs on the render thread when pipelined.
     virtual void shutdown();
 
-    void quit(); // request application quit
+    void quit(int inExitCode = 0); // request application quit, run() returns inExitCode
+
+private:
+    SDL_Thread*             renderThread;
+    SpscQueue<RenderFrame>  renderQueue;
+    SDL_sem*                slotsFree;
+    u64                     latencyFrames;
+    f64                     latencySum;
+    f64                     latencyMax;
+    RenderCounters          renderCounters; // of the frame being rendered, counted by the sokol_gfx trace hooks
+    FrameStatsSummary       statsSummary[2]; // per frame slot, for the overlay
+    FrameStatsOverlay       statsOverlayRenderer;
+    bool                    statsOverlayReady; // created on first use, on the thread that renders
+
+    void renderFrame(const RenderFrame& renderData);
+    void waitForNextFrame(u64 frameStart);
+    static int renderThreadFunc(void* userData);
 };
 
 }
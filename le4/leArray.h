@@ -0,0 +1,326 @@
+#pragma once
+
+#include "le4.h"
+#include <new>
+#include <utility>
+#include <type_traits>
+
+namespace le4 {
+
+#pragma mark - Array -
+
+    // Types that can be moved to a new address with memcpy, leaving nothing to destroy at the old one.
+    // True for trivially copyable types. Mark types that only point to the heap and not into
+    // themselves with LE_TRIVIALLY_RELOCATABLE(Type) at global scope, e.g. an Array, but never a
+    // SmallArray, which is move constructed instead.
+    template<typename T>
+    struct IsTriviallyRelocatable : std::integral_constant<bool, std::is_trivially_copyable<T>::value> {};
+
+#define LE_TRIVIALLY_RELOCATABLE(...) \
+    namespace le4 { template<> struct IsTriviallyRelocatable<__VA_ARGS__> : std::true_type {}; }
+
+    // Growable array. Storage comes from the allocator, see HeapAllocator, ZoneAllocator and
+    // SlabAllocator, and grows by doubling. Trivially relocatable elements are moved with memcpy and
+    // memmove when growing, inserting or removing, other types are move constructed.
+    // Like the other le4 containers it has no constructors. It must be init()ed, and it must not
+    // be copied by value, use moveFrom() to hand the storage over to another array.
+    // Pointers to elements are invalidated by anything that grows the array.
+    template<typename T, typename Allocator = HeapAllocator>
+    struct Array {
+        void init(Allocator inAllocator = Allocator(), u32 initialCapacity = 0) {
+            allocator = inAllocator;
+            items = NULL;
+            num = 0;
+            cap = 0;
+            inlineItems = NULL;
+            inlineCap = 0;
+            ownsItems = false;
+            if(initialCapacity) {
+                reserve(initialCapacity);
+            }
+        }
+
+        void deinit() {
+            clear();
+            release();
+        }
+
+        u32 count() const { return num; }
+        u32 capacity() const { return cap; }
+        bool empty() const { return num == 0; }
+
+        T* data() { return items; }
+        const T* data() const { return items; }
+        T* begin() { return items; }
+        T* end() { return items + num; }
+        const T* begin() const { return items; }
+        const T* end() const { return items + num; }
+
+        T& operator[](u32 i) {
+#if DEBUG
+            LEASSERT(i < num);
+#endif
+            return items[i];
+        }
+        const T& operator[](u32 i) const {
+#if DEBUG
+            LEASSERT(i < num);
+#endif
+            return items[i];
+        }
+
+        T& last() {
+            LEASSERT(num > 0);
+            return items[num - 1];
+        }
+
+        T* push(const T& item) {
+            if(num == cap) {
+                // item may live in this array
+                T copy(item);
+                grow(num + 1);
+                return new (&items[num++]) T(std::move(copy));
+            }
+            return new (&items[num++]) T(item);
+        }
+
+        T* push(T&& item) {
+            if(num == cap) {
+                T moved(std::move(item));
+                grow(num + 1);
+                return new (&items[num++]) T(std::move(moved));
+            }
+            return new (&items[num++]) T(std::move(item));
+        }
+
+        template<typename... Args> T* emplace(Args&&... args) {
+            reserve(num + 1);
+            return new (&items[num++]) T(std::forward<Args>(args)...);
+        }
+
+        void pop() {
+            LEASSERT(num > 0);
+            items[--num].~T();
+        }
+
+        // copies n items to the end. src must not point into this array.
+        void append(const T* src, u32 n) {
+            reserve(num + n);
+            copyConstruct(items + num, src, n);
+            num += n;
+        }
+
+        // adds n items at the end and returns them without initialising them, e.g. for writing
+        // vertices in place
+        T* appendUninitialized(u32 n) {
+            static_assert(std::is_trivially_copyable<T>::value, "only plain values can be left uninitialised");
+            reserve(num + n);
+            T* result = items + num;
+            num += n;
+            return result;
+        }
+
+        // copies n items to index, moving the following items back. src must not point into this array.
+        void insert(u32 index, const T* src, u32 n) {
+            LEASSERT(index <= num);
+            reserve(num + n);
+            relocateBackward(items + index + n, items + index, num - index);
+            copyConstruct(items + index, src, n);
+            num += n;
+        }
+
+        void insert(u32 index, const T& item) {
+            T copy(item);
+            LEASSERT(index <= num);
+            reserve(num + 1);
+            relocateBackward(items + index + 1, items + index, num - index);
+            new (&items[index]) T(std::move(copy));
+            num++;
+        }
+
+        // removes n items at index, keeping the order of the rest
+        void remove(u32 index, u32 n = 1) {
+            LEASSERT(index + n <= num);
+            destroy(items + index, n);
+            relocateForward(items + index, items + index + n, num - index - n);
+            num -= n;
+        }
+
+        // removes the item at index by moving the last one into its place
+        void removeSwap(u32 index) {
+            LEASSERT(index < num);
+            items[index].~T();
+            num--;
+            if(index != num) {
+                relocateForward(items + index, items + num, 1);
+            }
+        }
+
+        // default constructs new items, which zeroes plain values
+        void resize(u32 n) {
+            if(n < num) {
+                destroy(items + n, num - n);
+            } else if(n > num) {
+                reserve(n);
+                if(IsTriviallyRelocatable<T>::value && std::is_trivially_default_constructible<T>::value) {
+                    SDL_memset(items + num, 0, sizeof(T) * (n - num));
+                } else {
+                    for(u32 i=num; i<n; ++i) {
+                        new (&items[i]) T();
+                    }
+                }
+            }
+            num = n;
+        }
+
+        void clear() {
+            destroy(items, num);
+            num = 0;
+        }
+
+        void reserve(u32 n) {
+            if(n > cap) {
+                grow(n);
+            }
+        }
+
+        // takes over the items of other, which is left empty but initialised. Allocated storage
+        // changes hands along with its allocator, inline items of a SmallArray are moved one by one.
+        void moveFrom(Array& other) {
+            if(&other == this) {
+                return;
+            }
+            clear();
+            if(other.ownsItems) {
+                release();
+                allocator = other.allocator;
+                items = other.items;
+                num = other.num;
+                cap = other.cap;
+                ownsItems = true;
+                other.items = other.inlineItems;
+                other.num = 0;
+                other.cap = other.inlineCap;
+                other.ownsItems = false;
+            } else {
+                reserve(other.num);
+                relocateForward(items, other.items, other.num);
+                num = other.num;
+                other.num = 0;
+            }
+        }
+
+    protected:
+        T*          items;
+        u32         num;
+        u32         cap;
+        Allocator   allocator;
+        T*          inlineItems; // storage of a SmallArray, NULL for an Array
+        u32         inlineCap;
+        bool        ownsItems;  // false while items point at inline storage of a SmallArray
+
+        void grow(u32 n) {
+            u32 newCap = cap ? cap * 2 : 4;
+            while(newCap < n) {
+                newCap *= 2;
+            }
+            size_t align = alignof(T) > 16 ? alignof(T) : 16;
+            T* newItems = (T*)allocator.alloc(sizeof(T) * newCap, align);
+            LEASSERTM(newItems != NULL, "array out of memory");
+            relocateForward(newItems, items, num);
+            release();
+            items = newItems;
+            cap = newCap;
+            ownsItems = true;
+        }
+
+        // back to the inline storage of a SmallArray, or none
+        void release() {
+            if(ownsItems) {
+                allocator.free(items, sizeof(T) * cap);
+            }
+            items = inlineItems;
+            cap = inlineCap;
+            ownsItems = false;
+        }
+
+        static void copyConstruct(T* dst, const T* src, u32 n) {
+            if(std::is_trivially_copyable<T>::value) {
+                if(n) {
+                    SDL_memcpy((void*)dst, (const void*)src, sizeof(T) * n);
+                }
+            } else {
+                for(u32 i=0; i<n; ++i) {
+                    new (&dst[i]) T(src[i]);
+                }
+            }
+        }
+
+        static void destroy(T* p, u32 n) {
+            if(!std::is_trivially_destructible<T>::value) {
+                for(u32 i=0; i<n; ++i) {
+                    p[i].~T();
+                }
+            }
+        }
+
+        // moves n items from src to a lower or non overlapping dst, leaving src uninitialised
+        static void relocateForward(T* dst, T* src, u32 n) {
+            if(IsTriviallyRelocatable<T>::value) {
+                if(n) {
+                    SDL_memmove((void*)dst, (const void*)src, sizeof(T) * n);
+                }
+            } else {
+                for(u32 i=0; i<n; ++i) {
+                    new (&dst[i]) T(std::move(src[i]));
+                    src[i].~T();
+                }
+            }
+        }
+
+        // moves n items from src to a higher dst, leaving src uninitialised
+        static void relocateBackward(T* dst, T* src, u32 n) {
+            if(IsTriviallyRelocatable<T>::value) {
+                if(n) {
+                    SDL_memmove((void*)dst, (const void*)src, sizeof(T) * n);
+                }
+            } else {
+                for(u32 i=n; i-- > 0;) {
+                    new (&dst[i]) T(std::move(src[i]));
+                    src[i].~T();
+                }
+            }
+        }
+    };
+
+    // Array with room for N items inline, only allocates once it grows past them.
+    // Can be passed wherever an Array<T, Allocator>& is expected. Its items may point into
+    // itself, so it's moved with a move constructor rather than memcpy, e.g. when an Array of
+    // SmallArrays grows. It can't be copied.
+    template<typename T, u32 N, typename Allocator = HeapAllocator>
+    struct SmallArray : Array<T, Allocator> {
+        SmallArray() = default; // uninitialised, like Array
+        SmallArray(SmallArray&& other) {
+            init(other.allocator);
+            this->moveFrom(other);
+        }
+
+        void init(Allocator inAllocator = Allocator()) {
+            this->allocator = inAllocator;
+            this->items = (T*)storage;
+            this->num = 0;
+            this->cap = N;
+            this->inlineItems = (T*)storage;
+            this->inlineCap = N;
+            this->ownsItems = false;
+        }
+
+        bool isInline() const { return !this->ownsItems; }
+
+    private:
+        alignas(T) u8 storage[sizeof(T) * N];
+    };
+
+    template<typename T, u32 N, typename Allocator>
+    struct IsTriviallyRelocatable<SmallArray<T, N, Allocator>> : std::false_type {};
+}
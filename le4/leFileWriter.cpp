@@ -0,0 +1,266 @@
+#include "leFileWriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace le4 {
+
+    void FileWriter::init(u32 inMaxPendingBytes, u32 inMaxPendingWrites) {
+        maxPendingBytes = inMaxPendingBytes;
+        maxPendingWrites = inMaxPendingWrites;
+        mutex = SDL_CreateMutex();
+        workAvailable = SDL_CreateCond();
+        workDone = SDL_CreateCond();
+        pendingHead = pendingTail = NULL;
+        finishedHead = finishedTail = NULL;
+        pendingBytes = 0;
+        pendingWrites = 0;
+        busy = false;
+        running = true;
+        thread = SDL_CreateThread(threadFunc, "le4 FileWriter", this);
+        LEASSERTM(thread != NULL, "%s", SDL_GetError());
+    }
+
+    void FileWriter::deinit() {
+        SDL_LockMutex(mutex);
+        running = false;
+        SDL_CondSignal(workAvailable);
+        SDL_UnlockMutex(mutex);
+        SDL_WaitThread(thread, NULL);
+        thread = NULL;
+
+        // too late for callbacks, the owner may be gone. Failures are still logged.
+        FileWriteRequest* request = finishedHead;
+        finishedHead = finishedTail = NULL;
+        while(request) {
+            FileWriteRequest* next = request->next;
+            if(request->status == FileWriteFailed) {
+                LELOG_ERROR(LogCategoryIO, "couldn't write %s: %s", request->path, request->error);
+            }
+            SDL_free(request->path);
+            SDL_free(request);
+            request = next;
+        }
+
+        SDL_DestroyCond(workDone);
+        SDL_DestroyCond(workAvailable);
+        SDL_DestroyMutex(mutex);
+    }
+
+    static FileWriteRequest* findPending(FileWriteRequest* head, const char* path) {
+        for(FileWriteRequest* r = head; r; r = r->next) {
+            if(!SDL_strcmp(r->path, path)) {
+                return r;
+            }
+        }
+        return NULL;
+    }
+
+    bool FileWriter::write(const char* path, Data data, FileWriteCallback callback, void* userData, bool wait) {
+        LEASSERT(path);
+        // the temporary file is "<path>.tmp" in a PathString
+        if(SDL_strlen(path) + 4 >= sizeof(PathString::chars)) {
+            LELOG_WARNING(LogCategoryIO, "path exceeds %u chars: %s", (u32)sizeof(PathString::chars) - 5, path);
+            return false;
+        }
+
+        SDL_LockMutex(mutex);
+        for(;;) {
+            FileWriteRequest* existing = findPending(pendingHead, path);
+            if(existing) {
+                // replace the data in place, the request keeps its position in the queue.
+                // Doesn't add a write, but may add bytes. Like below, the only pending write may be oversized.
+                u32 bytes = pendingBytes - existing->data.size + data.size;
+                if((bytes <= maxPendingBytes) || (pendingWrites == 1)) {
+                    FileWriteRequest* superseded = (FileWriteRequest*)SDL_calloc(1, sizeof(FileWriteRequest));
+                    superseded->path = SDL_strdup(path);
+                    superseded->callback = existing->callback;
+                    superseded->userData = existing->userData;
+                    superseded->status = FileWriteCoalesced;
+                    finish(superseded);
+
+                    pendingBytes = bytes;
+                    existing->data.deinit();
+                    existing->data.init(data.bytes, data.size);
+                    existing->callback = callback;
+                    existing->userData = userData;
+                    break;
+                }
+            } else {
+                // allow a single oversized write if nothing else is queued, otherwise it could never go through
+                bool full = (pendingWrites >= maxPendingWrites) || ((pendingBytes + data.size > maxPendingBytes) && (pendingWrites > 0));
+                if(!full) {
+                    FileWriteRequest* request = (FileWriteRequest*)SDL_calloc(1, sizeof(FileWriteRequest));
+                    request->path = SDL_strdup(path);
+                    request->data.init(data.bytes, data.size);
+                    request->callback = callback;
+                    request->userData = userData;
+                    if(pendingTail) {
+                        pendingTail->next = request;
+                    } else {
+                        pendingHead = request;
+                    }
+                    pendingTail = request;
+                    pendingBytes += data.size;
+                    pendingWrites++;
+                    SDL_CondSignal(workAvailable);
+                    break;
+                }
+            }
+            if(!wait) {
+                SDL_UnlockMutex(mutex);
+                return false;
+            }
+            // the pending request may be taken by the writer meanwhile, so look again
+            SDL_CondWait(workDone, mutex);
+        }
+        SDL_UnlockMutex(mutex);
+        return true;
+    }
+
+    bool FileWriter::writeResource(const char* relativeFilePath, Data data, FileWriteCallback callback, void* userData, bool wait) {
+        PathString absoluteFilePath;
+        if(!resourcePath(absoluteFilePath, relativeFilePath)) {
+            return false;
+        }
+        return write(absoluteFilePath, data, callback, userData, wait);
+    }
+
+    void FileWriter::flush() {
+        SDL_LockMutex(mutex);
+        while(pendingHead || busy) {
+            SDL_CondWait(workDone, mutex);
+        }
+        SDL_UnlockMutex(mutex);
+    }
+
+    void FileWriter::dispatch() {
+        SDL_LockMutex(mutex);
+        FileWriteRequest* request = finishedHead;
+        finishedHead = finishedTail = NULL;
+        SDL_UnlockMutex(mutex);
+
+        while(request) {
+            FileWriteRequest* next = request->next;
+            if(request->status == FileWriteFailed) {
+                LELOG_ERROR(LogCategoryIO, "couldn't write %s: %s", request->path, request->error);
+            }
+            if(request->callback) {
+                request->callback(request->path, request->status, request->status == FileWriteFailed ? request->error : NULL, request->userData);
+            }
+            SDL_free(request->path);
+            SDL_free(request);
+            request = next;
+        }
+    }
+
+    // must be called with mutex locked
+    void FileWriter::finish(FileWriteRequest* request) {
+        request->next = NULL;
+        if(finishedTail) {
+            finishedTail->next = request;
+        } else {
+            finishedHead = request;
+        }
+        finishedTail = request;
+    }
+
+    // makes a rename in the directory of path durable
+    static bool syncDirectory(const char* path) {
+        PathString directory;
+        const char* slash = SDL_strrchr(path, '/');
+        if(slash == path) {
+            directory.append("/");
+        } else if(slash) {
+            directory.append(path, (u32)(slash - path));
+        } else {
+            directory.append(".");
+        }
+        int fd = open(directory, O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        bool ok = fsync(fd) == 0;
+        close(fd);
+        return ok;
+    }
+
+    #define LE_FILEWRITER_FAIL(what) { \
+        request->status = FileWriteFailed; \
+        SDL_snprintf(request->error, sizeof(request->error), "%s: %s", what, strerror(errno)); \
+    }
+
+    // runs on the writer thread without holding the mutex
+    void FileWriter::writeRequest(FileWriteRequest* request) {
+        PathString tmpPath(request->path);
+        tmpPath.append(".tmp");
+        request->status = FileWriteOk;
+
+        FILE* file = fopen(tmpPath, "wb");
+        if(!file) {
+            LE_FILEWRITER_FAIL("open");
+        } else {
+            if((request->data.size > 0) && (fwrite(request->data.bytes, request->data.size, 1, file) != 1)) {
+                LE_FILEWRITER_FAIL("write");
+            } else if(fflush(file) != 0) {
+                LE_FILEWRITER_FAIL("flush");
+            } else if(fsync(fileno(file)) != 0) {
+                LE_FILEWRITER_FAIL("fsync");
+            }
+            if((fclose(file) != 0) && (request->status == FileWriteOk)) {
+                LE_FILEWRITER_FAIL("close");
+            }
+            if(request->status == FileWriteOk) {
+                if(rename(tmpPath, request->path) != 0) {
+                    LE_FILEWRITER_FAIL("rename");
+                } else if(!syncDirectory(request->path)) {
+                    // the data is there, but the rename may not survive a crash
+                    LE_FILEWRITER_FAIL("fsync directory");
+                }
+            }
+            if(request->status != FileWriteOk) {
+                remove(tmpPath);
+            }
+        }
+    }
+
+    #undef LE_FILEWRITER_FAIL
+
+    int FileWriter::threadFunc(void* userData) {
+        FileWriter* writer = (FileWriter*)userData;
+        memorySetTag(MemoryTagIO);
+
+        SDL_LockMutex(writer->mutex);
+        for(;;) {
+            while(!writer->pendingHead && writer->running) {
+                SDL_CondWait(writer->workAvailable, writer->mutex);
+            }
+            FileWriteRequest* request = writer->pendingHead;
+            if(!request) {
+                break; // stopped and drained
+            }
+            writer->pendingHead = request->next;
+            if(!writer->pendingHead) {
+                writer->pendingTail = NULL;
+            }
+            writer->busy = true;
+            SDL_UnlockMutex(writer->mutex);
+
+            writer->writeRequest(request);
+
+            SDL_LockMutex(writer->mutex);
+            writer->pendingBytes -= request->data.size;
+            writer->pendingWrites--;
+            writer->busy = false;
+            request->data.deinit();
+            writer->finish(request);
+            SDL_CondBroadcast(writer->workDone);
+        }
+        SDL_UnlockMutex(writer->mutex);
+
+        return 0;
+    }
+}
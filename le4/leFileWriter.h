@@ -0,0 +1,67 @@
+#pragma once
+
+#include "le4.h"
+
+namespace le4 {
+
+#pragma mark - FileWriter -
+
+    enum FileWriteStatus {
+        FileWriteOk,
+        FileWriteFailed,
+        FileWriteCoalesced // superseded by a later write to the same path before it hit the disk
+    };
+
+    typedef void (*FileWriteCallback)(const char* path, FileWriteStatus status, const char* error, void* userData);
+
+    struct FileWriteRequest {
+        char*               path;
+        Data                data;
+        FileWriteCallback   callback;
+        void*               userData;
+        FileWriteStatus     status;
+        char                error[128];
+        FileWriteRequest*   next;
+    };
+
+    // Write-behind file saving on a background thread.
+    // Each write goes to "<path>.tmp", is fsynced and then renamed over the target, and the
+    // directory is fsynced, so readers never see partially written files. Pending writes to the same path are coalesced, only the
+    // latest data is written.
+    // Callbacks are never called from the writer thread, but from dispatch() on the calling thread.
+    struct FileWriter {
+        u32                 maxPendingBytes;  // write() blocks or fails beyond these limits
+        u32                 maxPendingWrites;
+
+        void init(u32 inMaxPendingBytes, u32 inMaxPendingWrites);
+        void deinit(); // writes everything still pending, then stops the thread. Doesn't call callbacks anymore.
+
+        // queues a copy of data for writing. If the queue is full and wait is false, nothing is
+        // queued and false is returned, otherwise blocks until there's enough space. Replacing
+        // the data of a pending write to the same path counts against maxPendingBytes as well.
+        // Also false if the path is too long for a PathString.
+        bool write(const char* path, Data data, FileWriteCallback callback, void* userData, bool wait);
+        bool writeResource(const char* relativeFilePath, Data data, FileWriteCallback callback, void* userData, bool wait);
+
+        void flush();    // blocks until all queued writes are on disk
+        void dispatch(); // calls callbacks of finished writes
+
+    private:
+        SDL_Thread*         thread;
+        SDL_mutex*          mutex;
+        SDL_cond*           workAvailable;
+        SDL_cond*           workDone;
+        FileWriteRequest*   pendingHead; // oldest first
+        FileWriteRequest*   pendingTail;
+        FileWriteRequest*   finishedHead;
+        FileWriteRequest*   finishedTail;
+        u32                 pendingBytes;
+        u32                 pendingWrites;
+        bool                busy; // writer thread is currently writing a request it took off the queue
+        bool                running;
+
+        static int threadFunc(void* userData);
+        void writeRequest(FileWriteRequest* request);
+        void finish(FileWriteRequest* request);
+    };
+}
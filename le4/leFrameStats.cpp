@@ -0,0 +1,77 @@
+#include "leFrameStats.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace le4 {
+
+    void FrameStats::init() {
+        SDL_memset(samples, 0, sizeof(samples));
+        numFrames = 0;
+    }
+
+    void FrameStats::addFrame(u64 frame, f32 ms, u32 allocations) {
+        FrameSample& sample = samples[frame & (LE_FRAME_STATS_FRAMES - 1)];
+        sample.frame = frame;
+        sample.ms = ms;
+        sample.allocations = allocations;
+        numFrames = frame + 1;
+        // a frame that isn't rendered, e.g. headless, mustn't show the counters of an old one
+        SDL_memset(&samples[numFrames & (LE_FRAME_STATS_FRAMES - 1)].render, 0, sizeof(RenderCounters));
+    }
+
+    void FrameStats::addRender(u64 frame, const RenderCounters& counters) {
+        samples[frame & (LE_FRAME_STATS_FRAMES - 1)].render = counters;
+    }
+
+    static f32 percentile(const f32* sorted, u32 count, u32 percent) {
+        // nearest rank
+        u32 rank = (percent * count + 99) / 100;
+        return sorted[rank > 0 ? rank - 1 : 0];
+    }
+
+    void FrameStats::summarize(FrameStatsSummary* summary) const {
+        SDL_memset(summary, 0, sizeof(FrameStatsSummary));
+        u32 count = numFrames < LE_FRAME_STATS_FRAMES ? (u32)numFrames : LE_FRAME_STATS_FRAMES;
+        if(count == 0) {
+            return;
+        }
+        f32 sorted[LE_FRAME_STATS_FRAMES];
+        for(u32 i=0; i<count; ++i) {
+            sorted[i] = samples[(numFrames - count + i) & (LE_FRAME_STATS_FRAMES - 1)].ms;
+        }
+        u32 numGraph = count < LE_FRAME_STATS_GRAPH ? count : LE_FRAME_STATS_GRAPH;
+        SDL_memcpy(summary->graph, sorted + count - numGraph, numGraph * sizeof(f32));
+        summary->numGraph = numGraph;
+        std::sort(sorted, sorted + count);
+        summary->numFrames = count;
+        summary->p50 = percentile(sorted, count, 50);
+        summary->p95 = percentile(sorted, count, 95);
+        summary->p99 = percentile(sorted, count, 99);
+        summary->max = sorted[count - 1];
+        // not the render counters, the render thread may be writing them
+        const FrameSample& last = samples[(numFrames - 1) & (LE_FRAME_STATS_FRAMES - 1)];
+        summary->lastMs = last.ms;
+        summary->lastAllocations = last.allocations;
+    }
+
+    bool FrameStats::writeCsv(const char* path) const {
+        FILE* file = fopen(path, "w");
+        if(file == NULL) {
+            LELOG_WARNING(LogCategoryIO, "couldn't open file %s", path);
+            return false;
+        }
+        fprintf(file, "frame,ms,allocations,passes,draws,pipelines,bindings,uniforms,upload_bytes\n");
+        u32 count = numFrames < LE_FRAME_STATS_FRAMES ? (u32)numFrames : LE_FRAME_STATS_FRAMES;
+        for(u32 i=0; i<count; ++i) {
+            const FrameSample& sample = samples[(numFrames - count + i) & (LE_FRAME_STATS_FRAMES - 1)];
+            fprintf(file, "%llu,%.3f,%u,%u,%u,%u,%u,%u,%llu\n", (unsigned long long)sample.frame, sample.ms, sample.allocations,
+                    sample.render.passes, sample.render.draws, sample.render.pipelines, sample.render.bindings,
+                    sample.render.uniforms, (unsigned long long)sample.render.uploadBytes);
+        }
+        bool ok = !ferror(file);
+        LEVERIFYM(0 == fclose(file), "couldn't close %s", path);
+        LELOG_DEBUG(LogCategoryIO, "%s [%u frames]", path, count);
+        return ok;
+    }
+}
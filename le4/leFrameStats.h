@@ -0,0 +1,66 @@
+#pragma once
+
+#include "le4.h"
+
+// LE_FRAME_STATS=0 compiles the sokol_gfx trace hooks out, App's frame stats then have no render counters
+#ifndef LE_FRAME_STATS
+#define LE_FRAME_STATS 1
+#endif
+
+#define LE_FRAME_STATS_FRAMES 256 // frames kept for percentiles and the CSV dump, must be a power of 2
+#define LE_FRAME_STATS_GRAPH 120  // frame times copied into each summary for the overlay graph
+
+namespace le4 {
+
+#pragma mark - Frame statistics -
+
+    // sokol_gfx calls of one frame, counted by the trace hooks on the thread that renders
+    struct RenderCounters {
+        u32 passes;
+        u32 draws;
+        u32 pipelines;   // sg_apply_pipeline calls
+        u32 bindings;    // sg_apply_bindings calls
+        u32 uniforms;    // sg_apply_uniforms calls
+        u64 uploadBytes; // buffer and image updates
+    };
+
+    struct FrameSample {
+        u64             frame;
+        f32             ms;          // from the start of the frame until the next one starts
+        u32             allocations; // on all threads
+        RenderCounters  render;      // zero until the frame was rendered
+    };
+
+    // what the overlay draws, summarised on the main thread for the render stage
+    struct FrameStatsSummary {
+        u32         numFrames; // frames the percentiles are over
+        f32         p50;
+        f32         p95;
+        f32         p99;
+        f32         max;
+        f32         lastMs;          // of the newest recorded frame
+        u32         lastAllocations;
+        f32         graph[LE_FRAME_STATS_GRAPH]; // frame times in ms, oldest first
+        u32         numGraph;
+    };
+
+    // Ring of the last LE_FRAME_STATS_FRAMES frames. addFrame() is called by the main thread,
+    // addRender() by the thread that renders. They only touch the fields they fill in, and a
+    // frame's sample isn't reused until LE_FRAME_STATS_FRAMES frames later, so they don't race.
+    // addFrame() for a frame must come before the next frame is rendered, it clears the render
+    // counters the next frame's sample kept from LE_FRAME_STATS_FRAMES frames ago.
+    struct FrameStats {
+        FrameSample samples[LE_FRAME_STATS_FRAMES];
+        u64         numFrames;
+
+        void init();
+        void addFrame(u64 frame, f32 ms, u32 allocations);
+        void addRender(u64 frame, const RenderCounters& counters);
+
+        // percentiles by nearest rank over the recorded frames
+        void summarize(FrameStatsSummary* summary) const;
+
+        // one line per recorded frame, oldest first. Call once rendering stopped.
+        bool writeCsv(const char* path) const;
+    };
+}
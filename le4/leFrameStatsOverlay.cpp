@@ -0,0 +1,284 @@
+#include "leFrameStatsOverlay.h"
+
+namespace le4 {
+
+#pragma mark - Render counters -
+
+    static sg_trace_hooks previousHooks;
+    static bool hooksInstalled = false;
+
+#if LE_FRAME_STATS
+    static void countPass(const sg_pass_action*, int, int, void* userData) {
+        ((RenderCounters*)userData)->passes++;
+    }
+
+    static void countOffscreenPass(sg_pass, const sg_pass_action*, void* userData) {
+        ((RenderCounters*)userData)->passes++;
+    }
+
+    static void countDraw(int, int, int, void* userData) {
+        ((RenderCounters*)userData)->draws++;
+    }
+
+    static void countPipeline(sg_pipeline, void* userData) {
+        ((RenderCounters*)userData)->pipelines++;
+    }
+
+    static void countBindings(const sg_bindings*, void* userData) {
+        ((RenderCounters*)userData)->bindings++;
+    }
+
+    static void countUniforms(sg_shader_stage, int, const void*, int, void* userData) {
+        ((RenderCounters*)userData)->uniforms++;
+    }
+
+    static void countBufferUpdate(sg_buffer, const void*, int size, void* userData) {
+        ((RenderCounters*)userData)->uploadBytes += (u64)size;
+    }
+
+    static void countBufferAppend(sg_buffer, const void*, int size, int, void* userData) {
+        ((RenderCounters*)userData)->uploadBytes += (u64)size;
+    }
+
+    static void countImageUpdate(sg_image, const sg_image_content* content, void* userData) {
+        u64 bytes = 0;
+        for(int face=0; face<SG_CUBEFACE_NUM; ++face) {
+            for(int mip=0; mip<SG_MAX_MIPMAPS; ++mip) {
+                bytes += (u64)content->subimage[face][mip].size;
+            }
+        }
+        ((RenderCounters*)userData)->uploadBytes += bytes;
+    }
+#endif
+
+    bool renderCountersInstall(RenderCounters* counters) {
+#if LE_FRAME_STATS
+        LEASSERT(sg_isvalid());
+        SDL_memset(counters, 0, sizeof(RenderCounters));
+        sg_trace_hooks hooks;
+        SDL_memset(&hooks, 0, sizeof(hooks));
+        hooks.user_data = counters;
+        hooks.begin_default_pass = countPass;
+        hooks.begin_pass = countOffscreenPass;
+        hooks.draw = countDraw;
+        hooks.apply_pipeline = countPipeline;
+        hooks.apply_bindings = countBindings;
+        hooks.apply_uniforms = countUniforms;
+        hooks.update_buffer = countBufferUpdate;
+        hooks.append_buffer = countBufferAppend;
+        hooks.update_image = countImageUpdate;
+        previousHooks = sg_install_trace_hooks(&hooks);
+        hooksInstalled = true;
+        return true;
+#else
+        (void)counters;
+        return false;
+#endif
+    }
+
+    void renderCountersUninstall() {
+        if(hooksInstalled && sg_isvalid()) {
+            sg_install_trace_hooks(&previousHooks);
+        }
+        hooksInstalled = false;
+    }
+
+#pragma mark - Overlay -
+
+    struct OverlayVertex {
+        f32 x, y; // normalized device coordinates
+        u32 color;
+    };
+
+    // 3x5 pixel glyphs from ' ' to 'Z', one octal digit per row from the top, the high bit is the left pixel
+    static const u16 glyphs['Z' - ' ' + 1] = {
+        0,      0,      0,      0,      0,      051245, 0,      0,      // space to '
+        0,      0,      0,      0,      0,      000700, 000002, 011244, // ( to /
+        075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, // 0 to 7
+        075757, 075717, 002020, 0,      0,      0,      0,      0,      // 8 to ?
+        0,      025755, 065656, 034443, 065556, 074647, 074644, 034553, // @ to G
+        055755, 072227, 011152, 055655, 044447, 057755, 065555, 025552, // H to O
+        065644, 025563, 065655, 034216, 072222, 055557, 055552, 055775, // P to W
+        055255, 055222, 071247                                          // X to Z
+    };
+
+    static const u32 colorText       = 0xffffffff;
+    static const u32 colorLabel      = 0xffb0b0b0;
+    static const u32 colorBackground = 0xb0000000;
+    static const u32 colorGood       = 0xff40d040;
+    static const u32 colorLate       = 0xff30c0f0;
+    static const u32 colorMissed     = 0xff4040f0;
+
+    void FrameStatsOverlay::init() {
+        LEASSERT(sg_isvalid());
+        vertices = (OverlayVertex*)SDL_malloc(LE_FRAME_STATS_OVERLAY_VERTICES * sizeof(OverlayVertex));
+        numVertices = 0;
+
+        sg_buffer_desc bufferDesc;
+        SDL_memset(&bufferDesc, 0, sizeof(bufferDesc));
+        bufferDesc.size = LE_FRAME_STATS_OVERLAY_VERTICES * sizeof(OverlayVertex);
+        bufferDesc.usage = SG_USAGE_STREAM;
+        bufferDesc.label = "frame stats overlay";
+        vertexBuffer = sg_make_buffer(&bufferDesc);
+
+        sg_shader_desc shaderDesc;
+        SDL_memset(&shaderDesc, 0, sizeof(shaderDesc));
+        shaderDesc.attrs[0].name = "position";
+        shaderDesc.attrs[1].name = "color0";
+        shaderDesc.vs.source =
+            "#version 330\n"
+            "in vec2 position;\n"
+            "in vec4 color0;\n"
+            "out vec4 color;\n"
+            "void main() {\n"
+            "  gl_Position = vec4(position, 0.0, 1.0);\n"
+            "  color = color0;\n"
+            "}\n";
+        shaderDesc.fs.source =
+            "#version 330\n"
+            "in vec4 color;\n"
+            "out vec4 frag_color;\n"
+            "void main() {\n"
+            "  frag_color = color;\n"
+            "}\n";
+        shader = sg_make_shader(&shaderDesc);
+
+        sg_pipeline_desc pipelineDesc;
+        SDL_memset(&pipelineDesc, 0, sizeof(pipelineDesc));
+        pipelineDesc.shader = shader;
+        pipelineDesc.layout.attrs[0].format = SG_VERTEXFORMAT_FLOAT2;
+        pipelineDesc.layout.attrs[1].format = SG_VERTEXFORMAT_UBYTE4N;
+        pipelineDesc.blend.enabled = true;
+        pipelineDesc.blend.src_factor_rgb = SG_BLENDFACTOR_SRC_ALPHA;
+        pipelineDesc.blend.dst_factor_rgb = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
+        pipelineDesc.label = "frame stats overlay";
+        pipeline = sg_make_pipeline(&pipelineDesc);
+
+        // draws over the frame instead of clearing it
+        SDL_memset(&passAction, 0, sizeof(passAction));
+        passAction.colors[0].action = SG_ACTION_LOAD;
+        passAction.depth.action = SG_ACTION_LOAD;
+        passAction.stencil.action = SG_ACTION_LOAD;
+    }
+
+    void FrameStatsOverlay::deinit() {
+        sg_destroy_pipeline(pipeline);
+        sg_destroy_shader(shader);
+        sg_destroy_buffer(vertexBuffer);
+        SDL_free(vertices);
+        vertices = NULL;
+    }
+
+    void FrameStatsOverlay::rect(f32 x, f32 y, f32 w, f32 h, u32 color) {
+        if(numVertices + 6 > LE_FRAME_STATS_OVERLAY_VERTICES) {
+            return;
+        }
+        f32 x0 = x / viewWidth * 2.f - 1.f;
+        f32 x1 = (x + w) / viewWidth * 2.f - 1.f;
+        f32 y0 = 1.f - y / viewHeight * 2.f;
+        f32 y1 = 1.f - (y + h) / viewHeight * 2.f;
+        OverlayVertex* v = vertices + numVertices;
+        v[0] = {x0, y0, color};
+        v[1] = {x1, y0, color};
+        v[2] = {x1, y1, color};
+        v[3] = {x0, y0, color};
+        v[4] = {x1, y1, color};
+        v[5] = {x0, y1, color};
+        numVertices += 6;
+    }
+
+    f32 FrameStatsOverlay::text(f32 x, f32 y, f32 scale, u32 color, const char* str) {
+        for(; *str; ++str) {
+            char c = *str;
+            if((c >= 'a') && (c <= 'z')) {
+                c = (char)(c - 'a' + 'A');
+            }
+            u16 glyph = ((c >= ' ') && (c <= 'Z')) ? glyphs[c - ' '] : 0;
+            for(u32 row=0; row<5; ++row) {
+                u32 bits = (glyph >> ((4 - row) * 3)) & 7;
+                for(u32 column=0; column<3; ++column) {
+                    if(bits & (4 >> column)) {
+                        rect(x + column * scale, y + row * scale, scale, scale, color);
+                    }
+                }
+            }
+            x += 4 * scale;
+        }
+        return x;
+    }
+
+    void FrameStatsOverlay::draw(const FrameStatsSummary& summary, const RenderCounters& counters, f32 budgetMs, int width, int height) {
+        viewWidth = (f32)width;
+        viewHeight = (f32)height;
+        numVertices = 0;
+
+        // scaled with the drawable, so it stays readable on high dpi screens
+        f32 scale = height > 1000 ? 4.f : 2.f;
+        f32 lineHeight = 7 * scale;
+        f32 margin = 4 * scale;
+        f32 graphHeight = 24 * scale;
+        f32 panelWidth = 3 * margin + LE_FRAME_STATS_GRAPH * scale + 4 * margin;
+        rect(margin, margin, panelWidth, 5 * lineHeight + graphHeight + 3 * margin, colorBackground);
+
+        char line[128];
+        f32 x = 2 * margin;
+        f32 y = 2 * margin;
+        SDL_snprintf(line, sizeof(line), "%.2f", summary.lastMs);
+        x = text(text(x, y, scale, colorLabel, "FRAME "), y, scale, colorText, line);
+        SDL_snprintf(line, sizeof(line), "%u", summary.lastAllocations);
+        text(text(x, y, scale, colorLabel, " MS  ALLOCS "), y, scale, colorText, line);
+
+        y += lineHeight;
+        x = 2 * margin;
+        SDL_snprintf(line, sizeof(line), "%.1f", summary.p50);
+        x = text(text(x, y, scale, colorLabel, "P50 "), y, scale, colorText, line);
+        SDL_snprintf(line, sizeof(line), "%.1f", summary.p95);
+        x = text(text(x, y, scale, colorLabel, " P95 "), y, scale, colorText, line);
+        SDL_snprintf(line, sizeof(line), "%.1f", summary.p99);
+        x = text(text(x, y, scale, colorLabel, " P99 "), y, scale, colorText, line);
+        SDL_snprintf(line, sizeof(line), "%.1f", summary.max);
+        text(text(x, y, scale, colorLabel, " MAX "), y, scale, colorText, line);
+
+        y += lineHeight;
+        x = 2 * margin;
+        SDL_snprintf(line, sizeof(line), "%u", counters.draws);
+        x = text(text(x, y, scale, colorLabel, "DRAWS "), y, scale, colorText, line);
+        SDL_snprintf(line, sizeof(line), "%u", counters.passes);
+        x = text(text(x, y, scale, colorLabel, " PASSES "), y, scale, colorText, line);
+        SDL_snprintf(line, sizeof(line), "%u", counters.pipelines);
+        text(text(x, y, scale, colorLabel, " PIPES "), y, scale, colorText, line);
+
+        y += lineHeight;
+        x = 2 * margin;
+        SDL_snprintf(line, sizeof(line), "%u", counters.bindings);
+        x = text(text(x, y, scale, colorLabel, "BINDS "), y, scale, colorText, line);
+        SDL_snprintf(line, sizeof(line), "%u", counters.uniforms);
+        x = text(text(x, y, scale, colorLabel, " UNIFORMS "), y, scale, colorText, line);
+        SDL_snprintf(line, sizeof(line), "%.1f", (f64)counters.uploadBytes / 1024.0);
+        x = text(text(x, y, scale, colorLabel, " UPLOAD "), y, scale, colorText, line);
+        text(x, y, scale, colorLabel, " KB");
+
+        // frame times, the budget at half height
+        y += lineHeight + margin;
+        f32 top = y;
+        for(u32 i=0; i<summary.numGraph; ++i) {
+            f32 ms = summary.graph[i];
+            f32 h = ms / (2.f * budgetMs) * graphHeight;
+            h = h > graphHeight ? graphHeight : h;
+            u32 color = ms <= budgetMs ? colorGood : (ms <= 1.5f * budgetMs ? colorLate : colorMissed);
+            rect(2 * margin + i * scale, top + graphHeight - h, scale, h, color);
+        }
+        rect(2 * margin, top + graphHeight / 2, LE_FRAME_STATS_GRAPH * scale, scale / 2, colorLabel);
+
+        sg_update_buffer(vertexBuffer, vertices, (int)(numVertices * sizeof(OverlayVertex)));
+        sg_begin_default_pass(&passAction, width, height);
+        sg_apply_pipeline(pipeline);
+        sg_bindings bindings;
+        SDL_memset(&bindings, 0, sizeof(bindings));
+        bindings.vertex_buffers[0] = vertexBuffer;
+        sg_apply_bindings(&bindings);
+        sg_draw(0, (int)numVertices, 1);
+        sg_end_pass();
+        sg_commit();
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "leFrameStats.h"
+#include "sokol_gfx.h"
+
+#define LE_FRAME_STATS_OVERLAY_VERTICES 16384
+
+namespace le4 {
+
+#pragma mark - Frame statistics overlay -
+
+    // Counts sokol_gfx calls into counters through its trace hooks, which only exist if
+    // SOKOL_TRACE_HOOKS is defined where sokol_gfx is implemented, see legl.cpp. Call after
+    // sg_setup(). counters is written by whichever thread renders. Returns false if there
+    // are no trace hooks.
+    bool renderCountersInstall(RenderCounters* counters);
+    void renderCountersUninstall(); // puts back the hooks that were installed before
+
+    struct OverlayVertex;
+
+    // Frame time percentiles, render counters and a frame time graph, drawn with sokol_gfx on
+    // top of whatever is in the default framebuffer. The font is built in, 3x5 pixels,
+    // upper case letters, digits and a little punctuation.
+    struct FrameStatsOverlay {
+        sg_buffer       vertexBuffer;
+        sg_shader       shader;
+        sg_pipeline     pipeline;
+        sg_pass_action  passAction;
+        OverlayVertex*  vertices; // LE_FRAME_STATS_OVERLAY_VERTICES
+        u32             numVertices;
+
+        void init();
+        void deinit();
+
+        // budgetMs colours the graph and draws its budget line
+        void draw(const FrameStatsSummary& summary, const RenderCounters& counters, f32 budgetMs, int width, int height);
+
+    private:
+        f32             viewWidth;  // pixels of the frame being drawn
+        f32             viewHeight;
+
+        void rect(f32 x, f32 y, f32 w, f32 h, u32 color); // in pixels from the top left, color is 0xaabbggrr
+        f32 text(f32 x, f32 y, f32 scale, u32 color, const char* str); // returns the x after the text
+    };
+}
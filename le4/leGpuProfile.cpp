@@ -0,0 +1,176 @@
+#include "leGpuProfile.h"
+
+namespace le4 {
+
+    #define LE_GPU_PROFILE_NO_REGION (~0u)
+    #define LE_GPU_PROFILE_CALIBRATION_FRAMES 256 // how often the GPU clock is matched to the CPU's again
+
+    struct GpuProfileFrame {
+        u64         frame;
+        GLuint      queries[LE_GPU_PROFILE_MAX_REGIONS * 2]; // begin and end timestamp of each region
+        const char* names[LE_GPU_PROFILE_MAX_REGIONS];
+        u32         depths[LE_GPU_PROFILE_MAX_REGIONS];
+        u32         numRegions;
+        u32         frameRegion;
+        bool        pending; // queries issued, not read back yet
+    };
+
+    static bool gpuProfileRunning = false;
+    static GpuProfileFrame gpuFrames[LE_GPU_PROFILE_FRAMES];
+    static GpuProfileFrame* current = NULL; // between gpuProfileBeginFrame and gpuProfileEndFrame
+    static u32 depth = 0;
+    static u64 numBegunFrames = 0;
+    static u64 droppedFrames = 0;
+    static u64 overflowRegions = 0;
+    static ProfileThread* lane = NULL;
+
+    // a GPU timestamp and profileTicks() at about the same moment
+    static GLint64 calibrationGpu = 0;
+    static u64 calibrationTicks = 0;
+
+    static GpuProfileRegion lastFrame[LE_GPU_PROFILE_MAX_REGIONS];
+    static u32 numLastFrame = 0;
+    static u64 lastFrameNumber = 0;
+
+    static void calibrate() {
+        // returns the GPU time once all commands so far reached the GPU, without waiting for them to finish
+        glGetInteger64v(GL_TIMESTAMP, &calibrationGpu);
+        calibrationTicks = profileTicks();
+    }
+
+    static u64 gpuToTicks(GLuint64 gpu) {
+        f64 seconds = (f64)((GLint64)gpu - calibrationGpu) * 1e-9;
+        return seconds >= 0 ? calibrationTicks + profileSecondsToTicks(seconds) : calibrationTicks - profileSecondsToTicks(-seconds);
+    }
+
+    bool gpuProfileInit() {
+        GLint bits = 0;
+        glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+        GLASSERT
+        if(bits == 0) {
+            LELOG_INFO(LogCategoryRender, "GPU profiler: no timestamp queries");
+            return false;
+        }
+        for(u32 i=0; i<LE_GPU_PROFILE_FRAMES; ++i) {
+            GpuProfileFrame& gpuFrame = gpuFrames[i];
+            glGenQueries(LE_GPU_PROFILE_MAX_REGIONS * 2, gpuFrame.queries);
+            gpuFrame.numRegions = 0;
+            gpuFrame.pending = false;
+        }
+        GLASSERT
+        calibrate();
+        current = NULL;
+        depth = 0;
+        numBegunFrames = 0;
+        droppedFrames = 0;
+        overflowRegions = 0;
+        numLastFrame = 0;
+        lane = profileLaneRegister("GPU");
+        gpuProfileRunning = true;
+        LELOG_INFO(LogCategoryRender, "GPU profiler: %d bit timestamps, read back %d frames late", bits, LE_GPU_PROFILE_FRAMES);
+        return true;
+    }
+
+    void gpuProfileDeinit() {
+        if(!gpuProfileRunning) {
+            return;
+        }
+        if(droppedFrames || overflowRegions) {
+            LELOG_WARNING(LogCategoryRender, "GPU profiler: %llu frames weren't done in time, %llu regions didn't fit", droppedFrames, overflowRegions);
+        }
+        for(u32 i=0; i<LE_GPU_PROFILE_FRAMES; ++i) {
+            glDeleteQueries(LE_GPU_PROFILE_MAX_REGIONS * 2, gpuFrames[i].queries);
+        }
+        GLASSERT
+        gpuProfileRunning = false;
+        current = NULL;
+        lane = NULL;
+    }
+
+    static void readBack(GpuProfileFrame& gpuFrame) {
+        // results of one frame come in order, once its last query is done all of them are
+        GLint available = 0;
+        glGetQueryObjectiv(gpuFrame.queries[gpuFrame.frameRegion * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) {
+            droppedFrames++;
+            return;
+        }
+        for(u32 i=0; i<gpuFrame.numRegions; ++i) {
+            GLuint64 begin, end;
+            glGetQueryObjectui64v(gpuFrame.queries[i * 2], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(gpuFrame.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+            end = end > begin ? end : begin;
+            lastFrame[i].name = gpuFrame.names[i];
+            lastFrame[i].depth = gpuFrame.depths[i];
+            lastFrame[i].ms = (f64)(end - begin) * 1e-6;
+            if(lane) {
+                // counted into the frame that issued them, not the one reading them back
+                profileLaneRecord(lane, gpuFrame.frame, gpuFrame.names[i], gpuToTicks(begin), gpuToTicks(end), gpuFrame.depths[i]);
+            }
+        }
+        GLASSERT
+        numLastFrame = gpuFrame.numRegions;
+        lastFrameNumber = gpuFrame.frame;
+    }
+
+    void gpuProfileBeginFrame(u64 frame) {
+        if(!gpuProfileRunning) {
+            return;
+        }
+        GpuProfileFrame& gpuFrame = gpuFrames[numBegunFrames % LE_GPU_PROFILE_FRAMES];
+        if(gpuFrame.pending) {
+            readBack(gpuFrame);
+        }
+        if(numBegunFrames % LE_GPU_PROFILE_CALIBRATION_FRAMES == 0) {
+            calibrate();
+        }
+        numBegunFrames++;
+        gpuFrame.frame = frame;
+        gpuFrame.numRegions = 0;
+        gpuFrame.pending = false;
+        current = &gpuFrame;
+        depth = 0;
+        gpuFrame.frameRegion = gpuProfileBegin("GPU frame");
+    }
+
+    void gpuProfileEndFrame() {
+        if(!current) {
+            return;
+        }
+        gpuProfileEnd(current->frameRegion);
+        current->pending = true;
+        current = NULL;
+    }
+
+    u32 gpuProfileBegin(const char* name) {
+        if(!current) {
+            return LE_GPU_PROFILE_NO_REGION;
+        }
+        if(current->numRegions == LE_GPU_PROFILE_MAX_REGIONS) {
+            overflowRegions++;
+            return LE_GPU_PROFILE_NO_REGION;
+        }
+        u32 region = current->numRegions++;
+        current->names[region] = name;
+        current->depths[region] = depth++;
+        glQueryCounter(current->queries[region * 2], GL_TIMESTAMP);
+        return region;
+    }
+
+    void gpuProfileEnd(u32 region) {
+        if(!current || (region == LE_GPU_PROFILE_NO_REGION)) {
+            return;
+        }
+        depth--;
+        glQueryCounter(current->queries[region * 2 + 1], GL_TIMESTAMP);
+    }
+
+    u32 gpuProfileLastFrame(GpuProfileRegion* regions, u32 maxRegions, u64* frame) {
+        u32 n = numLastFrame < maxRegions ? numLastFrame : maxRegions;
+        SDL_memcpy(regions, lastFrame, n * sizeof(GpuProfileRegion));
+        if(frame) {
+            *frame = lastFrameNumber;
+        }
+        return n;
+    }
+}
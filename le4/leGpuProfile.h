@@ -0,0 +1,58 @@
+#pragma once
+
+#include "legl.h"
+#include "leProfile.h"
+
+// frames of queries in flight, results are read back this many frames late so nothing waits for the GPU
+#ifndef LE_GPU_PROFILE_FRAMES
+#define LE_GPU_PROFILE_FRAMES 4
+#endif
+
+#define LE_GPU_PROFILE_MAX_REGIONS 64 // per frame, including the whole frame's
+
+namespace le4 {
+
+#pragma mark - GPU profiler -
+
+    // GPU time of a region of GL commands
+    struct GpuProfileRegion {
+        const char* name;
+        u32         depth;
+        f64         ms;
+    };
+
+    // Times regions of GL commands with a GL_TIMESTAMP query at either end, from a pool per frame
+    // in flight. Timestamps rather than GL_TIME_ELAPSED queries, which can't nest, and which
+    // couldn't be placed on the CPU timeline. Read back results go into the profiler's "GPU"
+    // lane, converted to profileTicks(), so they line up with the CPU zones that issued them,
+    // and count towards the per frame stats of the frame that issued them.
+    // All calls must come from the thread the GL context is current on.
+    bool gpuProfileInit(); // false if the context has no timer queries, all other calls do nothing then
+    void gpuProfileDeinit();
+
+    // Brackets the GL commands of a frame. Begin reads back the frame LE_GPU_PROFILE_FRAMES ago,
+    // or drops it if the GPU hasn't finished it yet.
+    void gpuProfileBeginFrame(u64 frame);
+    void gpuProfileEndFrame();
+
+    u32 gpuProfileBegin(const char* name); // name must outlive the profiler, e.g. a literal
+    void gpuProfileEnd(u32 region);
+
+    // regions of the last frame read back, in the order they began. Returns how many were written.
+    u32 gpuProfileLastFrame(GpuProfileRegion* regions, u32 maxRegions, u64* frame);
+
+    struct GpuProfileScope {
+        u32 region;
+
+        GpuProfileScope(const char* name) { region = gpuProfileBegin(name); }
+        ~GpuProfileScope() { gpuProfileEnd(region); }
+    };
+
+    // Times the GL commands of the rest of the enclosing block, compiled out with LE_PROFILE=0.
+    // Use names that differ from CPU zones, per frame stats aggregate zones by name.
+#if LE_PROFILE
+#define LE_GPU_PROFILE_SCOPE(name) le4::GpuProfileScope LE_PROFILE_CONCAT(leGpuProfileScope, __LINE__)(name)
+#else
+#define LE_GPU_PROFILE_SCOPE(name)
+#endif
+}
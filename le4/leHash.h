@@ -0,0 +1,249 @@
+#pragma once
+
+#include "le4.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace le4 {
+
+#pragma mark - Hash64 -
+
+    // 64 bit hash over (pointer, length), based on wyhash (final version 4).
+    // Inputs of LE_HASH_BULK_SIZE bytes or more first run through 8 independent 64 bit lanes in
+    // 64 byte stripes, in the style of xxh3, which map onto SSE2/NEON multiplies. The scalar,
+    // SIMD and constexpr paths produce the same values, so hashes computed at compile time with
+    // LE_HASH can be compared against runtime hashes of the same bytes.
+    // Values depend on byte order and are only meant to be used within one process or platform.
+    #define LE_HASH_BULK_SIZE 512
+
+    namespace hash {
+
+        static constexpr u64 secret[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+        static constexpr u64 laneKeys[8] = {0x8767ea4ffb591633ull, 0x21ed7d442bfa162dull, 0xfb97d2f5e084ca01ull, 0x5a46806abd97661bull,
+                                            0xe1258bde8641735bull, 0xce156b326f35e5f8ull, 0xb3ae7d6835f1650cull, 0xe77ee2de1d1c748full};
+
+        constexpr u64 mix(u64 a, u64 b) {
+            return (u64)((unsigned __int128)a * b) ^ (u64)(((unsigned __int128)a * b) >> 64);
+        }
+
+        // every 16 stripes, keeps the lanes from saturating their high bits
+        constexpr void scramble(u64* acc) {
+            for(u32 j=0; j<8; ++j) {
+                u64 a = acc[j];
+                a ^= a >> 47;
+                a ^= laneKeys[j];
+                acc[j] = a * 0x9e3779b1ull;
+            }
+        }
+
+        // reads bytes of a char array one at a time, usable in constant expressions
+        struct ConstexprReader {
+            static constexpr u64 r8(const char* p) {
+                return (u64)(u8)p[0] | ((u64)(u8)p[1] << 8) | ((u64)(u8)p[2] << 16) | ((u64)(u8)p[3] << 24) |
+                       ((u64)(u8)p[4] << 32) | ((u64)(u8)p[5] << 40) | ((u64)(u8)p[6] << 48) | ((u64)(u8)p[7] << 56);
+            }
+            static constexpr u64 r4(const char* p) {
+                return (u64)(u8)p[0] | ((u64)(u8)p[1] << 8) | ((u64)(u8)p[2] << 16) | ((u64)(u8)p[3] << 24);
+            }
+            static constexpr u64 r1(const char* p) {
+                return (u8)p[0];
+            }
+            static constexpr void stripes(u64* acc, const char* p, size_t n) {
+                for(size_t s=0; s<n; ++s, p+=64) {
+                    for(u32 j=0; j<8; ++j) {
+                        u64 d = r8(p + 8*j);
+                        u64 dk = d ^ laneKeys[j];
+                        acc[j ^ 1] += d;
+                        acc[j] += (dk & 0xffffffff) * (dk >> 32);
+                    }
+                    if((s & 15) == 15) {
+                        scramble(acc);
+                    }
+                }
+            }
+        };
+
+        // unaligned little endian loads and the SIMD stripe loop
+        struct RuntimeReader {
+            static inline u64 r8(const u8* p) { u64 v; SDL_memcpy(&v, p, 8); return v; }
+            static inline u64 r4(const u8* p) { u32 v; SDL_memcpy(&v, p, 4); return v; }
+            static inline u64 r1(const u8* p) { return *p; }
+
+            static inline void stripes(u64* acc, const u8* p, size_t n) {
+#if defined(__SSE2__)
+                __m128i a[4];
+                for(u32 j=0; j<4; ++j) {
+                    a[j] = _mm_loadu_si128((const __m128i*)(acc + 2*j));
+                }
+                for(size_t s=0; s<n; ++s, p+=64) {
+                    for(u32 j=0; j<4; ++j) {
+                        __m128i d = _mm_loadu_si128((const __m128i*)(p + 16*j));
+                        __m128i dk = _mm_xor_si128(d, _mm_loadu_si128((const __m128i*)(laneKeys + 2*j)));
+                        __m128i product = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+                        __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+                        a[j] = _mm_add_epi64(a[j], _mm_add_epi64(product, swapped));
+                    }
+                    if((s & 15) == 15) {
+                        for(u32 j=0; j<4; ++j) {
+                            _mm_storeu_si128((__m128i*)(acc + 2*j), a[j]);
+                        }
+                        scramble(acc);
+                        for(u32 j=0; j<4; ++j) {
+                            a[j] = _mm_loadu_si128((const __m128i*)(acc + 2*j));
+                        }
+                    }
+                }
+                for(u32 j=0; j<4; ++j) {
+                    _mm_storeu_si128((__m128i*)(acc + 2*j), a[j]);
+                }
+#elif defined(__ARM_NEON)
+                uint64x2_t a[4];
+                for(u32 j=0; j<4; ++j) {
+                    a[j] = vld1q_u64(acc + 2*j);
+                }
+                for(size_t s=0; s<n; ++s, p+=64) {
+                    for(u32 j=0; j<4; ++j) {
+                        uint64x2_t d = vreinterpretq_u64_u8(vld1q_u8(p + 16*j));
+                        uint64x2_t dk = veorq_u64(d, vld1q_u64(laneKeys + 2*j));
+                        uint64x2_t product = vmull_u32(vmovn_u64(dk), vshrn_n_u64(dk, 32));
+                        uint64x2_t swapped = vextq_u64(d, d, 1);
+                        a[j] = vaddq_u64(a[j], vaddq_u64(product, swapped));
+                    }
+                    if((s & 15) == 15) {
+                        for(u32 j=0; j<4; ++j) {
+                            vst1q_u64(acc + 2*j, a[j]);
+                        }
+                        scramble(acc);
+                        for(u32 j=0; j<4; ++j) {
+                            a[j] = vld1q_u64(acc + 2*j);
+                        }
+                    }
+                }
+                for(u32 j=0; j<4; ++j) {
+                    vst1q_u64(acc + 2*j, a[j]);
+                }
+#else
+                for(size_t s=0; s<n; ++s, p+=64) {
+                    for(u32 j=0; j<8; ++j) {
+                        u64 d = r8(p + 8*j);
+                        u64 dk = d ^ laneKeys[j];
+                        acc[j ^ 1] += d;
+                        acc[j] += (dk & 0xffffffff) * (dk >> 32);
+                    }
+                    if((s & 15) == 15) {
+                        scramble(acc);
+                    }
+                }
+#endif
+            }
+        };
+
+        template<typename Reader, typename Ptr>
+        constexpr u64 wyhash(Ptr p, size_t len, u64 seed) {
+            seed ^= mix(seed ^ secret[0], secret[1]);
+            u64 a = 0;
+            u64 b = 0;
+            if(len <= 16) {
+                if(len >= 4) {
+                    a = (Reader::r4(p) << 32) | Reader::r4(p + ((len >> 3) << 2));
+                    b = (Reader::r4(p + len - 4) << 32) | Reader::r4(p + len - 4 - ((len >> 3) << 2));
+                } else if(len > 0) {
+                    a = (Reader::r1(p) << 16) | (Reader::r1(p + (len >> 1)) << 8) | Reader::r1(p + len - 1);
+                }
+            } else {
+                size_t i = len;
+                if(i >= LE_HASH_BULK_SIZE) {
+                    u64 acc[8] = {seed, laneKeys[1], laneKeys[2], seed ^ laneKeys[3],
+                                  laneKeys[4], seed ^ laneKeys[5], laneKeys[6], laneKeys[7]};
+                    size_t n = i / 64;
+                    Reader::stripes(acc, p, n);
+                    for(u32 j=0; j<8; j+=2) {
+                        seed ^= mix(acc[j] ^ secret[j >> 1], acc[j+1] ^ seed);
+                    }
+                    p += n * 64;
+                    i -= n * 64;
+                }
+                if(i > 48) {
+                    u64 see1 = seed;
+                    u64 see2 = seed;
+                    do {
+                        seed = mix(Reader::r8(p) ^ secret[1], Reader::r8(p + 8) ^ seed);
+                        see1 = mix(Reader::r8(p + 16) ^ secret[2], Reader::r8(p + 24) ^ see1);
+                        see2 = mix(Reader::r8(p + 32) ^ secret[3], Reader::r8(p + 40) ^ see2);
+                        p += 48;
+                        i -= 48;
+                    } while(i > 48);
+                    seed ^= see1 ^ see2;
+                }
+                while(i > 16) {
+                    seed = mix(Reader::r8(p) ^ secret[1], Reader::r8(p + 8) ^ seed);
+                    i -= 16;
+                    p += 16;
+                }
+                // may overlap already hashed bytes, len is > 16
+                a = Reader::r8(p + i - 16);
+                b = Reader::r8(p + i - 8);
+            }
+            a ^= secret[1];
+            b ^= seed;
+            unsigned __int128 r = (unsigned __int128)a * b;
+            a = (u64)r;
+            b = (u64)(r >> 64);
+            return mix(a ^ secret[0] ^ len, b ^ secret[1]);
+        }
+    }
+
+    inline u64 hash64(const void* data, size_t len, u64 seed = 0) {
+        return hash::wyhash<hash::RuntimeReader>((const u8*)data, len, seed);
+    }
+
+    inline u64 hash64(const char* s) {
+        return hash64(s, SDL_strlen(s));
+    }
+
+    // same value as hash64(s, N-1, seed), can be evaluated at compile time
+    template<size_t N>
+    constexpr u64 hash64Literal(const char (&s)[N], u64 seed = 0) {
+        return hash::wyhash<hash::ConstexprReader>((const char*)s, N - 1, seed);
+    }
+
+    // hash64 of a string literal, forced to be computed at compile time
+#define LE_HASH(literal) (std::integral_constant<le4::u64, le4::hash64Literal(literal)>::value)
+
+    // order dependent
+    constexpr u64 hashCombine(u64 h, u64 value) {
+        return hash::mix(h ^ hash::secret[0], value ^ hash::secret[2]);
+    }
+
+    // Combines the hashes of several fields into one, e.g. for pipeline or render state
+    // descriptors. Add fields individually rather than whole structs, padding bytes are undefined.
+    // The result differs from hash64 over the concatenated bytes.
+    struct Hasher {
+        u64 state;
+
+        void init(u64 seed = 0) { state = seed; }
+
+        Hasher& add(const void* data, size_t len) {
+            state = hashCombine(state, hash64(data, len, len));
+            return *this;
+        }
+
+        Hasher& add(const char* s) { return add(s, SDL_strlen(s)); }
+
+        template<typename T> Hasher& add(const T& value) {
+            static_assert(std::is_trivially_copyable<T>::value, "only plain values can be hashed as bytes");
+            return add(&value, sizeof(T));
+        }
+
+        Hasher& addHash(u64 h) {
+            state = hashCombine(state, h);
+            return *this;
+        }
+
+        u64 finish() const { return state; }
+    };
+}
@@ -0,0 +1,338 @@
+#pragma once
+
+#include "le4.h"
+#include "leHash.h"
+#include <new>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace le4 {
+
+#pragma mark - HashMap -
+
+    // default hashing and equality for HashMap keys. Plain values are hashed by their bytes,
+    // specialise for keys with padding or indirection.
+    template<typename K>
+    struct HashTraits {
+        static u64 hash(const K& key) { return hash64(&key, sizeof(K)); }
+        static bool equal(const K& l, const K& r) { return l == r; }
+    };
+
+    // 0 terminated strings, compared by content. The map doesn't copy them.
+    template<>
+    struct HashTraits<const char*> {
+        static u64 hash(const char* key) { return hash64(key); }
+        static bool equal(const char* l, const char* r) { return !SDL_strcmp(l, r); }
+    };
+
+    namespace hashmap {
+
+        enum : u8 {
+            Empty   = 0x80,
+            Deleted = 0xfe
+            // full slots store the low 7 bits of the hash
+        };
+
+        enum {
+            GroupSize = 16
+        };
+
+        // bits of matching control bytes, one bit per slot (or 4 per slot with NEON)
+        struct BitMask {
+            u64 bits;
+
+            bool any() const { return bits != 0; }
+            u32 next() const { return (u32)__builtin_ctzll(bits) / Shift; }
+            void clear() { bits &= bits - 1; }
+            u32 trailingZeros() const { return bits ? (u32)__builtin_ctzll(bits) / Shift : GroupSize; }
+            u32 leadingZeros() const { return bits ? ((u32)__builtin_clzll(bits) - (64 - GroupSize * Shift)) / Shift : GroupSize; }
+#if defined(__ARM_NEON) && !defined(__SSE2__)
+            enum { Shift = 4 };
+#else
+            enum { Shift = 1 };
+#endif
+        };
+
+        // 16 control bytes, matched in parallel
+        struct Group {
+#if defined(__SSE2__)
+            __m128i ctrl;
+
+            Group(const u8* p) : ctrl(_mm_loadu_si128((const __m128i*)p)) {}
+            BitMask match(u8 h2) const {
+                BitMask result = {(u64)(u16)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2)))};
+                return result;
+            }
+            BitMask matchEmpty() const { return match(Empty); }
+            // empty or deleted, both have the high bit set
+            BitMask matchFree() const {
+                BitMask result = {(u64)(u16)_mm_movemask_epi8(ctrl)};
+                return result;
+            }
+#elif defined(__ARM_NEON)
+            uint8x16_t ctrl;
+
+            Group(const u8* p) : ctrl(vld1q_u8(p)) {}
+            static BitMask toMask(uint8x16_t eq) {
+                // narrow each byte to a nibble
+                uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+                BitMask result = {vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ull};
+                return result;
+            }
+            BitMask match(u8 h2) const { return toMask(vceqq_u8(ctrl, vdupq_n_u8(h2))); }
+            BitMask matchEmpty() const { return match(Empty); }
+            BitMask matchFree() const { return toMask(vcltzq_s8(vreinterpretq_s8_u8(ctrl))); }
+#else
+            u8 ctrl[GroupSize];
+
+            Group(const u8* p) { SDL_memcpy(ctrl, p, GroupSize); }
+            BitMask match(u8 h2) const {
+                BitMask result = {0};
+                for(u32 i=0; i<GroupSize; ++i) {
+                    result.bits |= (u64)(ctrl[i] == h2) << i;
+                }
+                return result;
+            }
+            BitMask matchEmpty() const { return match(Empty); }
+            BitMask matchFree() const {
+                BitMask result = {0};
+                for(u32 i=0; i<GroupSize; ++i) {
+                    result.bits |= (u64)(ctrl[i] >> 7) << i;
+                }
+                return result;
+            }
+#endif
+        };
+    }
+
+    // Open addressing hash map in the style of Swiss tables. Each slot has a control byte that
+    // holds 7 bits of its key's hash, or marks it empty or deleted. Lookups compare 16 control
+    // bytes at once and only touch keys whose hash bits match. The control bytes of the first
+    // group are mirrored past the end, so any 16 byte window can be loaded without wrapping.
+    // Keys and values are moved on growth, pointers into the map are invalidated by insertions.
+    template<typename K, typename V, typename Allocator = HeapAllocator, typename Traits = HashTraits<K>>
+    struct HashMap {
+        struct Slot {
+            K key;
+            V value;
+        };
+
+        void init(Allocator inAllocator = Allocator(), u32 initialCapacity = 0) {
+            allocator = inAllocator;
+            ctrl = NULL;
+            slots = NULL;
+            capacity = 0;
+            numEntries = 0;
+            growthLeft = 0;
+            if(initialCapacity) {
+                reserve(initialCapacity);
+            }
+        }
+
+        void deinit() {
+            clear();
+            release();
+        }
+
+        u32 count() const { return numEntries; }
+
+        V* find(const K& key) { return find(key, Traits::hash(key)); }
+
+        // heterogeneous lookup: query can be any type Traits::equal(K, Q) accepts,
+        // hash must be Traits::hash of the equivalent key
+        template<typename Q> V* find(const Q& query, u64 hash) {
+            Slot* slot = findSlot(query, hash);
+            return slot ? &slot->value : NULL;
+        }
+
+        // inserts or overwrites, returns the stored value
+        V* insert(const K& key, const V& value) {
+            bool inserted;
+            V* result = findOrInsert(key, Traits::hash(key), &inserted);
+            *result = value;
+            return result;
+        }
+
+        // returns the value for key, default constructing it first if needed
+        V* findOrInsert(const K& key, u64 hash, bool* inserted = NULL) {
+            Slot* slot = findSlot(key, hash);
+            if(inserted) {
+                *inserted = slot == NULL;
+            }
+            if(slot) {
+                return &slot->value;
+            }
+            if(!growthLeft) {
+                rehash(numEntries + 1);
+            }
+            u32 i = findFree(hash);
+            growthLeft -= ctrl[i] == hashmap::Empty ? 1 : 0;
+            setCtrl(i, h2(hash));
+            new (&slots[i]) Slot{key, V()};
+            numEntries++;
+            return &slots[i].value;
+        }
+
+        V* findOrInsert(const K& key, bool* inserted = NULL) { return findOrInsert(key, Traits::hash(key), inserted); }
+
+        bool remove(const K& key) { return remove(key, Traits::hash(key)); }
+
+        template<typename Q> bool remove(const Q& query, u64 hash) {
+            Slot* slot = findSlot(query, hash);
+            if(!slot) {
+                return false;
+            }
+            u32 i = (u32)(slot - slots);
+            slot->~Slot();
+            // if every 16 slot window containing i has always had an empty slot, no probe sequence
+            // ever went past i, so it can go back to empty instead of leaving a tombstone
+            u32 before = (i - hashmap::GroupSize) & (capacity - 1);
+            hashmap::BitMask emptyBefore = hashmap::Group(ctrl + before).matchEmpty();
+            hashmap::BitMask emptyAfter = hashmap::Group(ctrl + i).matchEmpty();
+            bool wasNeverFull = emptyBefore.any() && emptyAfter.any() &&
+                                (emptyAfter.trailingZeros() + emptyBefore.leadingZeros() < hashmap::GroupSize);
+            setCtrl(i, wasNeverFull ? hashmap::Empty : hashmap::Deleted);
+            growthLeft += wasNeverFull ? 1 : 0;
+            numEntries--;
+            return true;
+        }
+
+        void clear() {
+            for(u32 i=0; i<capacity; ++i) {
+                if(!(ctrl[i] & 0x80)) {
+                    slots[i].~Slot();
+                }
+            }
+            if(capacity) {
+                SDL_memset(ctrl, hashmap::Empty, capacity + hashmap::GroupSize);
+            }
+            numEntries = 0;
+            growthLeft = maxLoad(capacity);
+        }
+
+        void reserve(u32 n) {
+            if(n > maxLoad(capacity)) {
+                rehash(n);
+            }
+        }
+
+        // calls fn(const K&, V&) for each entry. fn must not insert or remove entries.
+        template<typename F> void forEach(F fn) {
+            for(u32 i=0; i<capacity; ++i) {
+                if(!(ctrl[i] & 0x80)) {
+                    fn((const K&)slots[i].key, slots[i].value);
+                }
+            }
+        }
+
+    private:
+        Allocator   allocator;
+        u8*         ctrl;       // capacity + GroupSize bytes, the last group mirrors the first
+        Slot*       slots;
+        u32         capacity;   // 0 or a power of 2 >= GroupSize
+        u32         numEntries;
+        u32         growthLeft; // inserts into empty slots until a rehash is due
+
+        static u32 maxLoad(u32 cap) { return cap - cap / 8; }
+        static u64 h1(u64 hash) { return hash >> 7; }
+        static u8 h2(u64 hash) { return (u8)(hash & 0x7f); }
+
+        void setCtrl(u32 i, u8 c) {
+            ctrl[i] = c;
+            // mirror into the cloned bytes past the end
+            if(i < hashmap::GroupSize) {
+                ctrl[capacity + i] = c;
+            }
+        }
+
+        template<typename Q> Slot* findSlot(const Q& query, u64 hash) {
+            if(!capacity) {
+                return NULL;
+            }
+            u32 mask = capacity - 1;
+            u32 pos = (u32)h1(hash) & mask;
+            u8 tag = h2(hash);
+            for(u32 step = hashmap::GroupSize; ; step += hashmap::GroupSize) {
+                hashmap::Group group(ctrl + pos);
+                for(hashmap::BitMask m = group.match(tag); m.any(); m.clear()) {
+                    u32 i = (pos + m.next()) & mask;
+                    if(Traits::equal(slots[i].key, query)) {
+                        return &slots[i];
+                    }
+                }
+                if(group.matchEmpty().any()) {
+                    return NULL;
+                }
+                pos = (pos + step) & mask;
+            }
+        }
+
+        // first empty or deleted slot on the probe sequence of hash
+        u32 findFree(u64 hash) const {
+            u32 mask = capacity - 1;
+            u32 pos = (u32)h1(hash) & mask;
+            for(u32 step = hashmap::GroupSize; ; step += hashmap::GroupSize) {
+                hashmap::BitMask m = hashmap::Group(ctrl + pos).matchFree();
+                if(m.any()) {
+                    return (pos + m.next()) & mask;
+                }
+                pos = (pos + step) & mask;
+            }
+        }
+
+        size_t allocationSize(u32 cap) const {
+            size_t ctrlSize = (cap + hashmap::GroupSize + alignof(Slot) - 1) & ~(size_t)(alignof(Slot) - 1);
+            return ctrlSize + sizeof(Slot) * cap;
+        }
+
+        void release() {
+            if(capacity) {
+                allocator.free(ctrl, allocationSize(capacity));
+            }
+            ctrl = NULL;
+            slots = NULL;
+            capacity = 0;
+            growthLeft = 0;
+        }
+
+        // moves all entries into a new table big enough for n entries, which also drops tombstones
+        void rehash(u32 n) {
+            // never shrinks. Rehashes at the same size if it's mostly tombstones that are in the way.
+            u32 newCapacity = capacity ? capacity : hashmap::GroupSize;
+            while((maxLoad(newCapacity) < n) || ((newCapacity == capacity) && (n > maxLoad(capacity) / 2))) {
+                newCapacity *= 2;
+            }
+
+            u8* oldCtrl = ctrl;
+            Slot* oldSlots = slots;
+            u32 oldCapacity = capacity;
+
+            size_t size = allocationSize(newCapacity);
+            size_t align = alignof(Slot) > 16 ? alignof(Slot) : 16;
+            ctrl = (u8*)allocator.alloc(size, align);
+            LEASSERTM(ctrl != NULL, "hash map out of memory");
+            slots = (Slot*)(ctrl + (size - sizeof(Slot) * newCapacity));
+            capacity = newCapacity;
+            SDL_memset(ctrl, hashmap::Empty, capacity + hashmap::GroupSize);
+            growthLeft = maxLoad(capacity) - numEntries;
+
+            for(u32 i=0; i<oldCapacity; ++i) {
+                if(!(oldCtrl[i] & 0x80)) {
+                    u64 hash = Traits::hash(oldSlots[i].key);
+                    u32 j = findFree(hash);
+                    setCtrl(j, h2(hash));
+                    new (&slots[j]) Slot(std::move(oldSlots[i]));
+                    oldSlots[i].~Slot();
+                }
+            }
+            if(oldCapacity) {
+                allocator.free(oldCtrl, allocationSize(oldCapacity));
+            }
+        }
+    };
+}
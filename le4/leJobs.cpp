@@ -0,0 +1,404 @@
+#include "leJobs.h"
+#include "leMetrics.h"
+#include "leProfile.h"
+#include "leQueue.h"
+
+#include <pthread.h>
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+// Chase-Lev deques as formulated for C11 atomics by Lê, Pop, Cohen and Zappa Nardelli,
+// "Correct and Efficient Work-Stealing for Weak Memory Models". Jobs live in a ring per thread,
+// a slot is only reused once its job finished. Jobs waiting for a dependency or running long
+// keep their slot while the ring wraps around them, which keeps the deques fixed size as well.
+
+#define LE_JOBS_SPINS 64
+
+namespace le4 {
+
+    struct Job {
+        JobFunction         function;
+        JobRangeFunction    rangeFunction;
+        void*               userData;
+        JobCounter*         counter;
+        Job*                nextWaiting;
+        u32                 begin;
+        u32                 end;
+        u32                 grainSize;
+        std::atomic<u32>    busy;   // from allocJob() until finished, set and reused by the owner only
+        u8                  padding[LE_CACHE_LINE_SIZE - 5 * sizeof(void*) - 4 * sizeof(u32)];
+    };
+
+    struct JobDeque {
+        u8                  padding0[LE_CACHE_LINE_SIZE];
+        std::atomic<s64>    top;    // stolen from
+        u8                  padding1[LE_CACHE_LINE_SIZE - sizeof(s64)];
+        std::atomic<s64>    bottom; // pushed and popped by the owner
+        u8                  padding2[LE_CACHE_LINE_SIZE - sizeof(s64)];
+        std::atomic<Job*>   items[LE_JOBS_PER_THREAD];
+
+        void push(Job* job) {
+            s64 b = bottom.load(std::memory_order_relaxed);
+            s64 t = top.load(std::memory_order_acquire);
+            LEASSERTM(b - t < LE_JOBS_PER_THREAD, "job deque overflow");
+            items[b & (LE_JOBS_PER_THREAD - 1)].store(job, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        Job* pop() {
+            s64 b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            s64 t = top.load(std::memory_order_relaxed);
+            Job* job = NULL;
+            if(t <= b) {
+                job = items[b & (LE_JOBS_PER_THREAD - 1)].load(std::memory_order_relaxed);
+                if(t == b) {
+                    // last job, race thieves for it
+                    if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                        job = NULL;
+                    }
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                }
+            } else {
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+
+        Job* steal() {
+            s64 t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            s64 b = bottom.load(std::memory_order_acquire);
+            if(t < b) {
+                Job* job = items[t & (LE_JOBS_PER_THREAD - 1)].load(std::memory_order_acquire);
+                if(top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    return job;
+                }
+            }
+            return NULL;
+        }
+
+        bool empty() const {
+            return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+        }
+    };
+
+    // per thread state, index 0 is the main thread
+    struct JobThread {
+        JobDeque            deque;
+        Job                 jobs[LE_JOBS_PER_THREAD];
+        u32                 nextJob;
+        u32                 randomState;
+        SDL_Thread*         thread;
+    };
+
+    static JobThread* threads = NULL;
+    static u32 numThreads = 0;
+    static bool pinThreads = false;
+    static std::atomic<bool> running(false);
+    static QueueSignal workAvailable;
+    static thread_local JobThread* threadSelf = NULL;
+
+    void JobCounter::init() {
+        pending.store(0);
+        lock = 0;
+        waiting = NULL;
+    }
+
+    struct JobSystem {
+        static Job* allocJob() {
+            JobThread* self = threadSelf;
+            LEASSERTM(self != NULL, "jobs can only be queued from the main thread or other jobs");
+            // skip slots of jobs that are still queued, waiting for a dependency or running
+            Job* job = &self->jobs[self->nextJob++ & (LE_JOBS_PER_THREAD - 1)];
+            for(u32 i=1; job->busy.load(std::memory_order_acquire); ++i) {
+                LEASSERTM(i < LE_JOBS_PER_THREAD, "more than %d unfinished jobs queued from one thread", LE_JOBS_PER_THREAD);
+                job = &self->jobs[self->nextJob++ & (LE_JOBS_PER_THREAD - 1)];
+            }
+            job->busy.store(1, std::memory_order_relaxed);
+            job->function = NULL;
+            job->rangeFunction = NULL;
+            job->counter = NULL;
+            job->nextWaiting = NULL;
+            return job;
+        }
+
+        static void queue(Job* job) {
+            threadSelf->deque.push(job);
+            workAvailable.notify();
+        }
+
+        static void addToCounter(JobCounter* counter, u32 n) {
+            if(counter) {
+                counter->pending.fetch_add(n, std::memory_order_relaxed);
+            }
+        }
+
+        // queues job once dependency is done, or right away if it is already
+        static void queueAfter(JobCounter* dependency, Job* job) {
+            SDL_AtomicLock(&dependency->lock);
+            if(dependency->pending.load(std::memory_order_acquire)) {
+                job->nextWaiting = dependency->waiting;
+                dependency->waiting = job;
+                job = NULL;
+            }
+            SDL_AtomicUnlock(&dependency->lock);
+            if(job) {
+                queue(job);
+            }
+        }
+
+        static void finish(Job* job) {
+            JobCounter* counter = job->counter;
+            if(!counter) {
+                return;
+            }
+            u32 pending = counter->pending.load(std::memory_order_relaxed);
+            while(pending > 1) {
+                if(counter->pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                    return;
+                }
+            }
+            // the count only drops to 0 under the lock, so jobsWait can tell when we're done
+            // touching the counter and its owner may free it
+            SDL_AtomicLock(&counter->lock);
+            Job* waiting = NULL;
+            if(counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                waiting = counter->waiting;
+                counter->waiting = NULL;
+            }
+            SDL_AtomicUnlock(&counter->lock);
+            while(waiting) {
+                Job* next = waiting->nextWaiting;
+                queue(waiting);
+                waiting = next;
+            }
+        }
+
+        // the last job may still hold the lock right after the count dropped to 0
+        static void settle(JobCounter* counter) {
+            SDL_AtomicLock(&counter->lock);
+            SDL_AtomicUnlock(&counter->lock);
+        }
+
+        static void execute(Job* job) {
+            if(job->rangeFunction) {
+                // split off the upper halves for others to steal, keep the lowest part
+                while(job->end - job->begin > job->grainSize) {
+                    u32 mid = job->begin + (job->end - job->begin) / 2;
+                    Job* half = allocJob();
+                    half->rangeFunction = job->rangeFunction;
+                    half->userData = job->userData;
+                    half->counter = job->counter;
+                    half->begin = mid;
+                    half->end = job->end;
+                    half->grainSize = job->grainSize;
+                    addToCounter(job->counter, 1);
+                    queue(half);
+                    job->end = mid;
+                }
+                job->rangeFunction(job->userData, job->begin, job->end);
+            } else {
+                job->function(job->userData);
+            }
+            LE_COUNTER_ADD(JobsRun, 1);
+            finish(job);
+            // the owner may hand out the slot again from here on
+            job->busy.store(0, std::memory_order_release);
+        }
+
+        static Job* find() {
+            JobThread* self = threadSelf;
+            Job* job = self->deque.pop();
+            if(job) {
+                return job;
+            }
+            // start stealing at a random thread, so thieves don't all pile onto the same deque
+            self->randomState ^= self->randomState << 13;
+            self->randomState ^= self->randomState >> 17;
+            self->randomState ^= self->randomState << 5;
+            u32 start = self->randomState % numThreads;
+            for(u32 i=0; i<numThreads; ++i) {
+                JobThread* victim = &threads[(start + i) % numThreads];
+                if(victim != self) {
+                    job = victim->deque.steal();
+                    if(job) {
+                        return job;
+                    }
+                }
+            }
+            return NULL;
+        }
+
+        static bool anyQueued() {
+            for(u32 i=0; i<numThreads; ++i) {
+                if(!threads[i].deque.empty()) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        static void pin(u32 core) {
+#if defined(__APPLE__)
+            // only a hint, threads with different tags are spread across cores.
+            // Not supported on Apple silicon, where the scheduler decides alone.
+            thread_affinity_policy_data_t policy = {(integer_t)(core + 1)};
+            kern_return_t result = thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY, (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
+            LEVERIFYM(result == KERN_SUCCESS || result == KERN_NOT_SUPPORTED, "thread_policy_set failed: %d", result);
+#elif defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(core % (u32)SDL_GetCPUCount(), &set);
+            int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            LEVERIFYM(result == 0, "pthread_setaffinity_np failed: %d", result);
+#else
+            (void)core;
+#endif
+        }
+
+        static int workerFunc(void* userData) {
+            threadSelf = (JobThread*)userData;
+            u32 index = (u32)(threadSelf - threads);
+            if(pinThreads) {
+                pin(index);
+            }
+            char name[32];
+            SDL_snprintf(name, sizeof(name), "le4 Worker %u", index);
+            profileSetThreadName(name);
+            for(;;) {
+                Job* job = find();
+                if(job) {
+                    execute(job);
+                    continue;
+                }
+                if(!running.load(std::memory_order_acquire)) {
+                    break;
+                }
+                workAvailable.waitUntil([]{ return anyQueued() || !running.load(std::memory_order_acquire); });
+            }
+            return 0;
+        }
+    };
+
+    void jobsInit(u32 numWorkers, bool inPinThreads) {
+        LEASSERT(!running.load());
+        numWorkers = numWorkers > LE_JOBS_MAX_WORKERS ? LE_JOBS_MAX_WORKERS : numWorkers;
+        numThreads = numWorkers + 1;
+        pinThreads = inPinThreads;
+        threads = (JobThread*)SDL_calloc(numThreads, sizeof(JobThread));
+        LEASSERTM(threads != NULL, "out of memory for %u job threads", numThreads);
+        for(u32 i=0; i<numThreads; ++i) {
+            threads[i].randomState = 0x9e3779b9u * (i + 1);
+        }
+        workAvailable.init();
+        running.store(true, std::memory_order_release);
+
+        threadSelf = &threads[0];
+        if(pinThreads) {
+            JobSystem::pin(0);
+        }
+        for(u32 i=1; i<numThreads; ++i) {
+            char name[32];
+            SDL_snprintf(name, sizeof(name), "le4 Worker %u", i);
+            threads[i].thread = SDL_CreateThread(JobSystem::workerFunc, name, &threads[i]);
+            LEASSERTM(threads[i].thread != NULL, "%s", SDL_GetError());
+        }
+        LELOG_INFO(LogCategoryApp, "job system: %u workers%s", numWorkers, pinThreads ? ", pinned" : "");
+    }
+
+    void jobsDeinit() {
+        if(!running.load()) {
+            return;
+        }
+        // run what's left on the main deque, workers drain their own before they exit
+        while(Job* job = JobSystem::find()) {
+            JobSystem::execute(job);
+        }
+        running.store(false, std::memory_order_release);
+        workAvailable.notify(numThreads);
+        for(u32 i=1; i<numThreads; ++i) {
+            SDL_WaitThread(threads[i].thread, NULL);
+        }
+        workAvailable.deinit();
+        SDL_free(threads);
+        threads = NULL;
+        threadSelf = NULL;
+        numThreads = 0;
+    }
+
+    u32 jobsNumWorkers() {
+        return numThreads ? numThreads - 1 : 0;
+    }
+
+    u32 jobsDefaultNumWorkers() {
+        int cores = SDL_GetCPUCount();
+        return cores > 1 ? (u32)(cores - 1) : 0;
+    }
+
+    void jobsRun(JobFunction function, void* userData, JobCounter* counter) {
+        Job* job = JobSystem::allocJob();
+        job->function = function;
+        job->userData = userData;
+        job->counter = counter;
+        JobSystem::addToCounter(counter, 1);
+        JobSystem::queue(job);
+    }
+
+    void jobsRunAfter(JobCounter* dependency, JobFunction function, void* userData, JobCounter* counter) {
+        Job* job = JobSystem::allocJob();
+        job->function = function;
+        job->userData = userData;
+        job->counter = counter;
+        JobSystem::addToCounter(counter, 1);
+        JobSystem::queueAfter(dependency, job);
+    }
+
+    void jobsWait(JobCounter* counter) {
+        u32 idle = 0;
+        while(!counter->done()) {
+            Job* job = JobSystem::find();
+            if(job) {
+                JobSystem::execute(job);
+                idle = 0;
+            } else if(++idle < LE_JOBS_SPINS) {
+                cpuRelax();
+            } else {
+                // the jobs we're waiting for are running elsewhere, give their threads the core
+                SDL_Delay(0);
+            }
+        }
+        JobSystem::settle(counter);
+    }
+
+    void parallelFor(u32 count, u32 grainSize, JobRangeFunction function, void* userData) {
+        if(!count) {
+            return;
+        }
+        grainSize = grainSize ? grainSize : 1;
+        // inline if there's nothing to split, or the calling thread doesn't belong to the job system
+        if((count <= grainSize) || (numThreads <= 1) || !threadSelf) {
+            function(userData, 0, count);
+            return;
+        }
+        JobCounter counter;
+        counter.init();
+        Job* job = JobSystem::allocJob();
+        job->rangeFunction = function;
+        job->userData = userData;
+        job->counter = &counter;
+        job->begin = 0;
+        job->end = count;
+        job->grainSize = grainSize;
+        JobSystem::addToCounter(&counter, 1);
+        // runs the lowest range right here, the rest is stolen or picked up while waiting
+        JobSystem::execute(job);
+        jobsWait(&counter);
+    }
+}
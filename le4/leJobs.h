@@ -0,0 +1,70 @@
+#pragma once
+
+#include "le4.h"
+
+namespace le4 {
+
+#pragma mark - Jobs -
+
+    // unfinished jobs a thread can have queued, including those waiting for a dependency
+#ifndef LE_JOBS_PER_THREAD
+#define LE_JOBS_PER_THREAD 4096
+#endif
+
+#define LE_JOBS_MAX_WORKERS 63
+
+    typedef void (*JobFunction)(void* userData);
+    typedef void (*JobRangeFunction)(void* userData, u32 begin, u32 end);
+
+    struct Job;
+
+    // Counts unfinished jobs. Every job run with a counter increments it when it's queued and
+    // decrements it when it's done, so a group of jobs can be waited for, or used as the
+    // dependency of later jobs. Must be init()ed, and must not go out of scope before
+    // jobsWait() on it returned.
+    struct JobCounter {
+        void init();
+        bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+    private:
+        std::atomic<u32>    pending;
+        SDL_SpinLock        lock;
+        Job*                waiting; // queued once pending drops to 0
+
+        friend struct JobSystem;
+    };
+
+    // Work stealing job system. Every worker thread and the main thread own a Chase-Lev deque:
+    // the owner pushes and pops jobs at the bottom without contention, idle threads steal from
+    // the top of other deques. Idle workers sleep until new jobs are queued.
+    // Jobs can only be queued from the thread that called jobsInit() and from inside jobs.
+    // Nothing is allocated after jobsInit().
+    void jobsInit(u32 numWorkers, bool pinThreads); // pinThreads binds each worker to its own core where the OS allows
+    void jobsDeinit(); // finishes all queued jobs, then stops the workers
+    u32 jobsNumWorkers();
+    u32 jobsDefaultNumWorkers(); // one per core besides the main thread's
+
+    // queues function(userData). counter may be NULL.
+    void jobsRun(JobFunction function, void* userData, JobCounter* counter);
+
+    // queues function(userData) once dependency is done. counter may be NULL.
+    void jobsRunAfter(JobCounter* dependency, JobFunction function, void* userData, JobCounter* counter);
+
+    // runs other jobs on the calling thread until counter is done
+    void jobsWait(JobCounter* counter);
+
+    // Calls function(userData, begin, end) for consecutive ranges covering [0, count), in
+    // parallel, and returns once all of them are done. Ranges are split in halves until they are
+    // no longer than grainSize, so idle threads steal big chunks first. Runs everything on the
+    // calling thread if the job system isn't running or was started on another thread.
+    void parallelFor(u32 count, u32 grainSize, JobRangeFunction function, void* userData);
+
+    // same with a callable taking (u32 begin, u32 end)
+    template<typename F>
+    void parallelFor(u32 count, u32 grainSize, const F& fn) {
+        struct Trampoline {
+            static void run(void* userData, u32 begin, u32 end) { (*(const F*)userData)(begin, end); }
+        };
+        parallelFor(count, grainSize, Trampoline::run, (void*)&fn);
+    }
+}
@@ -0,0 +1,545 @@
+#include "le4.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Asynchronous logging backend behind LELOG.
+//
+// Callers don't format anything. They walk the printf format once to pull the arguments off the
+// va_list and append the format pointer, call site and the raw argument values to a shared ring
+// buffer. Strings are copied, everything else is stored as 8 byte values. A background thread
+// formats the records in order and writes them to stdout in batches.
+//
+// Producers reserve space with a CAS on the write position and commit their record by publishing
+// its size, so multiple threads can log concurrently without a lock. Records never wrap, the end
+// of the ring is skipped with a padding record instead. If the ring is full the message is dropped
+// and counted. The consumer zeroes what it has read, so an uncommitted record always reads as 0.
+//
+// Format strings must outlive the record, which holds for literals. Before logInit and after
+// logDeinit messages are formatted and printed synchronously.
+
+#define LE_LOG_MAX_RECORD   1024
+#define LE_LOG_BATCH_SIZE   (64*1024)
+#define LE_LOG_PADDING_BIT  0x80000000u
+#define LE_LOG_WAKE_MS      10
+
+namespace le4 {
+
+    struct LogRecord {
+        std::atomic<u32>    committed; // record size including alignment, 0 while being written
+        u32                 ticks;
+        const char*         file;
+        const char*         func;
+        const char*         fmt;
+        s32                 line;
+        u32                 argBytes;
+    };
+
+    static_assert(sizeof(LogRecord) % 8 == 0, "log records must keep 8 byte alignment");
+
+    enum LogArgType {
+        LogArgNone,   // %% or invalid
+        LogArgInt,
+        LogArgInt64,
+        LogArgDouble,
+        LogArgString,
+        LogArgPointer,
+        LogArgCount   // %n, consumes the pointer but writes nothing
+    };
+
+    struct LogSpec {
+        const char* start;       // the '%'
+        const char* modifier;    // start of the length modifier
+        const char* modifierEnd;
+        const char* end;         // one past the conversion character
+        LogArgType  type;
+        u32         numStars;    // '*' width and precision, each takes an int argument
+        s32         precision;   // -1 if none or given by '*'
+        bool        starPrecision;
+    };
+
+    static u8* ring = NULL;
+    static u32 ringSize = 0; // power of 2
+    static std::atomic<u64> writePos(0);
+    static std::atomic<u64> readPos(0);
+    static std::atomic<u64> numMessages(0);
+    static std::atomic<u64> numDropped(0);
+    static std::atomic<u64> bytesWritten(0);
+    static std::atomic<u32> highWater(0);
+    static std::atomic<bool> running(false);
+    static u64 reportedDropped = 0;
+
+    static SDL_Thread* thread = NULL;
+    static SDL_sem* wake = NULL;
+    static SDL_mutex* consumerLock = NULL;
+    static char batch[LE_LOG_BATCH_SIZE];
+
+    static const char* baseName(const char* file) {
+        const char* filename = SDL_strrchr(file, '/');
+        return filename ? filename + 1 : file;
+    }
+
+    // parses the conversion specification starting at the '%' at p
+    static void parseSpec(const char* p, LogSpec* spec) {
+        spec->start = p++;
+        spec->numStars = 0;
+        spec->precision = -1;
+        spec->starPrecision = false;
+        while(*p && SDL_strchr("-+ #0'", *p)) {
+            p++;
+        }
+        if(*p == '*') {
+            spec->numStars++;
+            p++;
+        }
+        while((*p >= '0') && (*p <= '9')) {
+            p++;
+        }
+        if(*p == '.') {
+            p++;
+            if(*p == '*') {
+                spec->numStars++;
+                spec->starPrecision = true;
+                p++;
+            } else {
+                spec->precision = 0;
+                while((*p >= '0') && (*p <= '9')) {
+                    spec->precision = spec->precision * 10 + (*p++ - '0');
+                }
+            }
+        }
+        spec->modifier = p;
+        bool wide = false;
+        while(*p && SDL_strchr("hlLqjzt", *p)) {
+            wide |= (*p != 'h');
+            p++;
+        }
+        spec->modifierEnd = p;
+        switch(*p) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+                spec->type = wide ? LogArgInt64 : LogArgInt;
+                break;
+            case 'c':
+                spec->type = LogArgInt;
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                spec->type = LogArgDouble; // long double arguments are narrowed, see captureArgs
+                break;
+            case 's':
+                spec->type = LogArgString;
+                break;
+            case 'p':
+                spec->type = LogArgPointer;
+                break;
+            case 'n':
+                spec->type = LogArgCount;
+                break;
+            default:
+                spec->type = LogArgNone;
+                spec->numStars = 0;
+                break;
+        }
+        spec->end = *p ? p + 1 : p;
+    }
+
+    static inline u32 align8(u32 n) {
+        return (n + 7) & ~7u;
+    }
+
+    // serializes the arguments for fmt into args, returns the number of bytes used.
+    // strings are truncated if the record would exceed its maximum size.
+    static u32 captureArgs(const char* fmt, va_list va, u8* args, u32 capacity) {
+        u32 used = 0;
+        for(const char* p = fmt; *p; ) {
+            if(*p != '%') {
+                p++;
+                continue;
+            }
+            LogSpec spec;
+            parseSpec(p, &spec);
+            p = spec.end;
+            s32 lastStar = 0;
+            for(u32 i=0; i<spec.numStars; ++i) {
+                lastStar = va_arg(va, int);
+                if(used + 8 <= capacity) {
+                    *(s64*)(args + used) = lastStar;
+                    used += 8;
+                }
+            }
+            s32 precision = spec.starPrecision ? lastStar : spec.precision;
+            union { s64 i; f64 d; u64 u; } value;
+            value.u = 0;
+            switch(spec.type) {
+                case LogArgNone:
+                    continue;
+                case LogArgInt:
+                    value.i = va_arg(va, int);
+                    break;
+                case LogArgInt64:
+                    value.i = va_arg(va, long long);
+                    break;
+                case LogArgDouble:
+                    if((spec.modifier != spec.modifierEnd) && (*(spec.modifierEnd - 1) == 'L')) {
+                        value.d = (f64)va_arg(va, long double);
+                    } else {
+                        value.d = va_arg(va, double);
+                    }
+                    break;
+                case LogArgPointer:
+                case LogArgCount:
+                    value.u = (u64)(uintptr_t)va_arg(va, void*);
+                    break;
+                case LogArgString: {
+                    const char* s = va_arg(va, const char*);
+                    if(!s) {
+                        s = "(null)";
+                    }
+                    // %.*s may point at unterminated text, never read past the precision
+                    u32 len = 0;
+                    while(((precision < 0) || (len < (u32)precision)) && s[len]) {
+                        len++;
+                    }
+                    if(used + 8 > capacity) {
+                        continue;
+                    }
+                    u32 room = capacity - used - 8;
+                    len = len < room ? len : room;
+                    *(u32*)(args + used) = len;
+                    SDL_memcpy(args + used + 8, s, len);
+                    used += 8 + align8(len);
+                    continue;
+                }
+            }
+            if(used + 8 <= capacity) {
+                *(u64*)(args + used) = value.u;
+                used += 8;
+            }
+        }
+        return used;
+    }
+
+    // formats a captured record, returns the number of chars written to out (excluding the 0)
+    static u32 formatRecord(const LogRecord* record, char* out, u32 capacity) {
+        const u8* args = (const u8*)(record + 1);
+        const u8* argsEnd = args + record->argBytes;
+        int n = SDL_snprintf(out, capacity, "%8d - %s:%d : %s : ", record->ticks, baseName(record->file), record->line, record->func);
+        u32 used = n > 0 ? ((u32)n < capacity ? (u32)n : capacity - 1) : 0;
+
+        #define LE_LOG_NEXT_ARG(T, v) T v = 0; if(args + 8 <= argsEnd) { v = *(const T*)args; args += 8; }
+        for(const char* p = record->fmt; *p && (used + 1 < capacity); ) {
+            if(*p != '%') {
+                out[used++] = *p++;
+                continue;
+            }
+            LogSpec spec;
+            parseSpec(p, &spec);
+            p = spec.end;
+            if(spec.type == LogArgNone) {
+                if(*(spec.end - 1) == '%') {
+                    out[used++] = '%';
+                }
+                continue;
+            }
+
+            // rebuild the spec with a length modifier matching the stored value
+            char specText[32];
+            u32 prefix = (u32)(spec.modifier - spec.start);
+            if(prefix > sizeof(specText) - 4) {
+                continue;
+            }
+            SDL_memcpy(specText, spec.start, prefix);
+            u32 s = prefix;
+            if(spec.type == LogArgInt64) {
+                specText[s++] = 'l';
+                specText[s++] = 'l';
+            } else if(spec.type == LogArgInt) {
+                for(const char* m = spec.modifier; m < spec.modifierEnd; ++m) {
+                    if((*m == 'h') && (s < prefix + 2)) {
+                        specText[s++] = 'h';
+                    }
+                }
+            }
+            specText[s++] = *(spec.end - 1);
+            specText[s] = 0;
+
+            s64 stars[2] = {0, 0};
+            for(u32 i=0; i<spec.numStars; ++i) {
+                LE_LOG_NEXT_ARG(s64, star);
+                stars[i] = star;
+            }
+            char* dst = out + used;
+            u32 room = capacity - used;
+            int written = 0;
+            #define LE_LOG_PRINT(v) \
+                written = spec.numStars == 2 ? SDL_snprintf(dst, room, specText, (int)stars[0], (int)stars[1], v) : \
+                         (spec.numStars == 1 ? SDL_snprintf(dst, room, specText, (int)stars[0], v) : \
+                                               SDL_snprintf(dst, room, specText, v));
+            switch(spec.type) {
+                case LogArgInt: {
+                    LE_LOG_NEXT_ARG(s64, v);
+                    LE_LOG_PRINT((int)v);
+                    break;
+                }
+                case LogArgInt64: {
+                    LE_LOG_NEXT_ARG(s64, v);
+                    LE_LOG_PRINT((long long)v);
+                    break;
+                }
+                case LogArgDouble: {
+                    LE_LOG_NEXT_ARG(f64, v);
+                    LE_LOG_PRINT(v);
+                    break;
+                }
+                case LogArgPointer: {
+                    LE_LOG_NEXT_ARG(u64, v);
+                    LE_LOG_PRINT((void*)(uintptr_t)v);
+                    break;
+                }
+                case LogArgCount: {
+                    LE_LOG_NEXT_ARG(u64, v);
+                    (void)v;
+                    break;
+                }
+                case LogArgString: {
+                    LE_LOG_NEXT_ARG(u32, len);
+                    char text[LE_LOG_MAX_RECORD];
+                    if(args + len > argsEnd) {
+                        len = 0;
+                    }
+                    SDL_memcpy(text, args, len);
+                    text[len] = 0;
+                    args += align8(len);
+                    LE_LOG_PRINT(text);
+                    break;
+                }
+                case LogArgNone:
+                    break;
+            }
+            #undef LE_LOG_PRINT
+            if(written > 0) {
+                used += (u32)written < room ? (u32)written : room - 1;
+            }
+        }
+        #undef LE_LOG_NEXT_ARG
+        out[used] = 0;
+        return used;
+    }
+
+    static void logSync(const char* file, int line, const char* func, const char* fmt, va_list va) {
+        char stackMessage[2048];
+        char* logmsg = stackMessage;
+        va_list copy;
+        va_copy(copy, va);
+        int n = vsnprintf(stackMessage, sizeof(stackMessage), fmt, copy);
+        va_end(copy);
+        if(n >= (int)sizeof(stackMessage)) {
+            vasprintf(&logmsg, fmt, va);
+        }
+        printf("%8d - %s:%d : %s : %s\n", SDL_GetTicks(), baseName(file), line, func, logmsg);
+        if(logmsg != stackMessage) {
+            free(logmsg);
+        }
+    }
+
+    void leLog(const char* file, int line, const char* func, ...) {
+        va_list va;
+        va_start(va, func);
+        const char* fmt = va_arg(va, const char*);
+
+        if(!running.load(std::memory_order_acquire)) {
+            logSync(file, line, func, fmt, va);
+            va_end(va);
+            return;
+        }
+
+        u8 args[LE_LOG_MAX_RECORD - sizeof(LogRecord)];
+        u32 argBytes = captureArgs(fmt, va, args, sizeof(args));
+        va_end(va);
+        u32 size = (u32)sizeof(LogRecord) + argBytes;
+
+        // reserve, skipping the rest of the ring if the record doesn't fit before the end
+        u64 pos = writePos.load(std::memory_order_relaxed);
+        u64 start;
+        u32 gap;
+        do {
+            u32 offset = (u32)(pos & (ringSize - 1));
+            gap = offset + size > ringSize ? ringSize - offset : 0;
+            start = pos + gap;
+            if(start + size - readPos.load(std::memory_order_acquire) > ringSize) {
+                numDropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        } while(!writePos.compare_exchange_weak(pos, start + size, std::memory_order_relaxed));
+
+        if(gap) {
+            LogRecord* padding = (LogRecord*)(ring + (pos & (ringSize - 1)));
+            padding->committed.store(gap | LE_LOG_PADDING_BIT, std::memory_order_release);
+        }
+        LogRecord* record = (LogRecord*)(ring + (start & (ringSize - 1)));
+        record->ticks = SDL_GetTicks();
+        record->file = file;
+        record->func = func;
+        record->fmt = fmt;
+        record->line = line;
+        record->argBytes = argBytes;
+        SDL_memcpy(record + 1, args, argBytes);
+        record->committed.store(size, std::memory_order_release);
+        numMessages.fetch_add(1, std::memory_order_relaxed);
+
+        u32 fill = (u32)(start + size - readPos.load(std::memory_order_relaxed));
+        u32 high = highWater.load(std::memory_order_relaxed);
+        while((fill > high) && !highWater.compare_exchange_weak(high, fill, std::memory_order_relaxed)) {
+        }
+        // the consumer polls anyway, only wake it early if the ring fills up
+        if((fill > ringSize / 2) && (SDL_SemValue(wake) == 0)) {
+            SDL_SemPost(wake);
+        }
+    }
+
+    static void writeBatch(u32 length) {
+        if(length) {
+            fwrite(batch, length, 1, stdout);
+            bytesWritten.fetch_add(length, std::memory_order_relaxed);
+        }
+    }
+
+    // formats and writes all committed records in order. Stops at the first record that is
+    // still being written.
+    static void drain() {
+        SDL_LockMutex(consumerLock);
+        u64 pos = readPos.load(std::memory_order_relaxed);
+        u64 end = writePos.load(std::memory_order_acquire);
+        u32 length = 0;
+        while(pos < end) {
+            LogRecord* record = (LogRecord*)(ring + (pos & (ringSize - 1)));
+            u32 committed = record->committed.load(std::memory_order_acquire);
+            if(!committed) {
+                break;
+            }
+            u32 size = committed & ~LE_LOG_PADDING_BIT;
+            if(!(committed & LE_LOG_PADDING_BIT)) {
+                if(length + LE_LOG_MAX_RECORD * 2 > LE_LOG_BATCH_SIZE) {
+                    writeBatch(length);
+                    length = 0;
+                }
+                length += formatRecord(record, batch + length, LE_LOG_MAX_RECORD * 2 - 1);
+                batch[length++] = '\n';
+            }
+            // an uncommitted record must read as 0 on the next lap
+            SDL_memset(record, 0, size);
+            pos += size;
+            readPos.store(pos, std::memory_order_release);
+        }
+        u64 dropped = numDropped.load(std::memory_order_relaxed);
+        if(dropped != reportedDropped) {
+            int n = SDL_snprintf(batch + length, LE_LOG_BATCH_SIZE - length, "%8d - log: %llu messages dropped, ring buffer full\n",
+                                 SDL_GetTicks(), dropped - reportedDropped);
+            length += n > 0 ? (u32)n : 0;
+            reportedDropped = dropped;
+        }
+        writeBatch(length);
+        fflush(stdout);
+        SDL_UnlockMutex(consumerLock);
+    }
+
+    static int threadFunc(void*) {
+        while(running.load(std::memory_order_acquire)) {
+            SDL_SemWaitTimeout(wake, LE_LOG_WAKE_MS);
+            drain();
+        }
+        return 0;
+    }
+
+    void logInit(u32 bufferSize) {
+        LEASSERT(!running.load());
+        LEASSERT(bufferSize >= 2 * LE_LOG_MAX_RECORD);
+        ringSize = nextPowerOf2(bufferSize);
+        ring = (u8*)SDL_calloc(1, ringSize);
+        writePos.store(0);
+        readPos.store(0);
+        reportedDropped = numDropped.load();
+        wake = SDL_CreateSemaphore(0);
+        consumerLock = SDL_CreateMutex();
+        running.store(true, std::memory_order_release);
+        thread = SDL_CreateThread(threadFunc, "le4 Log", NULL);
+        LEASSERTM(thread != NULL, "%s", SDL_GetError());
+    }
+
+    void logDeinit() {
+        if(!running.load()) {
+            return;
+        }
+        running.store(false, std::memory_order_release);
+        SDL_SemPost(wake);
+        SDL_WaitThread(thread, NULL);
+        thread = NULL;
+        // messages logged concurrently with shutdown are printed synchronously from here on
+        drain();
+        SDL_DestroyMutex(consumerLock);
+        SDL_DestroySemaphore(wake);
+        SDL_free(ring);
+        ring = NULL;
+        consumerLock = NULL;
+        wake = NULL;
+    }
+
+    void logFlush() {
+        if(running.load(std::memory_order_acquire)) {
+            drain();
+        } else {
+            fflush(stdout);
+        }
+    }
+
+    std::atomic<u32> logCategoryMask(0xffffffff);
+
+    const char* logCategoryName(LogCategory category) {
+        switch(category) {
+            case LogCategoryGeneral: return "general";
+            case LogCategoryIO: return "io";
+            case LogCategoryRender: return "render";
+            case LogCategoryAudio: return "audio";
+            case LogCategoryMemory: return "memory";
+            case LogCategoryResources: return "resources";
+            case LogCategoryApp: return "app";
+            case LogCategoryCount: break;
+        }
+        return "?";
+    }
+
+    void logSetCategoryEnabled(LogCategory category, bool enabled) {
+        if(enabled) {
+            logCategoryMask.fetch_or(1u << category, std::memory_order_relaxed);
+        } else {
+            logCategoryMask.fetch_and(~(1u << category), std::memory_order_relaxed);
+        }
+    }
+
+    // counting is approximate when several threads hit the same call site at a window boundary
+    bool LogRateLimit::allow(const char* file, int line, const char* func) {
+        u32 now = SDL_GetTicks();
+        u32 start = windowStart.load(std::memory_order_relaxed);
+        if((now - start >= 1000) && windowStart.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+            count.store(0, std::memory_order_relaxed);
+            u32 n = suppressed.exchange(0, std::memory_order_relaxed);
+            if(n) {
+                leLog(file, line, func, "%d similar messages suppressed", n);
+            }
+        }
+        if(count.fetch_add(1, std::memory_order_relaxed) < LE_LOG_RATE_LIMIT) {
+            return true;
+        }
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    LogStats logStats() {
+        LogStats result;
+        result.numMessages = numMessages.load(std::memory_order_relaxed);
+        result.numDropped = numDropped.load(std::memory_order_relaxed);
+        result.bytesWritten = bytesWritten.load(std::memory_order_relaxed);
+        result.highWater = highWater.load(std::memory_order_relaxed);
+        return result;
+    }
+}
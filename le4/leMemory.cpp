@@ -0,0 +1,559 @@
+#include "le4.h"
+
+#include <atomic>
+#include <execinfo.h>
+#include <stdlib.h>
+
+namespace le4 {
+
+    // le memory functions are only intended as optional indirection layers for SDL_memory functions.
+    // use the SDL ones rather than these.
+
+    // Every allocation is prefixed with a header, so frees know the size, tag and site to account for.
+    // 16 bytes keep the user pointer aligned like the underlying allocator's.
+    struct AllocationHeader {
+        u64 size;
+        u16 tag;
+        u16 site; // index into the site table, 0 if the allocation wasn't sampled
+        u32 magic;
+    };
+
+    static const u32 allocationMagic = 0x1e4a110c;
+    static_assert(sizeof(AllocationHeader) == 16, "allocation header must preserve 16 byte alignment");
+
+    // Counters are only ever written by their owning thread, so updates are plain relaxed
+    // load/store pairs without a locked instruction. Readers on other threads just sum them up.
+    struct ThreadMemoryCounters {
+        std::atomic<u64>        numMalloc;
+        std::atomic<u64>        numCalloc;
+        std::atomic<u64>        numRealloc;
+        std::atomic<u64>        numFree;
+        std::atomic<s64>        liveBytes;
+        std::atomic<s64>        liveAllocations;
+        std::atomic<s64>        tagLiveBytes[MemoryTagCount];
+        std::atomic<u64>        tagAllocations[MemoryTagCount];
+        std::atomic<u64>        sizeClasses[LE_MEMORY_SIZE_CLASSES];
+        ThreadMemoryCounters*   next;
+    };
+
+    static std::atomic<ThreadMemoryCounters*> allThreadCounters(NULL);
+    static std::atomic<s64> globalLiveBytes(0);
+    static std::atomic<s64> globalPeakBytes(0);
+
+    static thread_local ThreadMemoryCounters* threadCounters = NULL;
+    static thread_local MemoryTag threadTag = MemoryTagGeneral;
+
+    static MemoryAllocator allocator = MemoryAllocatorSystem;
+
+    static inline void* rawAlloc(size_t size) {
+        return allocator == MemoryAllocatorSlab ? slabAlloc(size) : malloc(size);
+    }
+
+    static inline void* rawCalloc(size_t size) {
+        if(allocator == MemoryAllocatorSlab) {
+            void* result = slabAlloc(size);
+            if(result) {
+                SDL_memset(result, 0, size);
+            }
+            return result;
+        }
+        return calloc(1, size);
+    }
+
+    static inline void* rawRealloc(void* ptr, size_t oldSize, size_t newSize) {
+        return allocator == MemoryAllocatorSlab ? slabRealloc(ptr, oldSize, newSize) : realloc(ptr, newSize);
+    }
+
+    static inline void rawFree(void* ptr, size_t size) {
+        if(allocator == MemoryAllocatorSlab) {
+            slabFree(ptr, size);
+        } else {
+            free(ptr);
+        }
+    }
+
+#pragma mark - Allocation site tracking -
+
+    #define LE_MEMORY_MAX_SITES 4096 // must be a power of 2 and fit into AllocationHeader::site
+
+    struct TrackedSite {
+        u64         hash;
+        MemorySite  site;
+        bool        touched; // allocated this frame, listed in frameSites
+    };
+
+    static SDL_SpinLock trackingLock = 0;
+    static std::atomic<u32> trackingSampleRate(0);
+    static u32 trackingReportTopN = 0;
+    static TrackedSite* sites = NULL; // open addressing by callstack hash, slot 0 is never used
+    static u32 numSites = 0;
+    static u64 droppedSamples = 0; // site table was full
+    static u16 frameSites[LE_MEMORY_MAX_SITES];
+    static u32 numFrameSites = 0;
+    static MemorySite lastFrameTop[32];
+    static u32 numLastFrameTop = 0;
+
+    static thread_local u32 threadSampleCounter = 0;
+    static thread_local bool threadInTracking = false;
+
+    static u64 hashFrames(void** frames, int n) {
+        u64 h = 1469598103934665603ull;
+        for(int i=0; i<n; ++i) {
+            h = (h ^ (u64)(uintptr_t)frames[i]) * 1099511628211ull;
+        }
+        return h ? h : 1;
+    }
+
+    // returns the site for a sampled allocation, 0 if not sampled
+    static __attribute__((noinline)) u16 trackAlloc(u64 size) {
+        u32 rate = trackingSampleRate.load(std::memory_order_relaxed);
+        if(!rate || threadInTracking || (++threadSampleCounter < rate)) {
+            return 0;
+        }
+        threadSampleCounter = 0;
+        threadInTracking = true; // backtrace might allocate on first use
+
+        void* frames[LE_MEMORY_SITE_FRAMES + 2];
+        int n = backtrace(frames, LE_MEMORY_SITE_FRAMES + 2);
+        // skip trackAlloc and the le memory hook itself
+        int skip = n > 2 ? 2 : 0;
+        n -= skip;
+        u64 hash = hashFrames(frames + skip, n);
+
+        u16 result = 0;
+        SDL_AtomicLock(&trackingLock);
+        u32 i = (u32)hash & (LE_MEMORY_MAX_SITES - 1);
+        while(true) {
+            if(i == 0) {
+                i = 1;
+            }
+            if(sites[i].hash == hash) {
+                break;
+            }
+            if(!sites[i].hash) {
+                if(numSites + 1 >= LE_MEMORY_MAX_SITES * 3 / 4) {
+                    i = 0;
+                    droppedSamples++;
+                    break;
+                }
+                sites[i].hash = hash;
+                sites[i].site.numFrames = (u32)n;
+                SDL_memcpy(sites[i].site.frames, frames + skip, sizeof(void*) * (size_t)n);
+                numSites++;
+                break;
+            }
+            i = (i + 1) & (LE_MEMORY_MAX_SITES - 1);
+        }
+        if(i) {
+            MemorySite& site = sites[i].site;
+            site.liveBytes += (s64)size;
+            site.liveAllocations++;
+            site.totalAllocations++;
+            site.totalBytes += size;
+            site.frameAllocations++;
+            site.frameBytes += size;
+            if(!sites[i].touched) {
+                sites[i].touched = true;
+                frameSites[numFrameSites++] = (u16)i;
+            }
+            result = (u16)i;
+        }
+        SDL_AtomicUnlock(&trackingLock);
+
+        threadInTracking = false;
+        return result;
+    }
+
+    static void trackFree(u16 site, u64 size) {
+        SDL_AtomicLock(&trackingLock);
+        sites[site].site.liveBytes -= (s64)size;
+        sites[site].site.liveAllocations--;
+        SDL_AtomicUnlock(&trackingLock);
+    }
+
+    static void trackResize(u16 site, u64 oldSize, u64 newSize) {
+        SDL_AtomicLock(&trackingLock);
+        sites[site].site.liveBytes += (s64)newSize - (s64)oldSize;
+        SDL_AtomicUnlock(&trackingLock);
+    }
+
+    void memoryLogCallstack(void* const* frames, u32 numFrames) {
+        char** symbols = backtrace_symbols(frames, (int)numFrames);
+        for(u32 i=0; i<numFrames; ++i) {
+            LELOG("    %s", symbols ? symbols[i] : "?");
+        }
+        free(symbols); // allocated by libc
+    }
+
+    static void logSite(const MemorySite& site, const char* what, s64 bytes, s64 count) {
+        LELOG("%s: %lld bytes in %lld allocations", what, bytes, count);
+        memoryLogCallstack(site.frames, site.numFrames);
+    }
+
+    void memoryTrackingEnable(u32 sampleRate, u32 reportTopN) {
+        SDL_AtomicLock(&trackingLock);
+        if(sampleRate && !sites) {
+            // raw calloc, the table must not show up in the stats it collects
+            sites = (TrackedSite*)calloc(LE_MEMORY_MAX_SITES, sizeof(TrackedSite));
+        }
+        trackingReportTopN = reportTopN < 32 ? reportTopN : 32;
+        SDL_AtomicUnlock(&trackingLock);
+        trackingSampleRate.store(sampleRate, std::memory_order_relaxed);
+        LELOG("allocation tracking: sampling every %d allocations, reporting top %d sites per frame", sampleRate, reportTopN);
+    }
+
+    bool memoryTrackingEnabled() {
+        return trackingSampleRate.load(std::memory_order_relaxed) != 0;
+    }
+
+    void memoryTrackingEndFrame() {
+        if(!sites) {
+            return;
+        }
+        // selection of the top sites by bytes, the list of touched sites is usually short
+        SDL_AtomicLock(&trackingLock);
+        numLastFrameTop = 0;
+        for(u32 i=0; i<numFrameSites; ++i) {
+            TrackedSite& tracked = sites[frameSites[i]];
+            u32 pos = numLastFrameTop;
+            while((pos > 0) && (lastFrameTop[pos-1].frameBytes < tracked.site.frameBytes)) {
+                if(pos < 32) {
+                    lastFrameTop[pos] = lastFrameTop[pos-1];
+                }
+                pos--;
+            }
+            if(pos < 32) {
+                lastFrameTop[pos] = tracked.site;
+                if(numLastFrameTop < 32) {
+                    numLastFrameTop++;
+                }
+            }
+            tracked.site.frameAllocations = 0;
+            tracked.site.frameBytes = 0;
+            tracked.touched = false;
+        }
+        numFrameSites = 0;
+        u32 reportTopN = trackingReportTopN;
+        SDL_AtomicUnlock(&trackingLock);
+
+        u32 n = reportTopN < numLastFrameTop ? reportTopN : numLastFrameTop;
+        for(u32 i=0; i<n; ++i) {
+            logSite(lastFrameTop[i], "frame allocation site", (s64)lastFrameTop[i].frameBytes, (s64)lastFrameTop[i].frameAllocations);
+        }
+    }
+
+    u32 memoryTrackingTopSites(MemorySite* result, u32 maxSites) {
+        u32 n = maxSites < numLastFrameTop ? maxSites : numLastFrameTop;
+        SDL_memcpy(result, lastFrameTop, sizeof(MemorySite) * n);
+        return n;
+    }
+
+    void memoryTrackingDumpLive() {
+        if(!sites) {
+            return;
+        }
+        // sort a snapshot of the live sites by bytes, using libc memory to not disturb the stats
+        SDL_AtomicLock(&trackingLock);
+        MemorySite* live = (MemorySite*)malloc(sizeof(MemorySite) * numSites);
+        u32 numLive = 0;
+        for(u32 i=1; i<LE_MEMORY_MAX_SITES; ++i) {
+            if(sites[i].hash && sites[i].site.liveAllocations > 0) {
+                live[numLive++] = sites[i].site;
+            }
+        }
+        u64 dropped = droppedSamples;
+        SDL_AtomicUnlock(&trackingLock);
+
+        qsort(live, numLive, sizeof(MemorySite), [](const void* l, const void* r) -> int {
+            s64 lb = ((const MemorySite*)l)->liveBytes;
+            s64 rb = ((const MemorySite*)r)->liveBytes;
+            return lb < rb ? 1 : (lb > rb ? -1 : 0);
+        });
+        LELOG("%d allocation sites with live sampled allocations (sample rate %d, %llu samples dropped)",
+              numLive, trackingSampleRate.load(std::memory_order_relaxed), dropped);
+        for(u32 i=0; i<numLive; ++i) {
+            logSite(live[i], "live allocation site", live[i].liveBytes, live[i].liveAllocations);
+        }
+        free(live);
+    }
+
+#pragma mark - Allocation guard -
+
+    static thread_local bool threadGuarded = false;
+    static thread_local MemoryGuardReport threadGuardReport;
+
+    static __attribute__((noinline)) void guardAlloc(size_t size) {
+        if(!threadGuarded) {
+            return;
+        }
+        if(!threadGuardReport.numAllocations) {
+            threadGuarded = false; // backtrace might allocate on first use
+            void* frames[LE_MEMORY_SITE_FRAMES + 2];
+            int n = backtrace(frames, LE_MEMORY_SITE_FRAMES + 2);
+            // skip guardAlloc and the le memory hook itself
+            int skip = n > 2 ? 2 : 0;
+            threadGuardReport.numFrames = (u32)(n - skip);
+            SDL_memcpy(threadGuardReport.frames, frames + skip, sizeof(void*) * (size_t)(n - skip));
+            threadGuarded = true;
+        }
+        threadGuardReport.numAllocations++;
+        threadGuardReport.bytes += size;
+    }
+
+    void memoryGuardBegin() {
+        SDL_memset(&threadGuardReport, 0, sizeof(MemoryGuardReport));
+        threadGuarded = true;
+    }
+
+    MemoryGuardReport memoryGuardEnd() {
+        threadGuarded = false;
+        return threadGuardReport;
+    }
+
+#pragma mark - Hooks -
+
+    template<typename T> static inline void bump(std::atomic<T>& counter, T v) {
+        counter.store(counter.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+    static ThreadMemoryCounters* counters() {
+        ThreadMemoryCounters* result = threadCounters;
+        if(!result) {
+            // raw calloc, the counters must not account for themselves. Never freed, since other
+            // threads may still read them and the totals must include threads that already exited.
+            result = (ThreadMemoryCounters*)calloc(1, sizeof(ThreadMemoryCounters));
+            ThreadMemoryCounters* head = allThreadCounters.load(std::memory_order_relaxed);
+            do {
+                result->next = head;
+            } while(!allThreadCounters.compare_exchange_weak(head, result, std::memory_order_release, std::memory_order_relaxed));
+            threadCounters = result;
+        }
+        return result;
+    }
+
+    static u32 sizeClass(size_t size) {
+        u32 result = 0;
+        size_t limit = 16;
+        while((size > limit) && (result < LE_MEMORY_SIZE_CLASSES - 1)) {
+            limit <<= 1;
+            result++;
+        }
+        return result;
+    }
+
+    static void accountAlloc(ThreadMemoryCounters* c, AllocationHeader* header) {
+        bump(c->liveBytes, (s64)header->size);
+        bump(c->liveAllocations, (s64)1);
+        bump(c->tagLiveBytes[header->tag], (s64)header->size);
+        bump(c->tagAllocations[header->tag], (u64)1);
+        bump(c->sizeClasses[sizeClass(header->size)], (u64)1);
+
+        s64 live = globalLiveBytes.fetch_add((s64)header->size, std::memory_order_relaxed) + (s64)header->size;
+        s64 peak = globalPeakBytes.load(std::memory_order_relaxed);
+        while((live > peak) && !globalPeakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+    }
+
+    static void accountFree(ThreadMemoryCounters* c, AllocationHeader* header) {
+        bump(c->liveBytes, -(s64)header->size);
+        bump(c->liveAllocations, (s64)-1);
+        bump(c->tagLiveBytes[header->tag], -(s64)header->size);
+        globalLiveBytes.fetch_sub((s64)header->size, std::memory_order_relaxed);
+    }
+
+    // patchSDLMemoryFuncs made sure every block SDL hands back has a header
+    static AllocationHeader* headerOf(void* ptr) {
+        AllocationHeader* header = ((AllocationHeader*)ptr) - 1;
+        LEASSERTM(header->magic == allocationMagic, "%p wasn't allocated through le4 memory functions", ptr);
+        return header;
+    }
+
+    static void* initHeader(AllocationHeader* header, size_t size) {
+        header->size = size;
+        header->tag = (u16)threadTag;
+        header->site = trackAlloc(size);
+        header->magic = allocationMagic;
+        return header + 1;
+    }
+
+    void* leMalloc(size_t size) {
+        ThreadMemoryCounters* c = counters();
+        bump(c->numMalloc, (u64)1);
+        guardAlloc(size);
+        AllocationHeader* header = (AllocationHeader*)rawAlloc(sizeof(AllocationHeader) + size);
+        if(!header) {
+            return NULL;
+        }
+        void* result = initHeader(header, size);
+        accountAlloc(c, header);
+        return result;
+    }
+
+    void* leCalloc(size_t count, size_t size) {
+        ThreadMemoryCounters* c = counters();
+        bump(c->numCalloc, (u64)1);
+        guardAlloc(count * size);
+        if(size && (count > (SIZE_MAX - sizeof(AllocationHeader)) / size)) {
+            return NULL;
+        }
+        size_t total = count * size;
+        AllocationHeader* header = (AllocationHeader*)rawCalloc(sizeof(AllocationHeader) + total);
+        if(!header) {
+            return NULL;
+        }
+        void* result = initHeader(header, total);
+        accountAlloc(c, header);
+        return result;
+    }
+
+    void* leRealloc(void* ptr, size_t size) {
+        ThreadMemoryCounters* c = counters();
+        bump(c->numRealloc, (u64)1);
+        guardAlloc(size);
+        if(!ptr) {
+            AllocationHeader* header = (AllocationHeader*)rawAlloc(sizeof(AllocationHeader) + size);
+            if(!header) {
+                return NULL;
+            }
+            void* result = initHeader(header, size);
+            accountAlloc(c, header);
+            return result;
+        }
+
+        AllocationHeader* header = headerOf(ptr);
+        AllocationHeader old = *header;
+        AllocationHeader* newHeader = (AllocationHeader*)rawRealloc(header, sizeof(AllocationHeader) + old.size, sizeof(AllocationHeader) + size);
+        if(!newHeader) {
+            return NULL; // old block is untouched
+        }
+        // the allocation keeps the tag and site it was created with
+        accountFree(c, &old);
+        if(old.site) {
+            trackResize(old.site, old.size, size);
+        }
+        newHeader->size = size;
+        accountAlloc(c, newHeader);
+        return newHeader + 1;
+    }
+
+    void leFree(void* ptr) {
+        ThreadMemoryCounters* c = counters();
+        bump(c->numFree, (u64)1);
+        if(!ptr) {
+            return;
+        }
+        AllocationHeader* header = headerOf(ptr);
+        accountFree(c, header);
+        if(header->site) {
+            trackFree(header->site, header->size);
+        }
+        header->magic = 0;
+        rawFree(header, sizeof(AllocationHeader) + header->size);
+    }
+
+    void patchSDLMemoryFuncs(MemoryAllocator inAllocator) {
+        SDL_malloc_func mallocFunc;
+        SDL_calloc_func callocFunc;
+        SDL_realloc_func reallocFunc;
+        SDL_free_func freeFunc;
+        SDL_GetMemoryFunctions(&mallocFunc, &callocFunc, &reallocFunc, &freeFunc);
+        if(freeFunc != leFree) {
+            // blocks without a header couldn't be told apart from ours once they're freed
+            int numAllocations = SDL_GetNumAllocations();
+            LEASSERTM(numAllocations <= 0, "%d blocks were allocated through SDL before patchSDLMemoryFuncs", numAllocations);
+            allocator = inAllocator;
+        } else if(inAllocator != allocator) {
+            // headers don't say which allocator a block came from, so the first one stays
+            LELOG_INFO(LogCategoryMemory, "SDL memory functions are already patched, keeping their allocator");
+        }
+        SDL_SetMemoryFunctions(leMalloc, leCalloc, leRealloc, leFree);
+
+        const char* tracking = SDL_getenv("LE4_MEMORY_TRACKING");
+        if(tracking) {
+            const char* topN = SDL_strchr(tracking, ',');
+            memoryTrackingEnable((u32)SDL_atoi(tracking), topN ? (u32)SDL_atoi(topN + 1) : 0);
+        }
+    }
+
+    const char* memoryTagName(MemoryTag tag) {
+        const char* result = NULL;
+        switch(tag) {
+            case MemoryTagGeneral: result = "general"; break;
+            case MemoryTagRender: result = "render"; break;
+            case MemoryTagAudio: result = "audio"; break;
+            case MemoryTagIO: result = "io"; break;
+            case MemoryTagBitmap: result = "bitmap"; break;
+            case MemoryTagCount: result = "invalid"; break;
+        }
+        return result;
+    }
+
+    MemoryTag memorySetTag(MemoryTag tag) {
+        LEASSERT(tag < MemoryTagCount);
+        MemoryTag result = threadTag;
+        threadTag = tag;
+        return result;
+    }
+
+    MemoryStats memoryStats() {
+        MemoryStats result;
+        SDL_memset(&result, 0, sizeof(MemoryStats));
+        for(ThreadMemoryCounters* c = allThreadCounters.load(std::memory_order_acquire); c; c = c->next) {
+            result.numMalloc += c->numMalloc.load(std::memory_order_relaxed);
+            result.numCalloc += c->numCalloc.load(std::memory_order_relaxed);
+            result.numRealloc += c->numRealloc.load(std::memory_order_relaxed);
+            result.numFree += c->numFree.load(std::memory_order_relaxed);
+            result.liveAllocations += c->liveAllocations.load(std::memory_order_relaxed);
+            for(u32 i=0; i<MemoryTagCount; ++i) {
+                result.tagLiveBytes[i] += c->tagLiveBytes[i].load(std::memory_order_relaxed);
+                result.tagAllocations[i] += c->tagAllocations[i].load(std::memory_order_relaxed);
+            }
+            for(u32 i=0; i<LE_MEMORY_SIZE_CLASSES; ++i) {
+                result.sizeClasses[i] += c->sizeClasses[i].load(std::memory_order_relaxed);
+            }
+        }
+        result.liveBytes = globalLiveBytes.load(std::memory_order_relaxed);
+        result.peakBytes = globalPeakBytes.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    static MemoryFrameStats lastFrame;
+
+    void memoryFrameSnapshot() {
+        MemoryStats current = memoryStats();
+        const MemoryStats& prev = lastFrame.total;
+        lastFrame.frame++;
+        lastFrame.numAllocations = (current.numMalloc + current.numCalloc + current.numRealloc) -
+                                   (prev.numMalloc + prev.numCalloc + prev.numRealloc);
+        lastFrame.numFrees = current.numFree - prev.numFree;
+        lastFrame.bytesDelta = current.liveBytes - prev.liveBytes;
+        lastFrame.total = current;
+    }
+
+    const MemoryFrameStats& memoryLastFrame() {
+        return lastFrame;
+    }
+
+    void dumpMemoryLog() {
+        MemoryStats stats = memoryStats();
+        LELOG("mallocs: %llu", stats.numMalloc);
+        LELOG("callocs: %llu", stats.numCalloc);
+        LELOG("reallocs: %llu", stats.numRealloc);
+        LELOG("frees: %llu", stats.numFree);
+        LELOG("live: %lld bytes in %lld allocations, peak: %lld bytes", stats.liveBytes, stats.liveAllocations, stats.peakBytes);
+        for(u32 i=0; i<MemoryTagCount; ++i) {
+            LELOG("tag %-8s: %lld bytes live, %llu allocations", memoryTagName((MemoryTag)i), stats.tagLiveBytes[i], stats.tagAllocations[i]);
+        }
+        for(u32 i=0; i<LE_MEMORY_SIZE_CLASSES; ++i) {
+            if(stats.sizeClasses[i]) {
+                LELOG("size class %s%llu: %llu", (i == LE_MEMORY_SIZE_CLASSES-1) ? ">" : "<=", (i == LE_MEMORY_SIZE_CLASSES-1) ? (16ull << (i-1)) : (16ull << i), stats.sizeClasses[i]);
+            }
+        }
+        if(allocator == MemoryAllocatorSlab) {
+            SlabStats slab = slabStats();
+            LELOG("slab: %llu bytes reserved, %llu bytes in %d large blocks", slab.reservedBytes, slab.largeBytes, slab.largeBlocks);
+        }
+        LELOG("num allocs: %d", SDL_GetNumAllocations());
+        memoryTrackingDumpLive();
+    }
+}
@@ -0,0 +1,198 @@
+#include "leMetrics.h"
+
+namespace le4 {
+
+    struct MetricInfo {
+        const char* name;
+        MetricType  type;
+    };
+
+    static const MetricInfo metricInfos[MetricCount] = {
+#define LE_METRICS_INFO(identifier, type, name) { name, type },
+        LE_METRICS_ENGINE(LE_METRICS_INFO)
+        LE_METRICS_APP(LE_METRICS_INFO)
+#undef LE_METRICS_INFO
+    };
+
+    thread_local MetricsThread* metricsThreadSelf = NULL;
+    std::atomic<s64> metricGauges[MetricCount];
+
+    static std::atomic<MetricsThread*> allThreads(NULL);
+
+    // main thread only
+    static u64 totals[MetricCount];
+    static u64 frameValues[MetricCount];
+    static s64 gauges[MetricCount];
+    static MetricHistogram histogramTotals[MetricCount];
+    static MetricHistogram histograms[MetricCount];
+    static u64 lastFrame = 0;
+
+    MetricsThread* metricsThreadRegister() {
+        // raw calloc, memory accounting may count metrics itself. Never freed, see MetricsThread.
+        MetricsThread* result = (MetricsThread*)calloc(1, sizeof(MetricsThread));
+        LEASSERT(result != NULL);
+        MetricsThread* head = allThreads.load(std::memory_order_relaxed);
+        do {
+            result->next = head;
+        } while(!allThreads.compare_exchange_weak(head, result, std::memory_order_release, std::memory_order_relaxed));
+        metricsThreadSelf = result;
+        return result;
+    }
+
+    void metricsInit() {
+        SDL_memset(totals, 0, sizeof(totals));
+        SDL_memset(frameValues, 0, sizeof(frameValues));
+        SDL_memset(gauges, 0, sizeof(gauges));
+        SDL_memset(histogramTotals, 0, sizeof(histogramTotals));
+        SDL_memset(histograms, 0, sizeof(histograms));
+        lastFrame = 0;
+        metricsThread();
+        metricsEndFrame(0); // counts from here on
+    }
+
+    void metricsDeinit() {
+        LELOG_INFO(LogCategoryApp, "metrics: %llu files loaded [%llu bytes], %llu bitmaps decoded [%llu bytes], %llu jobs",
+                   totals[MetricFilesLoaded], totals[MetricBytesLoaded], totals[MetricBitmapsDecoded],
+                   totals[MetricBitmapBytesDecoded], totals[MetricJobsRun]);
+    }
+
+    void metricsEndFrame(u64 frame) {
+        u64 sums[MetricCount];
+        SDL_memset(sums, 0, sizeof(sums));
+        MetricHistogram sumHistograms[MetricCount];
+        SDL_memset(sumHistograms, 0, sizeof(sumHistograms));
+
+        for(MetricsThread* thread = allThreads.load(std::memory_order_acquire); thread; thread = thread->next) {
+            for(u32 i=0; i<MetricCount; ++i) {
+                sums[i] += thread->values[i].load(std::memory_order_relaxed);
+                if(metricInfos[i].type == MetricTypeHistogram) {
+                    for(u32 b=0; b<LE_METRICS_BUCKETS; ++b) {
+                        sumHistograms[i].buckets[b] += thread->buckets[i][b].load(std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+
+        for(u32 i=0; i<MetricCount; ++i) {
+            switch(metricInfos[i].type) {
+                case MetricTypeCounter:
+                    frameValues[i] = sums[i] - totals[i];
+                    totals[i] = sums[i];
+                    break;
+                case MetricTypeGauge:
+                    gauges[i] = metricGauges[i].load(std::memory_order_relaxed);
+                    break;
+                case MetricTypeHistogram: {
+                    MetricHistogram& total = histogramTotals[i];
+                    MetricHistogram& histogram = histograms[i];
+                    histogram.count = 0;
+                    histogram.sum = sums[i] - total.sum;
+                    total.sum = sums[i];
+                    for(u32 b=0; b<LE_METRICS_BUCKETS; ++b) {
+                        histogram.buckets[b] = sumHistograms[i].buckets[b] - total.buckets[b];
+                        histogram.count += histogram.buckets[b];
+                        total.buckets[b] = sumHistograms[i].buckets[b];
+                    }
+                    break;
+                }
+            }
+        }
+        lastFrame = frame;
+    }
+
+    u64 metricHistogramPercentile(const MetricHistogram& histogram, u32 percent) {
+        if(histogram.count == 0) {
+            return 0;
+        }
+        // nearest rank
+        u64 rank = (percent * histogram.count + 99) / 100;
+        rank = rank > 0 ? rank : 1;
+        u64 seen = 0;
+        for(u32 b=0; b<LE_METRICS_BUCKETS; ++b) {
+            seen += histogram.buckets[b];
+            if(seen >= rank) {
+                return b == LE_METRICS_BUCKETS - 1 ? ~0ull : (1ull << b) - 1;
+            }
+        }
+        return ~0ull;
+    }
+
+    const char* metricName(Metric metric) {
+        LEASSERT(metric < MetricCount);
+        return metricInfos[metric].name;
+    }
+
+    MetricType metricType(Metric metric) {
+        LEASSERT(metric < MetricCount);
+        return metricInfos[metric].type;
+    }
+
+    Metric metricFind(const char* name) {
+        for(u32 i=0; i<MetricCount; ++i) {
+            if(!SDL_strcmp(metricInfos[i].name, name)) {
+                return (Metric)i;
+            }
+        }
+        return MetricCount;
+    }
+
+    u64 metricFrame(Metric metric) {
+        LEASSERT(metric < MetricCount);
+        return frameValues[metric];
+    }
+
+    u64 metricTotal(Metric metric) {
+        LEASSERT(metric < MetricCount);
+        return totals[metric];
+    }
+
+    s64 metricGauge(Metric metric) {
+        LEASSERT(metric < MetricCount);
+        return gauges[metric];
+    }
+
+    const MetricHistogram& metricHistogram(Metric metric) {
+        LEASSERT(metric < MetricCount);
+        return histograms[metric];
+    }
+
+    void metricsLastFrame(MetricsFrame* result) {
+        result->frame = lastFrame;
+        for(u32 i=0; i<MetricCount; ++i) {
+            result->values[i] = metricInfos[i].type == MetricTypeGauge ? (u64)gauges[i] : frameValues[i];
+        }
+        SDL_memcpy(result->histograms, histograms, sizeof(histograms));
+    }
+
+    bool metricsWriteJson(FILE* file, const MetricsFrame& frame) {
+        fprintf(file, "{\"frame\":%llu", (unsigned long long)frame.frame);
+        for(u32 i=0; i<MetricCount; ++i) {
+            switch(metricInfos[i].type) {
+                case MetricTypeCounter:
+                    fprintf(file, ",\"%s\":%llu", metricInfos[i].name, (unsigned long long)frame.values[i]);
+                    break;
+                case MetricTypeGauge:
+                    fprintf(file, ",\"%s\":%lld", metricInfos[i].name, (long long)frame.values[i]);
+                    break;
+                case MetricTypeHistogram: {
+                    const MetricHistogram& histogram = frame.histograms[i];
+                    fprintf(file, ",\"%s\":{\"count\":%llu,\"sum\":%llu,\"p50\":%llu,\"p99\":%llu}", metricInfos[i].name,
+                            (unsigned long long)histogram.count, (unsigned long long)histogram.sum,
+                            (unsigned long long)metricHistogramPercentile(histogram, 50),
+                            (unsigned long long)metricHistogramPercentile(histogram, 99));
+                    break;
+                }
+            }
+        }
+        fprintf(file, "}");
+        return !ferror(file);
+    }
+
+    bool metricsWriteJsonLine(FILE* file) {
+        MetricsFrame frame;
+        metricsLastFrame(&frame);
+        metricsWriteJson(file, frame);
+        fprintf(file, "\n");
+        return !ferror(file);
+    }
+}
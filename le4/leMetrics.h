@@ -0,0 +1,146 @@
+#pragma once
+
+#include "le4.h"
+
+#include <stdio.h>
+
+// LE_METRICS=0 compiles all increments out
+#ifndef LE_METRICS
+#define LE_METRICS 1
+#endif
+
+#define LE_METRICS_BUCKETS 32 // power of 2 histogram buckets, the last one takes everything above
+
+// Metrics of the application, X(Identifier, MetricType, "name") for each, e.g.
+// #define LE_METRICS_APP(X) X(SpritesSubmitted, MetricTypeCounter, "sprites.submitted")
+// Must be the same in every file, so define it in the build settings or a prefix header.
+#ifndef LE_METRICS_APP
+#define LE_METRICS_APP(X)
+#endif
+
+#define LE_METRICS_ENGINE(X) \
+    X(FilesLoaded,          MetricTypeCounter,    "io.files_loaded") \
+    X(BytesLoaded,          MetricTypeCounter,    "io.bytes_loaded") \
+    X(FilesSaved,           MetricTypeCounter,    "io.files_saved") \
+    X(BytesSaved,           MetricTypeCounter,    "io.bytes_saved") \
+    X(FileLoadUs,           MetricTypeHistogram,  "io.file_load_us") \
+    X(BitmapsDecoded,       MetricTypeCounter,    "bitmap.decoded") \
+    X(BitmapBytesDecoded,   MetricTypeCounter,    "bitmap.bytes_decoded") \
+    X(ResourceHits,         MetricTypeCounter,    "resources.hits") \
+    X(ResourceMisses,       MetricTypeCounter,    "resources.misses") \
+    X(ResourceEvictions,    MetricTypeCounter,    "resources.evictions") \
+    X(JobsRun,              MetricTypeCounter,    "jobs.run") \
+    X(InternedStrings,      MetricTypeGauge,      "strings.interned")
+
+namespace le4 {
+
+#pragma mark - Metrics -
+
+    enum MetricType {
+        MetricTypeCounter,   // summed over all threads, per frame and in total
+        MetricTypeGauge,     // the last value set on any thread
+        MetricTypeHistogram  // values counted into power of 2 buckets, per frame
+    };
+
+    // Every metric is known at compile time, so an increment only adds to a fixed slot of the
+    // calling thread's block.
+    enum Metric {
+#define LE_METRICS_ENUM(identifier, type, name) Metric##identifier,
+        LE_METRICS_ENGINE(LE_METRICS_ENUM)
+        LE_METRICS_APP(LE_METRICS_ENUM)
+#undef LE_METRICS_ENUM
+        MetricCount
+    };
+
+    // Only the owner writes its block, with relaxed load/store pairs rather than a locked add.
+    // Blocks are never freed, so metricsEndFrame() still counts threads that exited.
+    struct MetricsThread {
+        std::atomic<u64>    values[MetricCount];
+        std::atomic<u64>    buckets[MetricCount][LE_METRICS_BUCKETS]; // histograms only
+        MetricsThread*      next;
+    };
+
+    extern thread_local MetricsThread* metricsThreadSelf;
+    extern std::atomic<s64> metricGauges[MetricCount];
+
+    // registers the calling thread, on its first increment
+    MetricsThread* metricsThreadRegister();
+
+    inline MetricsThread* metricsThread() {
+        MetricsThread* result = metricsThreadSelf;
+        return result ? result : metricsThreadRegister();
+    }
+
+    inline void metricAdd(Metric metric, u64 n) {
+        std::atomic<u64>& value = metricsThread()->values[metric];
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    inline void metricSet(Metric metric, s64 value) {
+        metricGauges[metric].store(value, std::memory_order_relaxed);
+    }
+
+    // 0 goes into bucket 0, otherwise v into bucket b with 2^(b-1) <= v < 2^b
+    inline u32 metricBucket(u64 v) {
+        u32 bucket = v ? 64 - (u32)__builtin_clzll(v) : 0;
+        return bucket < LE_METRICS_BUCKETS ? bucket : LE_METRICS_BUCKETS - 1;
+    }
+
+    inline void metricRecord(Metric metric, u64 v) {
+        MetricsThread* thread = metricsThread();
+        std::atomic<u64>& bucket = thread->buckets[metric][metricBucket(v)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic<u64>& sum = thread->values[metric];
+        sum.store(sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+#if LE_METRICS
+#define LE_COUNTER_ADD(identifier, n) le4::metricAdd(le4::Metric##identifier, (u64)(n))
+#define LE_GAUGE_SET(identifier, v) le4::metricSet(le4::Metric##identifier, (s64)(v))
+#define LE_HISTOGRAM_RECORD(identifier, v) le4::metricRecord(le4::Metric##identifier, (u64)(v))
+#else
+#define LE_COUNTER_ADD(identifier, n)
+#define LE_GAUGE_SET(identifier, v)
+#define LE_HISTOGRAM_RECORD(identifier, v)
+#endif
+
+    // histogram values recorded during one frame
+    struct MetricHistogram {
+        u64 count;
+        u64 sum;
+        u64 buckets[LE_METRICS_BUCKETS];
+    };
+
+    // upper bound of the bucket the percent-th percentile falls into, 0 if nothing was recorded
+    u64 metricHistogramPercentile(const MetricHistogram& histogram, u32 percent);
+
+    void metricsInit();
+    void metricsDeinit();
+
+    // Sums the blocks of all threads on the main thread, what the queries below return until the
+    // next call. Increments racing with it count towards the next frame.
+    void metricsEndFrame(u64 frame);
+
+    const char* metricName(Metric metric);
+    MetricType metricType(Metric metric);
+    Metric metricFind(const char* name); // MetricCount if there is none
+    u64 metricFrame(Metric metric);      // counters: added during the last frame
+    u64 metricTotal(Metric metric);      // counters: added until the end of the last frame
+    s64 metricGauge(Metric metric);      // gauges: value at the end of the last frame
+    const MetricHistogram& metricHistogram(Metric metric); // histograms: recorded during the last frame
+
+    // all values of one flushed frame, for keeping a history
+    struct MetricsFrame {
+        u64             frame;
+        u64             values[MetricCount]; // counters: added during the frame, gauges: their s64 value
+        MetricHistogram histograms[MetricCount]; // histograms only
+    };
+
+    void metricsLastFrame(MetricsFrame* result);
+
+    // Writes frame as one JSON object: counters per frame, gauges, and count, sum, p50 and p99
+    // of histograms.
+    bool metricsWriteJson(FILE* file, const MetricsFrame& frame);
+    // appends the last frame as a line of JSON
+    bool metricsWriteJsonLine(FILE* file);
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "le4.h"
+#include <new>
+
+namespace le4 {
+
+#pragma mark - Pool -
+
+    // 32 bit reference to a pool object: slot index in the low bits, generation in the high bits.
+    // The generation of a slot is bumped whenever its object is destroyed, so old handles go stale
+    // instead of silently pointing at a reused slot. A value of 0 is never a valid handle.
+    struct PoolHandle {
+        u32 value;
+
+        bool valid() const { return value != 0; }
+        u32 index() const { return value & ((1u << IndexBits) - 1); }
+        u32 generation() const { return value >> IndexBits; }
+
+        enum {
+            IndexBits = 20,
+            GenerationBits = 32 - IndexBits
+        };
+    };
+
+    inline bool operator==(const PoolHandle& l, const PoolHandle& r) {
+        return l.value == r.value;
+    }
+
+    struct PoolStats {
+        u32 capacity;       // slots in all allocated blocks
+        u32 live;           // constructed objects
+        u32 numBlocks;
+        u32 partialBlocks;  // blocks that are neither full nor empty
+        f32 occupancy;      // live / capacity
+        f32 fragmentation;  // share of free slots that sit in blocks that still hold live objects
+    };
+
+    // Fixed-size object allocator with stable addresses.
+    // Objects live in cache line aligned blocks of 64 slots that are never moved or freed before deinit().
+    // Free slots form an intrusive LIFO list, so a destroyed slot is reused first while it's still hot.
+    // Iteration walks each block's occupancy mask and skips 64 empty slots at a time.
+    template<typename T>
+    struct Pool {
+        enum {
+            SlotsPerBlock = 64,
+            CacheLineSize = 64,
+            MaxBlocks = (1u << PoolHandle::IndexBits) / SlotsPerBlock
+        };
+
+        void init(u32 initialCapacity = 0) {
+            blocks = NULL;
+            numBlocks = 0;
+            maxBlocks = 0;
+            freeHead = NoSlot;
+            live = 0;
+            while(numBlocks * SlotsPerBlock < initialCapacity) {
+                addBlock();
+            }
+        }
+
+        void deinit() {
+            for(u32 b=0; b<numBlocks; ++b) {
+                Block* block = blocks[b];
+                u64 mask = block->occupied;
+                while(mask) {
+                    u32 i = (u32)__builtin_ctzll(mask);
+                    mask &= mask - 1;
+                    ((T*)block->slots[i].bytes)->~T();
+                }
+                SDL_free(block->allocation);
+            }
+            SDL_free(blocks);
+            blocks = NULL;
+            numBlocks = 0;
+            maxBlocks = 0;
+            freeHead = NoSlot;
+            live = 0;
+        }
+
+        // default constructs a new object. ptr is optional.
+        PoolHandle create(T** ptr = NULL) {
+            if(freeHead == NoSlot) {
+                addBlock();
+            }
+            u32 index = freeHead;
+            Block* block = blocks[index / SlotsPerBlock];
+            u32 i = index % SlotsPerBlock;
+            freeHead = block->slots[i].nextFree;
+
+            T* obj = new (block->slots[i].bytes) T();
+            block->occupied |= (1ull << i);
+            live++;
+            if(ptr) {
+                *ptr = obj;
+            }
+
+            PoolHandle result;
+            result.value = ((u32)block->generations[i] << PoolHandle::IndexBits) | index;
+            return result;
+        }
+
+        void destroy(PoolHandle handle) {
+            LEASSERTM(alive(handle), "destroying stale pool handle %08x", handle.value);
+            u32 index = handle.index();
+            Block* block = blocks[index / SlotsPerBlock];
+            u32 i = index % SlotsPerBlock;
+
+            ((T*)block->slots[i].bytes)->~T();
+            block->occupied &= ~(1ull << i);
+            // generation 0 is reserved so handle value 0 stays invalid
+            u16 gen = (u16)((block->generations[i] + 1) & ((1u << PoolHandle::GenerationBits) - 1));
+            block->generations[i] = gen ? gen : 1;
+            block->slots[i].nextFree = freeHead;
+            freeHead = index;
+            live--;
+        }
+
+        bool alive(PoolHandle handle) const {
+            u32 index = handle.index();
+            if(!handle.valid() || (index / SlotsPerBlock >= numBlocks)) {
+                return false;
+            }
+            Block* block = blocks[index / SlotsPerBlock];
+            u32 i = index % SlotsPerBlock;
+            return (block->occupied & (1ull << i)) && (block->generations[i] == handle.generation());
+        }
+
+        // returns NULL for stale handles
+        T* get(PoolHandle handle) const {
+            if(!alive(handle)) {
+                return NULL;
+            }
+            u32 index = handle.index();
+            return (T*)blocks[index / SlotsPerBlock]->slots[index % SlotsPerBlock].bytes;
+        }
+
+        // calls fn(PoolHandle, T&) for each live object. fn must not create or destroy objects.
+        template<typename F> void forEach(F fn) {
+            for(u32 b=0; b<numBlocks; ++b) {
+                Block* block = blocks[b];
+                u64 mask = block->occupied;
+                while(mask) {
+                    u32 i = (u32)__builtin_ctzll(mask);
+                    mask &= mask - 1;
+                    PoolHandle handle;
+                    handle.value = ((u32)block->generations[i] << PoolHandle::IndexBits) | (b * SlotsPerBlock + i);
+                    fn(handle, *(T*)block->slots[i].bytes);
+                }
+            }
+        }
+
+        u32 count() const { return live; }
+
+        PoolStats stats() const {
+            PoolStats result;
+            SDL_memset(&result, 0, sizeof(PoolStats));
+            result.numBlocks = numBlocks;
+            result.capacity = numBlocks * SlotsPerBlock;
+            result.live = live;
+            u32 strandedFree = 0;
+            for(u32 b=0; b<numBlocks; ++b) {
+                u32 used = (u32)__builtin_popcountll(blocks[b]->occupied);
+                if((used > 0) && (used < SlotsPerBlock)) {
+                    result.partialBlocks++;
+                    strandedFree += SlotsPerBlock - used;
+                }
+            }
+            u32 numFree = result.capacity - live;
+            result.occupancy = result.capacity ? (f32)live / (f32)result.capacity : 0.f;
+            result.fragmentation = numFree ? (f32)strandedFree / (f32)numFree : 0.f;
+            return result;
+        }
+
+    private:
+        static const u32 NoSlot = 0xffffffff;
+
+        union Slot {
+            u32 nextFree;
+            alignas(T) u8 bytes[sizeof(T)];
+        };
+
+        struct Block {
+            Slot    slots[SlotsPerBlock]; // first member, so it starts on the cache line boundary
+            u64     occupied;
+            u16     generations[SlotsPerBlock];
+            void*   allocation; // unaligned pointer returned by SDL_malloc
+        };
+
+        Block** blocks;
+        u32     numBlocks;
+        u32     maxBlocks;
+        u32     freeHead;
+        u32     live;
+
+        void addBlock() {
+            LEASSERTM(numBlocks < MaxBlocks, "pool exceeded %d objects", MaxBlocks * SlotsPerBlock);
+            if(numBlocks == maxBlocks) {
+                maxBlocks = maxBlocks ? maxBlocks * 2 : 4;
+                blocks = (Block**)SDL_realloc(blocks, maxBlocks * sizeof(Block*));
+            }
+            size_t align = alignof(Block) > CacheLineSize ? alignof(Block) : CacheLineSize;
+            void* allocation = SDL_malloc(sizeof(Block) + align - 1);
+            LEASSERTM(allocation != NULL, "pool out of memory");
+            Block* block = (Block*)(((uintptr_t)allocation + align - 1) & ~(uintptr_t)(align - 1));
+            block->allocation = allocation;
+            block->occupied = 0;
+
+            u32 base = numBlocks * SlotsPerBlock;
+            // link in reverse, so the lowest index of the new block is handed out first
+            for(u32 i=SlotsPerBlock; i>0; --i) {
+                block->generations[i-1] = 1;
+                block->slots[i-1].nextFree = freeHead;
+                freeHead = base + i - 1;
+            }
+            blocks[numBlocks++] = block;
+        }
+    };
+}
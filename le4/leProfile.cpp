@@ -0,0 +1,389 @@
+#include "leProfile.h"
+#include "leArray.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+namespace le4 {
+
+    std::atomic<bool> profileEnabled(false);
+    std::atomic<u32> profileGeneration(0);
+    thread_local ProfileThread* profileThreadSelf = NULL;
+    thread_local u32 profileThreadGeneration = 0;
+
+    // threads are only ever added, so readers can walk the first numThreads without a lock
+    static ProfileThread* threads[LE_PROFILE_MAX_THREADS];
+    static std::atomic<u32> numThreads(0);
+    static SDL_SpinLock threadsLock = 0;
+
+    static u64 calibrationTicks = 0;
+    static u64 calibrationCounter = 0;
+    static f64 ticksPerSecond = 1.0;
+
+    struct ProfileFrame {
+        u64 frame;
+        u64 start; // profileTicks()
+    };
+
+    // zones of a frame aggregated by name, kept until lanes are done with it
+    struct ProfileFrameStats {
+        u64                 frame; // ~0 if unused
+        ProfileZoneStats    zones[LE_PROFILE_MAX_ZONE_NAMES]; // open addressing by name hash
+    };
+
+    static ProfileFrame frames[LE_PROFILE_MAX_FRAMES];
+    static u64 numFrames = 0; // profileBeginFrame calls
+    static ProfileFrameStats frameStats[LE_PROFILE_LANE_FRAMES];
+    static ProfileZoneStats lastFrameStats[LE_PROFILE_MAX_ZONE_NAMES]; // compacted and sorted
+    static u32 numLastFrameStats = 0;
+    static u64 lastStatsFrame = ~0ull;
+    static u64 droppedZones = 0; // overwritten before they were aggregated
+    static u64 lateZones = 0; // recorded into a lane after their frame's stats were gone
+
+#pragma mark - Threads -
+
+    static ProfileThread* newThread() {
+        SDL_AtomicLock(&threadsLock);
+        u32 index = numThreads.load(std::memory_order_relaxed);
+        if(index == LE_PROFILE_MAX_THREADS) {
+            SDL_AtomicUnlock(&threadsLock);
+            return NULL;
+        }
+        // not SDL_malloc, the rings would show up in every memory report and allocation check
+        ProfileThread* thread = (ProfileThread*)calloc(1, sizeof(ProfileThread));
+        thread->zones = (ProfileZone*)calloc(LE_PROFILE_ZONES_PER_THREAD, sizeof(ProfileZone));
+        LEASSERTM((thread != NULL) && (thread->zones != NULL), "couldn't allocate profiler ring");
+        thread->index = index;
+        thread->laneFrame = ~0ull;
+        SDL_snprintf(thread->name, sizeof(thread->name), "Thread %u", index);
+        threads[index] = thread;
+        numThreads.store(index + 1, std::memory_order_release);
+        SDL_AtomicUnlock(&threadsLock);
+        return thread;
+    }
+
+    ProfileThread* profileThreadRegister() {
+        // a ring from before the last profileDeinit() is gone
+        u32 generation = profileGeneration.load(std::memory_order_relaxed);
+        if(!profileThreadSelf || (profileThreadGeneration != generation)) {
+            profileThreadSelf = newThread();
+            profileThreadGeneration = generation;
+        }
+        return profileThreadSelf;
+    }
+
+    ProfileThread* profileLaneRegister(const char* name) {
+        if(!profileEnabled.load(std::memory_order_relaxed)) {
+            return NULL;
+        }
+        ProfileThread* lane = newThread();
+        if(lane) {
+            lane->lane = true;
+            SDL_strlcpy(lane->name, name, sizeof(lane->name));
+        }
+        return lane;
+    }
+
+    void profileSetThreadName(const char* name) {
+        if(!profileEnabled.load(std::memory_order_relaxed)) {
+            return; // threads only get a ring while the profiler runs
+        }
+        ProfileThread* thread = profileThreadRegister();
+        if(thread) {
+            SDL_strlcpy(thread->name, name, sizeof(thread->name));
+        }
+    }
+
+#pragma mark - Ticks -
+
+    static void calibrate() {
+        u64 counter = SDL_GetPerformanceCounter();
+        u64 ticks = profileTicks();
+        if(counter > calibrationCounter) {
+            f64 seconds = (f64)(counter - calibrationCounter) / (f64)SDL_GetPerformanceFrequency();
+            ticksPerSecond = (f64)(ticks - calibrationTicks) / seconds;
+        }
+    }
+
+    f64 profileTicksToSeconds(u64 ticks) {
+        return (f64)ticks / ticksPerSecond;
+    }
+
+    u64 profileSecondsToTicks(f64 seconds) {
+        return (u64)(seconds * ticksPerSecond);
+    }
+
+#pragma mark - Setup -
+
+    void profileInit() {
+        calibrationCounter = SDL_GetPerformanceCounter();
+        calibrationTicks = profileTicks();
+        // a first estimate, refined every frame as the time since init grows
+        u64 until = calibrationCounter + SDL_GetPerformanceFrequency() / 1000;
+        while(SDL_GetPerformanceCounter() < until) {
+        }
+        calibrate();
+        numFrames = 0;
+        for(u32 i=0; i<LE_PROFILE_LANE_FRAMES; ++i) {
+            frameStats[i].frame = ~0ull;
+        }
+        numLastFrameStats = 0;
+        lastStatsFrame = ~0ull;
+        droppedZones = 0;
+        lateZones = 0;
+        profileEnabled.store(true, std::memory_order_relaxed);
+        profileSetThreadName("Main");
+        LELOG_INFO(LogCategoryApp, "profiler: %.3f GHz ticks, %u zones per thread", ticksPerSecond / 1e9, LE_PROFILE_ZONES_PER_THREAD);
+    }
+
+    void profileDeinit() {
+        profileEnabled.store(false, std::memory_order_relaxed);
+        if(droppedZones) {
+            LELOG_WARNING(LogCategoryApp, "profiler: %llu zones were overwritten before they were aggregated", droppedZones);
+        }
+        if(lateZones) {
+            LELOG_WARNING(LogCategoryApp, "profiler: %llu lane zones came more than %d frames late", lateZones, LE_PROFILE_LANE_FRAMES);
+        }
+        // other threads still point at their rings, the new generation makes them register again
+        profileGeneration.fetch_add(1, std::memory_order_relaxed);
+        u32 n = numThreads.load(std::memory_order_acquire);
+        for(u32 i=0; i<n; ++i) {
+            free(threads[i]->zones);
+            free(threads[i]);
+            threads[i] = NULL;
+        }
+        numThreads.store(0, std::memory_order_release);
+        profileThreadSelf = NULL;
+    }
+
+    void profileSetEnabled(bool enabled) {
+        profileEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+#pragma mark - Frames -
+
+    static void addZone(ProfileFrameStats& frame, const ProfileZone& zone) {
+        u32 mask = LE_PROFILE_MAX_ZONE_NAMES - 1;
+        for(u32 i = hashDjb2(zone.name) & mask, probe = 0; probe <= mask; i = (i + 1) & mask, ++probe) {
+            ProfileZoneStats& stats = frame.zones[i];
+            if(stats.name && (stats.name != zone.name) && SDL_strcmp(stats.name, zone.name)) {
+                continue;
+            }
+            f64 ms = profileTicksToSeconds(zone.end - zone.start) * 1000.0;
+            stats.name = zone.name;
+            stats.count++;
+            stats.totalMs += ms;
+            stats.maxMs = ms > stats.maxMs ? ms : stats.maxMs;
+            return;
+        }
+    }
+
+    static int compareStats(const void* a, const void* b) {
+        f64 ta = ((const ProfileZoneStats*)a)->totalMs;
+        f64 tb = ((const ProfileZoneStats*)b)->totalMs;
+        return ta < tb ? 1 : (ta > tb ? -1 : 0);
+    }
+
+    void profileBeginFrame(u64 frame) {
+        if(!profileEnabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        u64 boundary = profileTicks();
+        calibrate();
+        bool previous = numFrames > 0;
+        u64 previousFrame = previous ? frames[(numFrames - 1) & (LE_PROFILE_MAX_FRAMES - 1)].frame : 0;
+        ProfileFrameStats& cpuStats = frameStats[previousFrame & (LE_PROFILE_LANE_FRAMES - 1)];
+        if(previous) {
+            // reuses the stats of the frame LE_PROFILE_LANE_FRAMES ago, lanes are too late for it now
+            SDL_memset(&cpuStats, 0, sizeof(cpuStats));
+            cpuStats.frame = previousFrame;
+        }
+        u64 incomplete = previousFrame + 1; // the oldest frame that may get more zones
+        u32 n = numThreads.load(std::memory_order_acquire);
+        for(u32 t=0; t<n; ++t) {
+            ProfileThread* thread = threads[t];
+            u64 written = thread->written.load(std::memory_order_acquire);
+            if(written - thread->aggregated > LE_PROFILE_ZONES_PER_THREAD) {
+                droppedZones += written - thread->aggregated - LE_PROFILE_ZONES_PER_THREAD;
+                thread->aggregated = written - LE_PROFILE_ZONES_PER_THREAD;
+            }
+            // zones are finished in order, the ones ending after the boundary belong to this frame
+            for(; thread->aggregated < written; thread->aggregated++) {
+                ProfileZone zone = thread->zones[thread->aggregated & (LE_PROFILE_ZONES_PER_THREAD - 1)];
+                // like the export, drop the copy if the owner overwrote it meanwhile
+                std::atomic_thread_fence(std::memory_order_acquire);
+                u64 writtenAfter = thread->written.load(std::memory_order_relaxed);
+                if(writtenAfter - thread->aggregated > LE_PROFILE_ZONES_PER_THREAD) {
+                    droppedZones += writtenAfter - thread->aggregated - LE_PROFILE_ZONES_PER_THREAD;
+                    thread->aggregated = writtenAfter - LE_PROFILE_ZONES_PER_THREAD - 1;
+                    continue;
+                }
+                if(thread->lane) {
+                    if(!previous) {
+                        continue;
+                    }
+                    // lane zones go to the frame that issued them, however late they were recorded
+                    s32 age = (s32)((u32)previousFrame - zone.frame);
+                    if(age < 0) {
+                        break; // issued during this frame, its stats don't exist yet
+                    }
+                    u64 issued = previousFrame - (u64)age;
+                    ProfileFrameStats& stats = frameStats[issued & (LE_PROFILE_LANE_FRAMES - 1)];
+                    if(stats.frame == issued) {
+                        addZone(stats, zone);
+                    } else {
+                        lateZones++;
+                    }
+                    thread->laneFrame = (thread->laneFrame == ~0ull) || (issued > thread->laneFrame) ? issued : thread->laneFrame;
+                    continue;
+                }
+                if(zone.end >= boundary) {
+                    break;
+                }
+                if(previous) {
+                    addZone(cpuStats, zone);
+                }
+            }
+            // more zones of the lane's newest frame may still come
+            if(thread->lane && (thread->laneFrame != ~0ull) && (thread->laneFrame < incomplete)) {
+                incomplete = thread->laneFrame;
+            }
+        }
+        // published once every lane is past it, at the latest before its stats are reused
+        u64 oldest = previousFrame >= LE_PROFILE_LANE_FRAMES - 1 ? previousFrame - (LE_PROFILE_LANE_FRAMES - 1) : 0;
+        if(previous && ((incomplete > oldest) || (oldest > 0))) {
+            u64 complete = incomplete > oldest ? incomplete - 1 : oldest;
+            ProfileFrameStats& stats = frameStats[complete & (LE_PROFILE_LANE_FRAMES - 1)];
+            if((stats.frame == complete) && ((lastStatsFrame == ~0ull) || (complete > lastStatsFrame))) {
+                numLastFrameStats = 0;
+                for(u32 i=0; i<LE_PROFILE_MAX_ZONE_NAMES; ++i) {
+                    if(stats.zones[i].name) {
+                        lastFrameStats[numLastFrameStats++] = stats.zones[i];
+                    }
+                }
+                SDL_qsort(lastFrameStats, numLastFrameStats, sizeof(ProfileZoneStats), compareStats);
+                lastStatsFrame = complete;
+            }
+        }
+        ProfileFrame& slot = frames[numFrames & (LE_PROFILE_MAX_FRAMES - 1)];
+        slot.frame = frame;
+        slot.start = boundary;
+        numFrames++;
+    }
+
+    u32 profileFrameStats(ProfileZoneStats* stats, u32 maxStats, u64* frame) {
+        u32 n = numLastFrameStats < maxStats ? numLastFrameStats : maxStats;
+        SDL_memcpy(stats, lastFrameStats, n * sizeof(ProfileZoneStats));
+        if(frame) {
+            *frame = lastStatsFrame;
+        }
+        return n;
+    }
+
+#pragma mark - Chrome trace -
+
+    static void appendf(Array<char>& out, const char* fmt, ...) {
+        char buffer[256];
+        va_list args;
+        va_start(args, fmt);
+        int n = SDL_vsnprintf(buffer, sizeof(buffer), fmt, args);
+        va_end(args);
+        out.append(buffer, (u32)(n < (int)sizeof(buffer) ? n : (int)sizeof(buffer) - 1));
+    }
+
+    static void appendEscaped(Array<char>& out, const char* s) {
+        for(; *s; ++s) {
+            if((*s == '"') || (*s == '\\')) {
+                out.push('\\');
+            }
+            if((u8)*s >= 0x20) {
+                out.push(*s);
+            }
+        }
+    }
+
+    // start of the frame with this number, if it's still among the recorded ones
+    static bool frameStart(u64 frame, u64* start) {
+        for(u64 i = numFrames > LE_PROFILE_MAX_FRAMES ? numFrames - LE_PROFILE_MAX_FRAMES : 0; i < numFrames; ++i) {
+            const ProfileFrame& slot = frames[i & (LE_PROFILE_MAX_FRAMES - 1)];
+            if(slot.frame == frame) {
+                *start = slot.start;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool profileExportChromeTrace(const char* path, u64 firstFrame, u32 numExportFrames) {
+        u64 begin, end;
+        if(!frameStart(firstFrame, &begin)) {
+            LELOG_WARNING(LogCategoryApp, "profiler: frame %llu is no longer recorded", firstFrame);
+            return false;
+        }
+        if(!frameStart(firstFrame + numExportFrames, &end)) {
+            end = profileTicks(); // the window reaches into the current frame
+        }
+
+        Array<char> json;
+        json.init(HeapAllocator(), 1024*1024);
+        Array<ProfileZone> zones;
+        zones.init();
+        appendf(json, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        u64 numZones = 0;
+        u32 n = numThreads.load(std::memory_order_acquire);
+        for(u32 t=0; t<n; ++t) {
+            ProfileThread* thread = threads[t];
+            appendf(json, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", thread->index);
+            appendEscaped(json, thread->name);
+            appendf(json, "\"}},\n");
+
+            // copy what the ring holds, then drop what its owner overwrote in the meantime
+            u64 written = thread->written.load(std::memory_order_acquire);
+            u64 first = written > LE_PROFILE_ZONES_PER_THREAD ? written - LE_PROFILE_ZONES_PER_THREAD : 0;
+            zones.clear();
+            for(u64 i=first; i<written; ++i) {
+                zones.push(thread->zones[i & (LE_PROFILE_ZONES_PER_THREAD - 1)]);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            u64 writtenAfter = thread->written.load(std::memory_order_relaxed);
+            u64 firstValid = writtenAfter > LE_PROFILE_ZONES_PER_THREAD ? writtenAfter - LE_PROFILE_ZONES_PER_THREAD : 0;
+            for(u64 i = firstValid > first ? firstValid - first : 0; i < zones.count(); ++i) {
+                const ProfileZone& zone = zones[(u32)i];
+                if((zone.end < begin) || (zone.end >= end) || (zone.start < begin)) {
+                    continue;
+                }
+                appendf(json, "{\"name\":\"");
+                appendEscaped(json, zone.name);
+                appendf(json, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f},\n",
+                        thread->index,
+                        profileTicksToSeconds(zone.start - begin) * 1e6,
+                        profileTicksToSeconds(zone.end - zone.start) * 1e6);
+                numZones++;
+            }
+        }
+        // frame boundaries as global instant events
+        for(u64 frame=firstFrame; frame<firstFrame + numExportFrames; ++frame) {
+            u64 start;
+            if(frameStart(frame, &start)) {
+                appendf(json, "{\"name\":\"Frame %llu\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":%.3f},\n",
+                        frame, profileTicksToSeconds(start - begin) * 1e6);
+            }
+        }
+        // strip the last comma
+        json.resize(json.count() - 2);
+        appendf(json, "\n]}\n");
+
+        Data data;
+        data.bytes = (u8*)json.data();
+        data.size = json.count();
+        bool written = fileSave(path, data);
+        if(written) {
+            LELOG_INFO(LogCategoryApp, "profiler: wrote %llu zones of frames %llu to %llu to %s", numZones, firstFrame, firstFrame + numExportFrames - 1, path);
+        } else {
+            LELOG_WARNING(LogCategoryIO, "profiler: couldn't write %s", path);
+        }
+        zones.deinit();
+        json.deinit();
+        return written;
+    }
+}
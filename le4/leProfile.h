@@ -0,0 +1,168 @@
+#pragma once
+
+#include "le4.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// LE_PROFILE=0 compiles all zones out
+#ifndef LE_PROFILE
+#define LE_PROFILE 1
+#endif
+
+// zones each thread keeps before its ring wraps around, must be a power of 2
+#ifndef LE_PROFILE_ZONES_PER_THREAD
+#define LE_PROFILE_ZONES_PER_THREAD 32768
+#endif
+
+#define LE_PROFILE_MAX_THREADS 64
+#define LE_PROFILE_MAX_FRAMES 512 // frame starts kept for aggregation and export, must be a power of 2
+#define LE_PROFILE_MAX_ZONE_NAMES 256 // distinct zone names aggregated per frame
+#define LE_PROFILE_LANE_FRAMES 8 // frames a lane may record zones after the frame that issued them, must be a power of 2
+
+namespace le4 {
+
+#pragma mark - Profiler -
+
+    // a finished zone, in profileTicks()
+    struct ProfileZone {
+        const char* name;
+        u64         start;
+        u64         end;
+        u32         depth; // number of enclosing zones on the same thread
+        u32         frame; // lanes only, low bits of the frame that issued the zone
+    };
+
+    // Every thread records into its own ring of zones. Only the owner writes, readers on other
+    // threads copy a range and then check written again to drop zones that were overwritten meanwhile.
+    struct ProfileThread {
+        ProfileZone*        zones;
+        std::atomic<u64>    written; // zones ever finished on this thread
+        u32                 depth;
+        u32                 index; // in the thread list, the tid of exported traces
+        u64                 aggregated; // zones already counted into a frame, main thread only
+        bool                lane;
+        u64                 laneFrame; // newest frame the lane recorded zones of, main thread only, ~0 before
+        char                name[32];
+    };
+
+    extern std::atomic<bool> profileEnabled;
+    extern std::atomic<u32> profileGeneration; // bumped by profileDeinit(), which frees the rings
+    extern thread_local ProfileThread* profileThreadSelf;
+    extern thread_local u32 profileThreadGeneration; // of profileThreadSelf
+
+    // The CPU's time stamp counter on x86 and arm64, otherwise SDL_GetPerformanceCounter.
+    // Converted with a rate calibrated against SDL_GetPerformanceCounter.
+    inline u64 profileTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        u64 ticks;
+        __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        return SDL_GetPerformanceCounter();
+#endif
+    }
+
+    // registers the calling thread, NULL if there are too many
+    ProfileThread* profileThreadRegister();
+
+    // the calling thread's ring, registers it on first use and again after a profileDeinit()
+    inline ProfileThread* profileThread() {
+        ProfileThread* result = profileThreadSelf;
+        bool current = profileThreadGeneration == profileGeneration.load(std::memory_order_relaxed);
+        return result && current ? result : profileThreadRegister();
+    }
+
+    inline void profileWriteZone(ProfileThread* thread, const char* name, u64 start, u64 end, u32 depth, u64 frame = 0) {
+        u64 index = thread->written.load(std::memory_order_relaxed);
+        ProfileZone& zone = thread->zones[index & (LE_PROFILE_ZONES_PER_THREAD - 1)];
+        zone.name = name;
+        zone.start = start;
+        zone.end = end;
+        zone.depth = depth;
+        zone.frame = (u32)frame;
+        thread->written.store(index + 1, std::memory_order_release);
+    }
+
+    struct ProfileScope {
+        ProfileThread*  thread;
+        const char*     name;
+        u64             start;
+
+        ProfileScope(const char* inName) {
+            thread = NULL;
+            if(profileEnabled.load(std::memory_order_relaxed)) {
+                thread = profileThread();
+                if(thread) {
+                    name = inName;
+                    thread->depth++;
+                    start = profileTicks();
+                }
+            }
+        }
+
+        ~ProfileScope() {
+            if(thread) {
+                u64 end = profileTicks();
+                profileWriteZone(thread, name, start, end, --thread->depth);
+            }
+        }
+    };
+
+#define LE_PROFILE_CONCAT2(a, b) a##b
+#define LE_PROFILE_CONCAT(a, b) LE_PROFILE_CONCAT2(a, b)
+
+    // Times the rest of the enclosing block. name must outlive the profiler, e.g. a literal.
+#if LE_PROFILE
+#define LE_PROFILE_SCOPE(name) le4::ProfileScope LE_PROFILE_CONCAT(leProfileScope, __LINE__)(name)
+#else
+#define LE_PROFILE_SCOPE(name)
+#endif
+
+    // zones with the same name that ended during one frame, on any thread
+    struct ProfileZoneStats {
+        const char* name;
+        u32         count;
+        f64         totalMs;
+        f64         maxMs;
+    };
+
+    // Calibrates the ticks, registers the calling thread as the main thread and starts recording.
+    // Nothing is recorded before.
+    void profileInit();
+    // Stops recording and frees all rings. No thread may be inside a zone meanwhile. Threads that
+    // keep running get a new ring when they record after the next profileInit().
+    void profileDeinit();
+    void profileSetEnabled(bool enabled);
+    void profileSetThreadName(const char* name); // registers the calling thread under name, if the profiler runs
+    f64 profileTicksToSeconds(u64 ticks);
+    u64 profileSecondsToTicks(f64 seconds);
+
+    // A lane of zones that aren't timed by scopes on the thread that records them, e.g. GPU
+    // timings read back later. Only one thread at a time may record into a lane. NULL if the
+    // profiler doesn't run or there are too many lanes.
+    ProfileThread* profileLaneRegister(const char* name);
+    // Zones are aggregated into frame, the one that issued them, if they're recorded within
+    // LE_PROFILE_LANE_FRAMES of it. All zones of a frame must be recorded before any of a later
+    // one. start and end in profileTicks().
+    inline void profileLaneRecord(ProfileThread* lane, u64 frame, const char* name, u64 start, u64 end, u32 depth) {
+        profileWriteZone(lane, name, start, end, depth, frame);
+    }
+
+    // Marks the start of frame on the main thread, and aggregates the zones that ended during the
+    // previous one by name, and those lanes recorded meanwhile into the frames that issued them.
+    void profileBeginFrame(u64 frame);
+    // Aggregated zones of the last complete frame, by total time, longest first. That's the
+    // previous one, or once lanes record zones the last one they're done with. Returns how many
+    // were written.
+    u32 profileFrameStats(ProfileZoneStats* stats, u32 maxStats, u64* frame = NULL);
+
+    // Writes the zones of all threads that ended during [firstFrame, firstFrame + numFrames) as a
+    // Chrome trace event JSON file, which chrome://tracing and ui.perfetto.dev open. The frames
+    // must still be among the last LE_PROFILE_MAX_FRAMES, and their zones in the rings.
+    // Returns false if the window is no longer available or the file couldn't be written.
+    bool profileExportChromeTrace(const char* path, u64 firstFrame, u32 numFrames);
+}
@@ -0,0 +1,362 @@
+#pragma once
+
+#include "le4.h"
+#include <new>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace le4 {
+
+#pragma mark - Queue -
+
+#define LE_CACHE_LINE_SIZE 64
+
+    // spins before a blocking push or pop goes to sleep on its semaphore
+#ifndef LE_QUEUE_SPINS
+#define LE_QUEUE_SPINS 256
+#endif
+
+    // tells the core we're spinning, so it can back off and yield to its hyperthread
+    inline void cpuRelax() {
+#if defined(__SSE2__)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    // Lets threads sleep until a condition becomes true. The side making it true calls notify()
+    // afterwards, which only touches the semaphore if somebody is actually sleeping.
+    // Sleepers register before checking the condition a last time, and notify() reads the number
+    // of sleepers after a full fence, so a wakeup can't get lost between the check and the wait.
+    struct QueueSignal {
+        SDL_sem*            sem;
+        std::atomic<u32>    sleepers;
+
+        void init() {
+            sem = SDL_CreateSemaphore(0);
+            LEASSERTM(sem != NULL, "%s", SDL_GetError());
+            sleepers.store(0);
+        }
+
+        void deinit() {
+            SDL_DestroySemaphore(sem);
+            sem = NULL;
+        }
+
+        // wakes up to count sleepers
+        void notify(u32 count = 1) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            u32 n = sleepers.load(std::memory_order_relaxed);
+            for(u32 i=0; i<n && i<count; ++i) {
+                SDL_SemPost(sem);
+            }
+        }
+
+        template<typename F> void waitUntil(F ready) {
+            for(u32 i=0; i<LE_QUEUE_SPINS; ++i) {
+                if(ready()) {
+                    return;
+                }
+                cpuRelax();
+            }
+            for(;;) {
+                sleepers.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if(ready()) {
+                    sleepers.fetch_sub(1);
+                    return;
+                }
+                // surplus posts from earlier notifies only cause another round through the loop
+                SDL_SemWait(sem);
+                sleepers.fetch_sub(1);
+                if(ready()) {
+                    return;
+                }
+            }
+        }
+    };
+
+    // Bounded single producer, single consumer ring.
+    // tryPush/tryPop and their batch versions are wait-free: each side only writes its own index
+    // and reads the other one, and keeps a cached copy of it so it doesn't touch the other side's
+    // cache line until the ring looks full or empty. push/pop block until there's room or an item.
+    // Items are copied with memcpy, so only plain values can be queued, e.g. pointers or messages.
+    template<typename T>
+    struct SpscQueue {
+        static_assert(std::is_trivially_copyable<T>::value, "queues copy items as bytes");
+
+        // capacity is rounded up to a power of 2
+        void init(u32 inCapacity) {
+            LEASSERT(inCapacity > 0 && inCapacity <= (1u << 31));
+            capacity = nextPowerOf2(inCapacity);
+            mask = capacity - 1;
+            items = (T*)SDL_malloc(sizeof(T) * capacity);
+            head.store(0);
+            tail.store(0);
+            cachedHead = 0;
+            cachedTail = 0;
+            notEmpty.init();
+            notFull.init();
+        }
+
+        void deinit() {
+            notEmpty.deinit();
+            notFull.deinit();
+            SDL_free(items);
+            items = NULL;
+        }
+
+        // producer only. Returns the number of items pushed, which is less than n if the ring fills up.
+        u32 tryPush(const T* src, u32 n) {
+            u32 t = tail.load(std::memory_order_relaxed);
+            if(capacity - (t - cachedHead) < n) {
+                cachedHead = head.load(std::memory_order_acquire);
+            }
+            u32 space = capacity - (t - cachedHead);
+            n = n < space ? n : space;
+            copyIn(t, src, n);
+            tail.store(t + n, std::memory_order_release);
+            if(n) {
+                notEmpty.notify();
+            }
+            return n;
+        }
+
+        bool tryPush(const T& item) { return tryPush(&item, 1) == 1; }
+
+        // producer only, blocks until all n items are queued
+        void push(const T* src, u32 n) {
+            while(n) {
+                u32 pushed = tryPush(src, n);
+                src += pushed;
+                n -= pushed;
+                if(n) {
+                    notFull.waitUntil([this]{ return (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire)) < capacity; });
+                }
+            }
+        }
+
+        void push(const T& item) { push(&item, 1); }
+
+        // consumer only. Pops up to n items, returns how many.
+        u32 tryPop(T* dst, u32 n) {
+            u32 h = head.load(std::memory_order_relaxed);
+            if(cachedTail - h < n) {
+                cachedTail = tail.load(std::memory_order_acquire);
+            }
+            u32 available = cachedTail - h;
+            n = n < available ? n : available;
+            copyOut(h, dst, n);
+            head.store(h + n, std::memory_order_release);
+            if(n) {
+                notFull.notify();
+            }
+            return n;
+        }
+
+        bool tryPop(T* item) { return tryPop(item, 1) == 1; }
+
+        // consumer only, blocks until at least one item is available. Returns the number popped.
+        u32 pop(T* dst, u32 n) {
+            for(;;) {
+                u32 popped = tryPop(dst, n);
+                if(popped) {
+                    return popped;
+                }
+                notEmpty.waitUntil([this]{ return tail.load(std::memory_order_acquire) != head.load(std::memory_order_relaxed); });
+            }
+        }
+
+        void pop(T* item) { pop(item, 1); }
+
+        // approximate when called concurrently with push or pop
+        u32 count() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+
+    private:
+        u8                  padding0[LE_CACHE_LINE_SIZE];
+        // consumer's line
+        std::atomic<u32>    head;
+        u32                 cachedTail;
+        u8                  padding1[LE_CACHE_LINE_SIZE - 2 * sizeof(u32)];
+        // producer's line
+        std::atomic<u32>    tail;
+        u32                 cachedHead;
+        u8                  padding2[LE_CACHE_LINE_SIZE - 2 * sizeof(u32)];
+        // read only after init
+        T*                  items;
+        u32                 capacity;
+        u32                 mask;
+        QueueSignal         notEmpty;
+        QueueSignal         notFull;
+
+        // copies in up to two runs, the second one after the ring wraps
+        void copyIn(u32 pos, const T* src, u32 n) {
+            u32 i = pos & mask;
+            u32 first = n < capacity - i ? n : capacity - i;
+            SDL_memcpy(items + i, src, sizeof(T) * first);
+            SDL_memcpy(items, src + first, sizeof(T) * (n - first));
+        }
+
+        void copyOut(u32 pos, T* dst, u32 n) {
+            u32 i = pos & mask;
+            u32 first = n < capacity - i ? n : capacity - i;
+            SDL_memcpy(dst, items + i, sizeof(T) * first);
+            SDL_memcpy(dst + first, items, sizeof(T) * (n - first));
+        }
+    };
+
+    // Bounded multi producer, multi consumer ring, after Dmitry Vyukov's design.
+    // Every cell carries a sequence number that says whether it's ready for the producer or the
+    // consumer of a given lap, so producers and consumers only contend on their own index.
+    // Claiming cells is a single CAS that fails only if another thread claimed them first, which
+    // makes the try functions lock-free rather than wait-free. Batches claim a run of consecutive
+    // ready cells with one CAS.
+    template<typename T>
+    struct MpmcQueue {
+        static_assert(std::is_trivially_copyable<T>::value, "queues copy items as bytes");
+
+        // capacity is rounded up to a power of 2
+        void init(u32 inCapacity) {
+            LEASSERT(inCapacity > 0 && inCapacity <= (1u << 31));
+            capacity = nextPowerOf2(inCapacity);
+            capacity = capacity < 2 ? 2 : capacity;
+            mask = capacity - 1;
+            cells = (Cell*)SDL_malloc(sizeof(Cell) * capacity);
+            for(u32 i=0; i<capacity; ++i) {
+                new (&cells[i].sequence) std::atomic<u32>(i);
+            }
+            enqueuePos.store(0);
+            dequeuePos.store(0);
+            notEmpty.init();
+            notFull.init();
+        }
+
+        void deinit() {
+            notEmpty.deinit();
+            notFull.deinit();
+            SDL_free(cells);
+            cells = NULL;
+        }
+
+        // returns the number of items pushed, which is less than n if the ring fills up
+        u32 tryPush(const T* src, u32 n) {
+            u32 pos = enqueuePos.load(std::memory_order_relaxed);
+            for(;;) {
+                // count the cells that are free for this lap
+                u32 k = 0;
+                while(k < n && cells[(pos + k) & mask].sequence.load(std::memory_order_acquire) == pos + k) {
+                    k++;
+                }
+                if(!k) {
+                    s32 diff = (s32)(cells[pos & mask].sequence.load(std::memory_order_acquire) - pos);
+                    if(diff < 0) {
+                        return 0; // full
+                    }
+                    // another producer got there first
+                    pos = enqueuePos.load(std::memory_order_relaxed);
+                    continue;
+                }
+                if(enqueuePos.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                    for(u32 i=0; i<k; ++i) {
+                        Cell& cell = cells[(pos + i) & mask];
+                        cell.value = src[i];
+                        cell.sequence.store(pos + i + 1, std::memory_order_release);
+                    }
+                    notEmpty.notify(k);
+                    return k;
+                }
+            }
+        }
+
+        bool tryPush(const T& item) { return tryPush(&item, 1) == 1; }
+
+        // blocks until all n items are queued
+        void push(const T* src, u32 n) {
+            while(n) {
+                u32 pushed = tryPush(src, n);
+                src += pushed;
+                n -= pushed;
+                if(n) {
+                    notFull.waitUntil([this]{
+                        u32 pos = enqueuePos.load(std::memory_order_relaxed);
+                        return (s32)(cells[pos & mask].sequence.load(std::memory_order_acquire) - pos) >= 0;
+                    });
+                }
+            }
+        }
+
+        void push(const T& item) { push(&item, 1); }
+
+        // pops up to n items, returns how many
+        u32 tryPop(T* dst, u32 n) {
+            u32 pos = dequeuePos.load(std::memory_order_relaxed);
+            for(;;) {
+                // count the cells that are filled for this lap
+                u32 k = 0;
+                while(k < n && cells[(pos + k) & mask].sequence.load(std::memory_order_acquire) == pos + k + 1) {
+                    k++;
+                }
+                if(!k) {
+                    s32 diff = (s32)(cells[pos & mask].sequence.load(std::memory_order_acquire) - (pos + 1));
+                    if(diff < 0) {
+                        return 0; // empty
+                    }
+                    pos = dequeuePos.load(std::memory_order_relaxed);
+                    continue;
+                }
+                if(dequeuePos.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                    for(u32 i=0; i<k; ++i) {
+                        Cell& cell = cells[(pos + i) & mask];
+                        dst[i] = cell.value;
+                        // ready for the producer of the next lap
+                        cell.sequence.store(pos + i + capacity, std::memory_order_release);
+                    }
+                    notFull.notify(k);
+                    return k;
+                }
+            }
+        }
+
+        bool tryPop(T* item) { return tryPop(item, 1) == 1; }
+
+        // blocks until at least one item is available. Returns the number popped.
+        u32 pop(T* dst, u32 n) {
+            for(;;) {
+                u32 popped = tryPop(dst, n);
+                if(popped) {
+                    return popped;
+                }
+                notEmpty.waitUntil([this]{
+                    u32 pos = dequeuePos.load(std::memory_order_relaxed);
+                    return (s32)(cells[pos & mask].sequence.load(std::memory_order_acquire) - (pos + 1)) >= 0;
+                });
+            }
+        }
+
+        void pop(T* item) { pop(item, 1); }
+
+        // approximate when called concurrently with push or pop
+        u32 count() const { return enqueuePos.load(std::memory_order_acquire) - dequeuePos.load(std::memory_order_acquire); }
+
+    private:
+        struct Cell {
+            std::atomic<u32>    sequence;
+            T                   value;
+        };
+
+        u8                  padding0[LE_CACHE_LINE_SIZE];
+        std::atomic<u32>    enqueuePos;
+        u8                  padding1[LE_CACHE_LINE_SIZE - sizeof(u32)];
+        std::atomic<u32>    dequeuePos;
+        u8                  padding2[LE_CACHE_LINE_SIZE - sizeof(u32)];
+        Cell*               cells;
+        u32                 capacity;
+        u32                 mask;
+        QueueSignal         notEmpty;
+        QueueSignal         notFull;
+    };
+}
@@ -0,0 +1,344 @@
+#include "leResources.h"
+#include "leMetrics.h"
+
+namespace le4 {
+
+    static const u32 initialCapacity = 64;
+
+    static u32 slotIndex(ResourceId id, ResourceType type, u32 capacity) {
+        return (id ^ ((u32)type * 0x9e3779b9)) & (capacity - 1);
+    }
+
+    void ResourceManager::init(u64 inCpuBudget, u64 inGpuBudget) {
+        cpuBudget = inCpuBudget;
+        gpuBudget = inGpuBudget;
+        SDL_memset(&stats, 0, sizeof(ResourceStats));
+        capacity = initialCapacity;
+        slots = (ResourceEntry**)SDL_calloc(capacity, sizeof(ResourceEntry*));
+        lruHead = NULL;
+        lruTail = NULL;
+    }
+
+    void ResourceManager::deinit() {
+        for(u32 i=0; i<capacity; ++i) {
+            if(slots[i]) {
+                LEVERIFYM(slots[i]->refCount == 0, "resource %08x still has %d references", slots[i]->id, slots[i]->refCount);
+                destroy(slots[i]);
+                slots[i] = NULL;
+            }
+        }
+        SDL_free(slots);
+        slots = NULL;
+        capacity = 0;
+        lruHead = NULL;
+        lruTail = NULL;
+    }
+
+    ResourceEntry* ResourceManager::find(ResourceId id, ResourceType type) {
+        u32 mask = capacity - 1;
+        for(u32 i = slotIndex(id, type, capacity); slots[i]; i = (i + 1) & mask) {
+            if((slots[i]->id == id) && (slots[i]->type == type)) {
+                return slots[i];
+            }
+        }
+        return NULL;
+    }
+
+    void ResourceManager::grow() {
+        ResourceEntry** oldSlots = slots;
+        u32 oldCapacity = capacity;
+        capacity *= 2;
+        slots = (ResourceEntry**)SDL_calloc(capacity, sizeof(ResourceEntry*));
+        for(u32 i=0; i<oldCapacity; ++i) {
+            ResourceEntry* entry = oldSlots[i];
+            if(entry) {
+                u32 j = slotIndex(entry->id, entry->type, capacity);
+                while(slots[j]) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                slots[j] = entry;
+            }
+        }
+        SDL_free(oldSlots);
+    }
+
+    ResourceEntry* ResourceManager::insert(ResourceId id, ResourceType type) {
+        // keep load factor below 3/4
+        if((stats.numEntries + 1) * 4 > capacity * 3) {
+            grow();
+        }
+        ResourceEntry* entry = (ResourceEntry*)SDL_calloc(1, sizeof(ResourceEntry));
+        entry->id = id;
+        entry->type = type;
+        entry->path = stringLookup(id);
+
+        u32 i = slotIndex(id, type, capacity);
+        while(slots[i]) {
+            i = (i + 1) & (capacity - 1);
+        }
+        slots[i] = entry;
+        stats.numEntries++;
+        return entry;
+    }
+
+    // linear probing removal with backward shift, so lookups never need tombstones
+    void ResourceManager::remove(ResourceEntry* entry) {
+        u32 mask = capacity - 1;
+        u32 i = slotIndex(entry->id, entry->type, capacity);
+        while(slots[i] != entry) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = NULL;
+        for(u32 j = (i + 1) & mask; slots[j]; j = (j + 1) & mask) {
+            u32 home = slotIndex(slots[j]->id, slots[j]->type, capacity);
+            // move entry j into the hole if its home slot is not within (i, j]
+            if(((j - home) & mask) >= ((j - i) & mask)) {
+                slots[i] = slots[j];
+                slots[j] = NULL;
+                i = j;
+            }
+        }
+        stats.numEntries--;
+    }
+
+    void ResourceManager::destroy(ResourceEntry* entry) {
+        switch(entry->type) {
+            case ResourceTypeData: entry->data.deinit(); break;
+            case ResourceTypeBitmap: entry->bitmap.deinit(); break;
+            case ResourceTypeShaderProgram: glDeleteProgram(entry->program);GLASSERT; break;
+            case ResourceTypeImage: sg_destroy_image(entry->image); break;
+        }
+        stats.cpuBytes -= entry->cpuBytes;
+        stats.gpuBytes -= entry->gpuBytes;
+        SDL_free(entry);
+    }
+
+    void ResourceManager::evict(ResourceEntry* entry) {
+        LEASSERT(entry->refCount == 0);
+        lruUnlink(entry);
+        remove(entry);
+        destroy(entry);
+        stats.evictions++;
+        LE_COUNTER_ADD(ResourceEvictions, 1);
+    }
+
+    void ResourceManager::lruLink(ResourceEntry* entry) {
+        entry->lruPrev = lruTail;
+        entry->lruNext = NULL;
+        if(lruTail) {
+            lruTail->lruNext = entry;
+        } else {
+            lruHead = entry;
+        }
+        lruTail = entry;
+        stats.numUnreferenced++;
+    }
+
+    void ResourceManager::lruUnlink(ResourceEntry* entry) {
+        if(entry->lruPrev) {
+            entry->lruPrev->lruNext = entry->lruNext;
+        } else {
+            lruHead = entry->lruNext;
+        }
+        if(entry->lruNext) {
+            entry->lruNext->lruPrev = entry->lruPrev;
+        } else {
+            lruTail = entry->lruPrev;
+        }
+        entry->lruPrev = NULL;
+        entry->lruNext = NULL;
+        stats.numUnreferenced--;
+    }
+
+    void ResourceManager::retainEntry(ResourceEntry* entry) {
+        LEASSERT(entry);
+        if(entry->refCount == 0) {
+            lruUnlink(entry);
+        }
+        entry->refCount++;
+    }
+
+    void ResourceManager::releaseEntry(ResourceEntry* entry) {
+        LEASSERT(entry);
+        LEASSERTM(entry->refCount > 0, "resource %08x released too often", entry->id);
+        entry->refCount--;
+        if(entry->refCount == 0) {
+            lruLink(entry);
+            trim();
+        }
+    }
+
+    void ResourceManager::trim() {
+        ResourceEntry* entry = lruHead;
+        while(entry) {
+            bool cpuOver = cpuBudget && (stats.cpuBytes > cpuBudget);
+            bool gpuOver = gpuBudget && (stats.gpuBytes > gpuBudget);
+            if(!cpuOver && !gpuOver) {
+                break;
+            }
+            ResourceEntry* next = entry->lruNext;
+            // only evict entries that actually free memory in the exceeded budget
+            if((cpuOver && entry->cpuBytes) || (gpuOver && entry->gpuBytes)) {
+                evict(entry);
+            }
+            entry = next;
+        }
+    }
+
+    void ResourceManager::purge() {
+        while(lruHead) {
+            evict(lruHead);
+        }
+    }
+
+    void ResourceManager::setBudget(u64 inCpuBudget, u64 inGpuBudget) {
+        cpuBudget = inCpuBudget;
+        gpuBudget = inGpuBudget;
+        trim();
+    }
+
+    void ResourceManager::logStats() {
+        LELOG("resources: %d entries (%d unreferenced), cpu %llu/%llu bytes, gpu %llu/%llu bytes",
+              stats.numEntries, stats.numUnreferenced,
+              stats.cpuBytes, cpuBudget, stats.gpuBytes, gpuBudget);
+        LELOG("resources: %llu hits, %llu misses, %llu evictions", stats.hits, stats.misses, stats.evictions);
+    }
+
+    // on a cache hit, returns a new reference to the cached entry. Expects the interned path as id
+    // in scope, declares relativeFilePath for the miss.
+    #define LE_RESOURCE_LOOKUP(resType, resField) \
+        ResourceEntry* entry = find(id, resType); \
+        if(entry) { \
+            stats.hits++; \
+            LE_COUNTER_ADD(ResourceHits, 1); \
+            retainEntry(entry); \
+            return handle(entry, &entry->resField); \
+        } \
+        stats.misses++; \
+        LE_COUNTER_ADD(ResourceMisses, 1); \
+        const char* relativeFilePath = stringLookup(id); \
+        LEASSERTM(relativeFilePath != NULL, "resource path %08x was never interned", id);
+
+    DataHandle ResourceManager::loadData(const char* relativeFilePath) {
+        StringId id;
+        if(!stringTryIntern(relativeFilePath, &id)) {
+            return handle<Data>(NULL, NULL);
+        }
+        return loadData(id);
+    }
+
+    BitmapHandle ResourceManager::loadBitmap(const char* relativeFilePath) {
+        StringId id;
+        if(!stringTryIntern(relativeFilePath, &id)) {
+            return handle<Bitmap>(NULL, NULL);
+        }
+        return loadBitmap(id);
+    }
+
+    ShaderProgramHandle ResourceManager::loadShaderProgram(const char* path) {
+        StringId id;
+        if(!stringTryIntern(path, &id)) {
+            return handle<GLuint>(NULL, NULL);
+        }
+        return loadShaderProgram(id);
+    }
+
+    ImageHandle ResourceManager::loadImage(const char* relativeFilePath) {
+        StringId id;
+        if(!stringTryIntern(relativeFilePath, &id)) {
+            return handle<sg_image>(NULL, NULL);
+        }
+        return loadImage(id);
+    }
+
+    DataHandle ResourceManager::loadData(StringId id) {
+        LE_RESOURCE_LOOKUP(ResourceTypeData, data);
+
+        Data data = fileLoadResource(relativeFilePath);
+        if(!data.bytes) {
+            return handle<Data>(NULL, NULL);
+        }
+        entry = insert(id, ResourceTypeData);
+        entry->data = data;
+        entry->cpuBytes = data.size;
+        stats.cpuBytes += entry->cpuBytes;
+        entry->refCount = 1;
+        trim();
+        return handle(entry, &entry->data);
+    }
+
+    BitmapHandle ResourceManager::loadBitmap(StringId id) {
+        LE_RESOURCE_LOOKUP(ResourceTypeBitmap, bitmap);
+
+        Data data = fileLoadResource(relativeFilePath);
+        if(!data.bytes) {
+            return handle<Bitmap>(NULL, NULL);
+        }
+        entry = insert(id, ResourceTypeBitmap);
+        entry->bitmap.init(data);
+        data.deinit();
+        entry->cpuBytes = entry->bitmap.width * entry->bitmap.height * (entry->bitmap.format == RGBA ? 4u : 3u);
+        stats.cpuBytes += entry->cpuBytes;
+        entry->refCount = 1;
+        trim();
+        return handle(entry, &entry->bitmap);
+    }
+
+    ShaderProgramHandle ResourceManager::loadShaderProgram(StringId id) {
+        LE_RESOURCE_LOOKUP(ResourceTypeShaderProgram, program);
+
+        entry = insert(id, ResourceTypeShaderProgram);
+        entry->program = le4::loadShaderProgram(relativeFilePath);
+        entry->refCount = 1;
+        return handle(entry, &entry->program);
+    }
+
+    ImageHandle ResourceManager::loadImage(StringId id) {
+        LE_RESOURCE_LOOKUP(ResourceTypeImage, image);
+        MemoryTagScope tag(MemoryTagRender);
+
+        // decoded pixels are only needed for the upload, the bitmap entry stays cached until evicted
+        BitmapHandle bmp = loadBitmap(id);
+        if(!bmp.valid()) {
+            return handle<sg_image>(NULL, NULL);
+        }
+
+        u32 numPixels = bmp->width * bmp->height;
+        u8* pixels = bmp->data;
+        if(bmp->format == RGB) {
+            pixels = (u8*)SDL_malloc(numPixels * 4);
+            for(u32 i=0; i<numPixels; ++i) {
+                pixels[i*4+0] = bmp->data[i*3+0];
+                pixels[i*4+1] = bmp->data[i*3+1];
+                pixels[i*4+2] = bmp->data[i*3+2];
+                pixels[i*4+3] = 0xff;
+            }
+        }
+
+        sg_image_desc desc;
+        SDL_memset(&desc, 0, sizeof(sg_image_desc));
+        desc.width = bmp->width;
+        desc.height = bmp->height;
+        desc.pixel_format = SG_PIXELFORMAT_RGBA8;
+        desc.min_filter = SG_FILTER_LINEAR;
+        desc.mag_filter = SG_FILTER_LINEAR;
+        desc.content.subimage[0][0].ptr = pixels;
+        desc.content.subimage[0][0].size = (int)(numPixels * 4);
+        desc.label = relativeFilePath;
+
+        entry = insert(id, ResourceTypeImage);
+        entry->image = sg_make_image(&desc);
+        entry->gpuBytes = numPixels * 4;
+        stats.gpuBytes += entry->gpuBytes;
+        entry->refCount = 1;
+
+        if(pixels != bmp->data) {
+            SDL_free(pixels);
+        }
+        release(bmp);
+        trim();
+        return handle(entry, &entry->image);
+    }
+
+    #undef LE_RESOURCE_LOOKUP
+}
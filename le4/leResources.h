@@ -0,0 +1,131 @@
+#pragma once
+
+#include "le4.h"
+#include "legl.h"
+#include "sokol_gfx.h"
+
+namespace le4 {
+
+#pragma mark - Resources -
+
+    enum ResourceType {
+        ResourceTypeData,
+        ResourceTypeBitmap,
+        ResourceTypeShaderProgram,
+        ResourceTypeImage
+    };
+
+    // one cache slot. Payload members are only valid for the entry's type.
+    struct ResourceEntry {
+        ResourceId      id;       // hash of the relative resource path
+        ResourceType    type;
+        const char*     path;     // interned relative resource path, compared on lookups by path
+        u32             refCount;
+        u32             cpuBytes; // memory accounted against the cpu budget
+        u32             gpuBytes; // memory accounted against the gpu budget
+        ResourceEntry*  lruPrev;  // only linked while refCount == 0
+        ResourceEntry*  lruNext;
+
+        Data            data;
+        Bitmap          bitmap;
+        GLuint          program;
+        sg_image        image;
+    };
+
+    // typed, refcounted reference to a cached resource.
+    // must be returned with ResourceManager::release once done with it.
+    template<typename T>
+    struct ResourceHandle {
+        ResourceEntry*  entry;
+        T*              value;
+
+        bool valid() const { return entry != NULL; }
+        T* operator->() const { return value; }
+        T& operator*() const { return *value; }
+    };
+
+    typedef ResourceHandle<Data>     DataHandle;
+    typedef ResourceHandle<Bitmap>   BitmapHandle;
+    typedef ResourceHandle<GLuint>   ShaderProgramHandle;
+    typedef ResourceHandle<sg_image> ImageHandle;
+
+    struct ResourceStats {
+        u64 hits;
+        u64 misses;
+        u64 evictions;
+        u64 cpuBytes;
+        u64 gpuBytes;
+        u32 numEntries;
+        u32 numUnreferenced;
+    };
+
+    // Caches resources loaded from the resource path, keyed by hash of the relative path and type.
+    // Loading the same path twice returns the same entry with an increased refcount. Paths are
+    // interned with stringTryIntern(), a path whose hash belongs to another interned string fails
+    // to load.
+    // Entries whose refcount drops to zero stay cached and are evicted least recently used first
+    // whenever the cpu or gpu budget is exceeded.
+    // Images are created with sokol_gfx, so sg_setup must have been called before loading any.
+    struct ResourceManager {
+        u64             cpuBudget; // bytes, 0 means unlimited
+        u64             gpuBudget; // bytes, 0 means unlimited
+        ResourceStats   stats;
+
+        void init(u64 inCpuBudget, u64 inGpuBudget);
+        void deinit(); // destroys all entries, handles must not be used afterwards
+
+        DataHandle          loadData(const char* relativeFilePath);
+        BitmapHandle        loadBitmap(const char* relativeFilePath);
+        ShaderProgramHandle loadShaderProgram(const char* path); // path without .vs/.fs extension
+        ImageHandle         loadImage(const char* relativeFilePath); // uploads the bitmap as RGBA8
+
+        // same as above for interned paths, cache hits don't touch the path string at all
+        DataHandle          loadData(StringId relativeFilePath);
+        BitmapHandle        loadBitmap(StringId relativeFilePath);
+        ShaderProgramHandle loadShaderProgram(StringId path);
+        ImageHandle         loadImage(StringId relativeFilePath);
+
+        // adds another reference to an existing handle
+        template<typename T> ResourceHandle<T> retain(const ResourceHandle<T>& handle) {
+            retainEntry(handle.entry);
+            return handle;
+        }
+
+        // drops a reference and invalidates the handle
+        template<typename T> void release(ResourceHandle<T>& handle) {
+            releaseEntry(handle.entry);
+            handle.entry = NULL;
+            handle.value = NULL;
+        }
+
+        void setBudget(u64 inCpuBudget, u64 inGpuBudget); // evicts immediately if necessary
+        void trim();  // evicts unreferenced entries until both budgets are met
+        void purge(); // evicts all unreferenced entries
+        void logStats();
+
+    private:
+        ResourceEntry** slots;    // open addressing table, capacity is a power of 2
+        u32             capacity;
+        ResourceEntry*  lruHead;  // least recently used unreferenced entry
+        ResourceEntry*  lruTail;  // most recently used unreferenced entry
+
+        ResourceEntry* find(ResourceId id, ResourceType type);
+        ResourceEntry* insert(ResourceId id, ResourceType type);
+        void remove(ResourceEntry* entry);
+        void grow();
+        void destroy(ResourceEntry* entry);
+        void evict(ResourceEntry* entry);
+
+        void retainEntry(ResourceEntry* entry);
+        void releaseEntry(ResourceEntry* entry);
+        void lruLink(ResourceEntry* entry);
+        void lruUnlink(ResourceEntry* entry);
+
+        template<typename T> ResourceHandle<T> handle(ResourceEntry* entry, T* value) {
+            ResourceHandle<T> result;
+            result.entry = entry;
+            result.value = value;
+            return result;
+        }
+    };
+}
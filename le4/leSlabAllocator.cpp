@@ -0,0 +1,290 @@
+#include "le4.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <mach/vm_statistics.h>
+#endif
+
+// Size class slab allocator backing the SDL memory hooks, see patchSDLMemoryFuncs.
+//
+// Small blocks (up to LE_SLAB_MAX_SMALL bytes) are rounded up to one of 40 size classes and carved
+// from 64k slabs, which in turn are carved from 2mb spans mapped from the OS. Each thread keeps a
+// free list per class and only talks to the shared central lists in batches, so the common
+// malloc/free pair doesn't touch any shared cache line. Medium blocks go to the system allocator,
+// blocks of 2mb or more are mapped directly and backed by huge pages where the OS allows it.
+// Memory of small blocks is never returned to the OS.
+
+#define LE_SLAB_SPAN_SIZE   (2*1024*1024)
+#define LE_SLAB_SIZE        (64*1024)
+#define LE_SLAB_MAX_SMALL   (32*1024)
+#define LE_SLAB_NUM_CLASSES 40
+#define LE_SLAB_MAX_BATCH   32
+#define LE_SLAB_HUGE_PAGE   (2*1024*1024)
+
+namespace le4 {
+
+    struct FreeBlock {
+        FreeBlock*  next;      // next block in the same batch or thread cache list
+        FreeBlock*  nextBatch; // only valid in the first block of a batch in a central list
+    };
+
+    struct CentralList {
+        SDL_SpinLock    lock;
+        FreeBlock*      batches;
+        u8              padding[64 - sizeof(SDL_SpinLock) - sizeof(FreeBlock*)]; // one cache line per class
+    };
+
+    struct ThreadCacheList {
+        FreeBlock*  head;
+        u32         count;
+    };
+
+    static CentralList centralLists[LE_SLAB_NUM_CLASSES];
+
+    static SDL_SpinLock spanLock = 0;
+    static u8* spanCursor = NULL;
+    static u8* spanEnd = NULL;
+    static SDL_atomic_t reservedSpans;
+    static SDL_atomic_t largeBlocks;
+    static SDL_atomic_t largePages;
+
+    // 16 byte steps up to 128, then 4 classes per power of 2
+    static inline u32 slabClass(size_t size) {
+        if(size <= 128) {
+            return size ? (u32)((size + 15) >> 4) - 1 : 0;
+        }
+        size_t s = size - 1;
+        u32 hb = 63 - (u32)__builtin_clzll(s);
+        u32 sub = (u32)(s >> (hb - 2)) & 3;
+        return 8 + (hb - 7) * 4 + sub;
+    }
+
+    static inline size_t slabClassSize(u32 cls) {
+        if(cls < 8) {
+            return (cls + 1) << 4;
+        }
+        u32 hb = 7 + (cls - 8) / 4;
+        u32 sub = (cls - 8) & 3;
+        return (size_t)(4 + sub + 1) << (hb - 2);
+    }
+
+    static inline u32 slabBatchSize(u32 cls) {
+        size_t n = LE_SLAB_SIZE / (4 * slabClassSize(cls));
+        return n < 1 ? 1 : (n > LE_SLAB_MAX_BATCH ? LE_SLAB_MAX_BATCH : (u32)n);
+    }
+
+    static void* mapPages(size_t size) {
+        void* result = MAP_FAILED;
+        if(size >= LE_SLAB_HUGE_PAGE) {
+#if defined(__APPLE__)
+            result = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+#endif
+        }
+        if(result == MAP_FAILED) {
+            result = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+            if(result == MAP_FAILED) {
+                return NULL;
+            }
+#if defined(MADV_HUGEPAGE)
+            if(size >= LE_SLAB_HUGE_PAGE) {
+                madvise(result, size, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        return result;
+    }
+
+    static size_t roundToPages(size_t size) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        return (size + page - 1) & ~(page - 1);
+    }
+
+    static u8* newSlab() {
+        SDL_AtomicLock(&spanLock);
+        if(spanCursor == spanEnd) {
+            // mmap returns page aligned memory, which keeps slabs page aligned as well
+            spanCursor = (u8*)mapPages(LE_SLAB_SPAN_SIZE);
+            LEASSERTM(spanCursor != NULL, "slab allocator out of memory");
+            spanEnd = spanCursor + LE_SLAB_SPAN_SIZE;
+            SDL_AtomicAdd(&reservedSpans, 1);
+        }
+        u8* result = spanCursor;
+        spanCursor += LE_SLAB_SIZE;
+        SDL_AtomicUnlock(&spanLock);
+        return result;
+    }
+
+    // returns a list of up to one batch of free blocks
+    static FreeBlock* centralPop(u32 cls) {
+        CentralList& central = centralLists[cls];
+        SDL_AtomicLock(&central.lock);
+        FreeBlock* result = central.batches;
+        if(result) {
+            central.batches = result->nextBatch;
+        }
+        SDL_AtomicUnlock(&central.lock);
+        if(result) {
+            return result;
+        }
+
+        // carve a new slab into batches, keep the first one and publish the rest
+        u8* slab = newSlab();
+        size_t blockSize = slabClassSize(cls);
+        u32 numBlocks = (u32)(LE_SLAB_SIZE / blockSize);
+        u32 batchSize = slabBatchSize(cls);
+
+        FreeBlock* batches = NULL;
+        for(u32 first = 0; first < numBlocks; first += batchSize) {
+            u32 last = first + batchSize < numBlocks ? first + batchSize : numBlocks;
+            FreeBlock* head = (FreeBlock*)(slab + first * blockSize);
+            for(u32 i = first; i < last; ++i) {
+                FreeBlock* block = (FreeBlock*)(slab + i * blockSize);
+                block->next = (i + 1 < last) ? (FreeBlock*)(slab + (i + 1) * blockSize) : NULL;
+            }
+            head->nextBatch = batches;
+            batches = head;
+        }
+        result = batches;
+        if(batches->nextBatch) {
+            FreeBlock* rest = batches->nextBatch;
+            FreeBlock* restTail = rest;
+            while(restTail->nextBatch) {
+                restTail = restTail->nextBatch;
+            }
+            SDL_AtomicLock(&central.lock);
+            restTail->nextBatch = central.batches;
+            central.batches = rest;
+            SDL_AtomicUnlock(&central.lock);
+        }
+        return result;
+    }
+
+    static void centralPush(u32 cls, FreeBlock* batch) {
+        CentralList& central = centralLists[cls];
+        SDL_AtomicLock(&central.lock);
+        batch->nextBatch = central.batches;
+        central.batches = batch;
+        SDL_AtomicUnlock(&central.lock);
+    }
+
+    struct ThreadCache {
+        ThreadCacheList lists[LE_SLAB_NUM_CLASSES];
+
+        // hand everything back when the thread exits, other threads may still use it
+        ~ThreadCache() {
+            for(u32 cls=0; cls<LE_SLAB_NUM_CLASSES; ++cls) {
+                while(lists[cls].head) {
+                    flush(cls, slabBatchSize(cls));
+                }
+            }
+        }
+
+        void flush(u32 cls, u32 n) {
+            ThreadCacheList& list = lists[cls];
+            FreeBlock* batch = list.head;
+            FreeBlock* tail = batch;
+            u32 taken = 1;
+            while((taken < n) && tail->next) {
+                tail = tail->next;
+                taken++;
+            }
+            list.head = tail->next;
+            list.count -= taken;
+            tail->next = NULL;
+            centralPush(cls, batch);
+        }
+    };
+
+    static thread_local ThreadCache threadCache;
+
+    void* slabAlloc(size_t size) {
+        if(size >= LE_SLAB_HUGE_PAGE) {
+            void* result = mapPages(roundToPages(size));
+            if(result) {
+                SDL_AtomicAdd(&largeBlocks, 1);
+                SDL_AtomicAdd(&largePages, (int)(roundToPages(size) / (size_t)sysconf(_SC_PAGESIZE)));
+            }
+            return result;
+        }
+        if(size > LE_SLAB_MAX_SMALL) {
+            return malloc(size);
+        }
+        u32 cls = slabClass(size);
+        ThreadCacheList& list = threadCache.lists[cls];
+        if(!list.head) {
+            list.head = centralPop(cls);
+            u32 n = 0;
+            for(FreeBlock* b = list.head; b; b = b->next) {
+                n++;
+            }
+            list.count = n;
+        }
+        FreeBlock* result = list.head;
+        list.head = result->next;
+        list.count--;
+        return result;
+    }
+
+    void slabFree(void* ptr, size_t size) {
+        if(!ptr) {
+            return;
+        }
+        if(size >= LE_SLAB_HUGE_PAGE) {
+            size_t mapped = roundToPages(size);
+            munmap(ptr, mapped);
+            SDL_AtomicAdd(&largeBlocks, -1);
+            SDL_AtomicAdd(&largePages, -(int)(mapped / (size_t)sysconf(_SC_PAGESIZE)));
+            return;
+        }
+        if(size > LE_SLAB_MAX_SMALL) {
+            free(ptr);
+            return;
+        }
+        u32 cls = slabClass(size);
+        ThreadCacheList& list = threadCache.lists[cls];
+        FreeBlock* block = (FreeBlock*)ptr;
+        block->next = list.head;
+        list.head = block;
+        list.count++;
+        // keep one batch around for the next allocations, return the rest
+        u32 batch = slabBatchSize(cls);
+        if(list.count >= 2 * batch) {
+            threadCache.flush(cls, batch);
+        }
+    }
+
+    void* slabRealloc(void* ptr, size_t oldSize, size_t newSize) {
+        if(!ptr) {
+            return slabAlloc(newSize);
+        }
+        bool oldSmall = oldSize <= LE_SLAB_MAX_SMALL;
+        bool newSmall = newSize <= LE_SLAB_MAX_SMALL;
+        bool oldHuge = oldSize >= LE_SLAB_HUGE_PAGE;
+        bool newHuge = newSize >= LE_SLAB_HUGE_PAGE;
+        if(oldSmall && newSmall && (slabClass(oldSize) == slabClass(newSize))) {
+            return ptr;
+        }
+        if(oldHuge && newHuge && (roundToPages(oldSize) == roundToPages(newSize))) {
+            return ptr;
+        }
+        if(!oldSmall && !oldHuge && !newSmall && !newHuge) {
+            return realloc(ptr, newSize);
+        }
+        void* result = slabAlloc(newSize);
+        if(result) {
+            SDL_memcpy(result, ptr, oldSize < newSize ? oldSize : newSize);
+            slabFree(ptr, oldSize);
+        }
+        return result;
+    }
+
+    SlabStats slabStats() {
+        SlabStats result;
+        result.reservedBytes = (u64)SDL_AtomicGet(&reservedSpans) * LE_SLAB_SPAN_SIZE;
+        result.largeBlocks = (u32)SDL_AtomicGet(&largeBlocks);
+        result.largeBytes = (u64)SDL_AtomicGet(&largePages) * (u64)sysconf(_SC_PAGESIZE);
+        return result;
+    }
+}
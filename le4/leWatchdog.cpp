@@ -0,0 +1,223 @@
+#include "leWatchdog.h"
+#include "leProfile.h"
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LE_WATCHDOG_SIGNAL SIGUSR2 // sent to the main thread to take its callstack
+
+namespace le4 {
+
+    // filled in by the signal handler on the main thread
+    static void* hangCallstack[LE_WATCHDOG_CALLSTACK_FRAMES];
+    static int hangNumCallstack = 0;
+    static std::atomic<bool> hangCaptured(false);
+    static pthread_t mainThread;
+    static struct sigaction previousAction;
+
+    static void captureCallstack(int) {
+        hangNumCallstack = backtrace(hangCallstack, LE_WATCHDOG_CALLSTACK_FRAMES);
+        hangCaptured.store(true, std::memory_order_release);
+    }
+
+    void FrameWatchdog::init(f32 inBudgetMs, u32 inHistoryFrames, const char* inDirectory, f32 inHangSeconds) {
+        budgetMs = inBudgetMs;
+        historyFrames = inHistoryFrames < LE_WATCHDOG_MAX_HISTORY ? inHistoryFrames : LE_WATCHDOG_MAX_HISTORY - 1;
+        directory = inDirectory;
+        hangSeconds = inHangSeconds;
+        numStalls = 0;
+        numSnapshots = 0;
+        // allocated up front, WatchdogFrame is too big to keep in App
+        frames = (WatchdogFrame*)SDL_calloc(LE_WATCHDOG_MAX_HISTORY, sizeof(WatchdogFrame));
+        numFrames = 0;
+        skipNext = false;
+        heartbeat.store(0, std::memory_order_relaxed);
+        thread = NULL;
+        quit = NULL;
+        if(hangSeconds > 0) {
+            // backtrace might allocate on first use, not something to do in a signal handler
+            backtrace(hangCallstack, LE_WATCHDOG_CALLSTACK_FRAMES);
+            mainThread = pthread_self();
+            struct sigaction action;
+            SDL_memset(&action, 0, sizeof(action));
+            action.sa_handler = captureCallstack;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_RESTART;
+            sigaction(LE_WATCHDOG_SIGNAL, &action, &previousAction);
+            quit = SDL_CreateSemaphore(0);
+            thread = SDL_CreateThread(threadFunc, "le4 Watchdog", this);
+        }
+        LELOG_INFO(LogCategoryApp, "frame watchdog: %.2f ms budget, %u frames history, %s", budgetMs, historyFrames, directory);
+    }
+
+    void FrameWatchdog::deinit() {
+        if(thread) {
+            SDL_SemPost(quit);
+            SDL_WaitThread(thread, NULL);
+            SDL_DestroySemaphore(quit);
+            sigaction(LE_WATCHDOG_SIGNAL, &previousAction, NULL);
+            thread = NULL;
+            quit = NULL;
+        }
+        if(numStalls) {
+            LELOG_WARNING(LogCategoryApp, "frame watchdog: %llu frames over %.2f ms, %u snapshots", numStalls, budgetMs, numSnapshots);
+        }
+        SDL_free(frames);
+        frames = NULL;
+    }
+
+    bool FrameWatchdog::endFrame(u64 frame, f32 ms) {
+        WatchdogFrame& record = frames[frame & (LE_WATCHDOG_MAX_HISTORY - 1)];
+        record.ms = ms;
+        record.memory = memoryLastFrame();
+        metricsLastFrame(&record.metrics);
+        numFrames++;
+        heartbeat.store(frame + 1, std::memory_order_release);
+
+        bool skip = skipNext;
+        skipNext = false;
+        if(skip || (budgetMs <= 0) || (ms <= budgetMs)) {
+            return false;
+        }
+        numStalls++;
+        if(numSnapshots == LE_WATCHDOG_MAX_SNAPSHOTS) {
+            LELOG_WARNING(LogCategoryApp, "frame %llu: %.2f ms, over the %.2f ms budget", frame, ms, budgetMs);
+            return true;
+        }
+        LELOG_WARNING(LogCategoryApp, "frame %llu: %.2f ms, over the %.2f ms budget, writing a snapshot", frame, ms, budgetMs);
+        writeSnapshot(frame);
+        numSnapshots++;
+        skipNext = true;
+        return true;
+    }
+
+    static void writeJsonString(FILE* file, const char* s) {
+        fputc('"', file);
+        for(; *s; ++s) {
+            if((*s == '"') || (*s == '\\')) {
+                fputc('\\', file);
+            }
+            fputc((u8)*s < 0x20 ? ' ' : *s, file);
+        }
+        fputc('"', file);
+    }
+
+    static void writeJsonCallstack(FILE* file, void* const* callstack, u32 numCallstack) {
+        char** symbols = backtrace_symbols(callstack, (int)numCallstack);
+        fprintf(file, "[");
+        for(u32 i=0; i<numCallstack; ++i) {
+            fprintf(file, i ? "," : "");
+            writeJsonString(file, symbols ? symbols[i] : "?");
+        }
+        fprintf(file, "]");
+        free(symbols); // allocated by libc
+    }
+
+    void FrameWatchdog::writeSnapshot(u64 frame) {
+        LE_PROFILE_SCOPE("FrameWatchdog::writeSnapshot");
+        u64 recorded = numFrames < LE_WATCHDOG_MAX_HISTORY ? numFrames : LE_WATCHDOG_MAX_HISTORY;
+        u64 count = historyFrames + 1ull < recorded ? historyFrames + 1ull : recorded;
+        u64 first = frame + 1 - count;
+
+        char name[64];
+        SDL_snprintf(name, sizeof(name), "stall-%llu.jsonl", (unsigned long long)frame);
+        PathString path(directory);
+        path.appendPath(name);
+        FILE* file = fopen(path, "w");
+        if(file == NULL) {
+            LELOG_WARNING(LogCategoryIO, "couldn't open file %s", path.str());
+            return;
+        }
+        for(u64 i=first; i<=frame; ++i) {
+            const WatchdogFrame& record = frames[i & (LE_WATCHDOG_MAX_HISTORY - 1)];
+            fprintf(file, "{\"frame\":%llu,\"ms\":%.3f,\"budget_ms\":%.3f,\"allocations\":%llu,\"frees\":%llu,\"bytes_delta\":%lld,\"live_bytes\":%lld,\"metrics\":",
+                    (unsigned long long)i, record.ms, budgetMs, (unsigned long long)record.memory.numAllocations,
+                    (unsigned long long)record.memory.numFrees, (long long)record.memory.bytesDelta, (long long)record.memory.total.liveBytes);
+            metricsWriteJson(file, record.metrics);
+            fprintf(file, "}\n");
+        }
+        if(memoryTrackingEnabled()) {
+            // sampled allocation sites of the stalled frame, memory tracking only keeps the last one
+            MemorySite sites[32];
+            u32 numSites = memoryTrackingTopSites(sites, 32);
+            for(u32 i=0; i<numSites; ++i) {
+                fprintf(file, "{\"frame\":%llu,\"site\":%u,\"allocations\":%llu,\"bytes\":%llu,\"callstack\":",
+                        (unsigned long long)frame, i, (unsigned long long)sites[i].frameAllocations, (unsigned long long)sites[i].frameBytes);
+                writeJsonCallstack(file, sites[i].frames, sites[i].numFrames);
+                fprintf(file, "}\n");
+            }
+        }
+        bool ok = !ferror(file);
+        LEVERIFYM(0 == fclose(file) && ok, "couldn't write %s", path.str());
+        LELOG_DEBUG(LogCategoryIO, "%s [%llu frames]", path.str(), count);
+
+        if(profileEnabled.load(std::memory_order_relaxed)) {
+            SDL_snprintf(name, sizeof(name), "stall-%llu.trace.json", (unsigned long long)frame);
+            path.clear();
+            path.append(directory).appendPath(name);
+            LEVERIFYM(profileExportChromeTrace(path, first, (u32)count), "frame watchdog: couldn't export the zones of frames %llu to %llu", first, frame);
+        }
+    }
+
+    void FrameWatchdog::writeHang(u64 frame, f64 seconds, void* const* callstack, u32 numCallstack) {
+        LELOG_ERROR(LogCategoryApp, "frame %llu hasn't finished for %.1f s, main thread:", frame, seconds);
+        if(numCallstack) {
+            memoryLogCallstack(callstack, numCallstack);
+        } else {
+            LELOG("    callstack not available");
+        }
+
+        char name[64];
+        SDL_snprintf(name, sizeof(name), "hang-%llu.json", (unsigned long long)frame);
+        PathString path(directory);
+        path.appendPath(name);
+        FILE* file = fopen(path, "w");
+        if(file == NULL) {
+            LELOG_WARNING(LogCategoryIO, "couldn't open file %s", path.str());
+            return;
+        }
+        fprintf(file, "{\"frame\":%llu,\"seconds\":%.3f,\"callstack\":", (unsigned long long)frame, seconds);
+        writeJsonCallstack(file, callstack, numCallstack);
+        fprintf(file, "}\n");
+        bool ok = !ferror(file);
+        LEVERIFYM(0 == fclose(file) && ok, "couldn't write %s", path.str());
+    }
+
+    int FrameWatchdog::threadFunc(void* userData) {
+        FrameWatchdog* self = (FrameWatchdog*)userData;
+        f64 ticksPerSecond = (f64)SDL_GetPerformanceFrequency();
+        u32 pollMs = (u32)(self->hangSeconds * 1000.f / 4.f);
+        pollMs = pollMs < 10 ? 10 : (pollMs > 250 ? 250 : pollMs);
+        u64 lastBeat = self->heartbeat.load(std::memory_order_acquire);
+        u64 lastChange = SDL_GetPerformanceCounter();
+        u64 reported = ~0ull;
+        while(SDL_SemWaitTimeout(self->quit, pollMs) == SDL_MUTEX_TIMEDOUT) {
+            u64 beat = self->heartbeat.load(std::memory_order_acquire);
+            u64 now = SDL_GetPerformanceCounter();
+            if(beat != lastBeat) {
+                lastBeat = beat;
+                lastChange = now;
+                continue;
+            }
+            f64 seconds = (f64)(now - lastChange) / ticksPerSecond;
+            if((seconds < self->hangSeconds) || (reported == beat)) {
+                continue;
+            }
+            // once per hang, a debugger breaking in looks the same
+            reported = beat;
+            hangCaptured.store(false, std::memory_order_relaxed);
+            u32 numCallstack = 0;
+            if(pthread_kill(mainThread, LE_WATCHDOG_SIGNAL) == 0) {
+                for(u32 i=0; (i < 100) && !hangCaptured.load(std::memory_order_acquire); ++i) {
+                    SDL_Delay(1);
+                }
+                numCallstack = hangCaptured.load(std::memory_order_acquire) ? (u32)hangNumCallstack : 0;
+            }
+            self->writeHang(beat, seconds, hangCallstack, numCallstack);
+        }
+        return 0;
+    }
+}
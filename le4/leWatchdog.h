@@ -0,0 +1,56 @@
+#pragma once
+
+#include "le4.h"
+#include "leMetrics.h"
+
+#define LE_WATCHDOG_MAX_HISTORY 64      // frames kept before a stall, must be a power of 2
+#define LE_WATCHDOG_MAX_SNAPSHOTS 16    // stall snapshots written per run, later stalls are only logged
+#define LE_WATCHDOG_CALLSTACK_FRAMES 32 // of the main thread when it hangs
+
+namespace le4 {
+
+#pragma mark - Frame watchdog -
+
+    // what the watchdog keeps of each frame
+    struct WatchdogFrame {
+        f32                 ms;
+        MemoryFrameStats    memory;
+        MetricsFrame        metrics;
+    };
+
+    // Compares every frame against a budget. A frame over it leaves a snapshot in directory:
+    // stall-<frame>.jsonl with time, allocations and metrics of the frame and the historyFrames
+    // frames before it, the allocation sites of the frame if memory tracking is on, and
+    // stall-<frame>.trace.json with the profiler zones that ended during them if the profiler runs.
+    // Optionally also starts a thread that logs the main thread's callstack, and writes it to
+    // hang-<frame>.json, once no frame finished for hangSeconds.
+    struct FrameWatchdog {
+        f32             budgetMs;
+        u32             historyFrames;
+        const char*     directory;
+        f32             hangSeconds;    // 0 for no hang detection
+        u64             numStalls;
+        u32             numSnapshots;
+
+        // call on the main thread
+        void init(f32 inBudgetMs, u32 inHistoryFrames, const char* inDirectory, f32 inHangSeconds);
+        void deinit(); // stops the hang detection thread
+
+        // Call once frame is over, before its memory and metrics are overwritten by the next one,
+        // i.e. after memoryFrameSnapshot() and metricsEndFrame(). Also the heartbeat of the hang
+        // detection. Returns true if frame was over budget.
+        bool endFrame(u64 frame, f32 ms);
+
+    private:
+        WatchdogFrame*      frames;         // LE_WATCHDOG_MAX_HISTORY
+        u64                 numFrames;
+        bool                skipNext;       // the frame that wrote a snapshot pays for it, don't count it as a stall
+        SDL_Thread*         thread;
+        SDL_sem*            quit;
+        std::atomic<u64>    heartbeat;      // frames finished
+
+        void writeSnapshot(u64 frame);
+        void writeHang(u64 frame, f64 seconds, void* const* callstack, u32 numCallstack);
+        static int threadFunc(void* userData);
+    };
+}
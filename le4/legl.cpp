@@ -1,12 +1,140 @@
 #include "legl.h"
 #include "le4.h"
+#include "leFrameStats.h"
 
 #define SOKOL_IMPL
 #define SOKOL_GLCORE33
+#if LE_FRAME_STATS
+#define SOKOL_TRACE_HOOKS // counts the calls of each frame, see renderCountersInstall()
+#endif
 #include "sokol_gfx.h"
 
+// KHR_debug isn't part of the generated 3.3 core loader, it's looked up through SDL instead
+#ifndef GL_DEBUG_OUTPUT
+#define GL_DEBUG_OUTPUT                     0x92E0
+#define GL_DEBUG_SOURCE_API                 0x8246
+#define GL_DEBUG_SOURCE_WINDOW_SYSTEM       0x8247
+#define GL_DEBUG_SOURCE_SHADER_COMPILER     0x8248
+#define GL_DEBUG_SOURCE_THIRD_PARTY         0x8249
+#define GL_DEBUG_SOURCE_APPLICATION         0x824A
+#define GL_DEBUG_SOURCE_OTHER               0x824B
+#define GL_DEBUG_TYPE_ERROR                 0x824C
+#define GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR   0x824D
+#define GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR    0x824E
+#define GL_DEBUG_TYPE_PORTABILITY           0x824F
+#define GL_DEBUG_TYPE_PERFORMANCE           0x8250
+#define GL_DEBUG_TYPE_OTHER                 0x8251
+#define GL_DEBUG_TYPE_MARKER                0x8268
+#define GL_DEBUG_TYPE_PUSH_GROUP            0x8269
+#define GL_DEBUG_TYPE_POP_GROUP             0x826A
+#define GL_DEBUG_SEVERITY_HIGH              0x9146
+#define GL_DEBUG_SEVERITY_MEDIUM            0x9147
+#define GL_DEBUG_SEVERITY_LOW               0x9148
+#define GL_DEBUG_SEVERITY_NOTIFICATION      0x826B
+#endif
+#ifndef GL_DEBUG_OUTPUT_SYNCHRONOUS
+#define GL_DEBUG_OUTPUT_SYNCHRONOUS         0x8242
+#endif
+
 namespace le4 {
 
+    typedef void (APIENTRY *LEGLDebugProc)(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam);
+    typedef void (APIENTRY *LEGLDebugMessageCallback)(LEGLDebugProc callback, const void* userParam);
+    typedef void (APIENTRY *LEGLDebugMessageControl)(GLenum source, GLenum type, GLenum severity, GLsizei count, const GLuint* ids, GLboolean enabled);
+
+    GLValidation leglValidation = {{NULL}, {0}, {0}, true};
+
+    static const char* debugSourceToString(GLenum source) {
+        switch(source) {
+            case GL_DEBUG_SOURCE_API: return "api";
+            case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window system";
+            case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+            case GL_DEBUG_SOURCE_THIRD_PARTY: return "third party";
+            case GL_DEBUG_SOURCE_APPLICATION: return "application";
+            default: return "other";
+        }
+    }
+
+    static const char* debugTypeToString(GLenum type) {
+        switch(type) {
+            case GL_DEBUG_TYPE_ERROR: return "error";
+            case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+            case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined behavior";
+            case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+            case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+            case GL_DEBUG_TYPE_MARKER: return "marker";
+            case GL_DEBUG_TYPE_PUSH_GROUP: return "push group";
+            case GL_DEBUG_TYPE_POP_GROUP: return "pop group";
+            default: return "other";
+        }
+    }
+
+    static const char* debugSeverityToString(GLenum severity) {
+        switch(severity) {
+            case GL_DEBUG_SEVERITY_HIGH: return "high";
+            case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+            case GL_DEBUG_SEVERITY_LOW: return "low";
+            default: return "notification";
+        }
+    }
+
+    // may be called from a driver thread, only touches atomics and the log
+    static void APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei, const GLchar* message, const void*) {
+        const char* file = leglValidation.file.load(std::memory_order_relaxed);
+        int line = leglValidation.line.load(std::memory_order_relaxed);
+        if(type == GL_DEBUG_TYPE_ERROR) {
+            leglValidation.errors.fetch_add(1, std::memory_order_relaxed);
+            LELOG_ERROR(LogCategoryRender, "GL %s %s (%s, id %d): %s [after %s:%d]",
+                        debugSourceToString(source), debugTypeToString(type), debugSeverityToString(severity), id, message, file ? file : "?", line);
+        } else {
+            LELOG_WARNING(LogCategoryRender, "GL %s %s (%s, id %d): %s [after %s:%d]",
+                          debugSourceToString(source), debugTypeToString(type), debugSeverityToString(severity), id, message, file ? file : "?", line);
+        }
+    }
+
+    void leglValidationInit() {
+#if LEGL_VALIDATION == LEGL_VALIDATION_CALLBACK
+        LEGLDebugMessageCallback debugMessageCallback = NULL;
+        LEGLDebugMessageControl debugMessageControl = NULL;
+        if(SDL_GL_ExtensionSupported("GL_KHR_debug")) {
+            debugMessageCallback = (LEGLDebugMessageCallback)SDL_GL_GetProcAddress("glDebugMessageCallback");
+            debugMessageControl = (LEGLDebugMessageControl)SDL_GL_GetProcAddress("glDebugMessageControl");
+        }
+        if(!debugMessageCallback || !debugMessageControl) {
+            LELOG_WARNING(LogCategoryRender, "GL_KHR_debug not supported, falling back to glGetError validation");
+            leglValidation.sync = true;
+            return;
+        }
+        debugMessageCallback(debugCallback, NULL);
+        // notifications are mostly buffer placement chatter
+        debugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, NULL, GL_FALSE);
+        glEnable(GL_DEBUG_OUTPUT);
+#if DEBUG
+        // messages arrive inside the offending call, before the next GLASSERT moves the call site
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+#endif
+        leglValidation.sync = false;
+        LELOG_INFO(LogCategoryRender, "GL validation through KHR_debug callback");
+#endif
+    }
+
+    void leglCheckSync(const char* file, int line, bool fatal) {
+        GLenum err;
+        int numErrors = 0;
+        while((err = glGetError())) {
+            LELOG_ERROR(LogCategoryRender, "GL error: %s at %s:%d", leglErrorToString(err), file, line);
+            numErrors++;
+        }
+        if(fatal && (numErrors > 0)) {
+            LEASSERTM(false, "failed with GL error at %s:%d", file, line);
+        }
+    }
+
+    void leglFailPending(const char* file, int line) {
+        LEASSERTM(false, "failed with %d GL errors reported between %s:%d and %s:%d", leglValidation.errors.load(),
+                  leglValidation.file.load(), leglValidation.line.load(), file, line);
+    }
+
     const char* leglErrorToString(GLenum err) {
         const char* result = NULL;
         #define ERR(e) case e: result = #e; break;
@@ -106,15 +234,15 @@ namespace le4 {
     }
 
     GLuint loadShaderProgram(const char* path) {
-        char* fspath = concat(path, ".fs");
-        char* vspath = concat(path, ".vs");
+        MemoryTagScope tag(MemoryTagRender);
+        PathString fspath(path);
+        PathString vspath(path);
+        fspath.append(".fs");
+        vspath.append(".vs");
 
         Data fsdata = fileLoadResource(fspath);
         Data vsdata = fileLoadResource(vspath);
 
-        SDL_free(fspath);
-        SDL_free(vspath);
-
         GLuint shaderProgram = glCreateProgram();GLASSERT;
 
         GLuint vs = glCreateShader(GL_VERTEX_SHADER);GLASSERT;
@@ -151,7 +279,7 @@ namespace le4 {
 
         if(!leglShaderProgramLinked(shaderProgram))
         {
-            LELOG("================= SHADER PROGRAM LINK FAILED: %s", path);
+            LELOG_ERROR(LogCategoryRender, "================= SHADER PROGRAM LINK FAILED: %s", path);
             LELOG("%s", leglShaderProgramGetLog(shaderProgram));
             LEASSERTM(false, "ERROR: shader program link failed");
         }
@@ -9,6 +9,25 @@
 #define LEGL_MAX_TEXTURES 4
 #define LEGL_MAX_UNIFORMBLOCK_ENTRIES 4
 
+// GL error checking done by GLASSERT/GLDEBUG, chosen at build time with LEGL_VALIDATION:
+// OFF:      both compile to nothing.
+// CALLBACK: the driver reports errors through a KHR_debug callback. GLASSERT only records its
+//           call site, so reports can name the last checked call, and asserts on errors the
+//           callback has seen since. Debug builds make the output synchronous for that, otherwise
+//           a report may name a later call. Falls back to SYNC if the context doesn't support KHR_debug.
+// SYNC:     drains glGetError after each checked call, which stalls the driver every time.
+#define LEGL_VALIDATION_OFF      0
+#define LEGL_VALIDATION_CALLBACK 1
+#define LEGL_VALIDATION_SYNC     2
+
+#ifndef LEGL_VALIDATION
+#if DEBUG
+#define LEGL_VALIDATION LEGL_VALIDATION_CALLBACK
+#else
+#define LEGL_VALIDATION LEGL_VALIDATION_OFF
+#endif
+#endif
+
 
 namespace le4 {
 
@@ -50,9 +69,38 @@ namespace le4 {
 
     GLuint loadShaderProgram(const char* path);
 
-    #if 1
-    #define GLDEBUG {GLenum err; while((err = glGetError())) { LELOG("GL error: %s", le4::leglErrorToString(err)); }}
-    #define GLASSERT {GLenum err; int numErrors = 0; while((err = glGetError())) { LELOG("GL error: %s", le4::leglErrorToString(err)); numErrors++;} if(numErrors>0) {LEASSERTM(false, "failed with GL error");}}
+    struct GLValidation {
+        std::atomic<const char*>    file;   // call site of the last GLASSERT/GLDEBUG
+        std::atomic<int>            line;
+        std::atomic<u32>            errors; // reported by the callback, not yet asserted on
+        bool                        sync;   // no debug callback installed, check with glGetError
+    };
+
+    extern GLValidation leglValidation;
+
+    // installs the KHR_debug callback for LEGL_VALIDATION_CALLBACK, call once the context is current
+    void leglValidationInit();
+    void leglCheckSync(const char* file, int line, bool fatal);
+    void leglFailPending(const char* file, int line);
+
+    inline void leglCheckpoint(const char* file, int line, bool fatal) {
+        if(leglValidation.sync) {
+            leglCheckSync(file, line, fatal);
+            return;
+        }
+        if(fatal && leglValidation.errors.load(std::memory_order_relaxed)) {
+            leglFailPending(file, line);
+        }
+        leglValidation.file.store(file, std::memory_order_relaxed);
+        leglValidation.line.store(line, std::memory_order_relaxed);
+    }
+
+    #if LEGL_VALIDATION == LEGL_VALIDATION_CALLBACK
+    #define GLDEBUG { le4::leglCheckpoint(__FILE__, __LINE__, false); }
+    #define GLASSERT { le4::leglCheckpoint(__FILE__, __LINE__, true); }
+    #elif LEGL_VALIDATION == LEGL_VALIDATION_SYNC
+    #define GLDEBUG { le4::leglCheckSync(__FILE__, __LINE__, false); }
+    #define GLASSERT { le4::leglCheckSync(__FILE__, __LINE__, true); }
     #else
     #define GLDEBUG
     #define GLASSERT
@@ -1,5 +1,24 @@
 #import <XCTest/XCTest.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
 #import "le4.h"
+#import "leApp.h"
+#import "leArray.h"
+#import "leFileWriter.h"
+#import "leFrameStats.h"
+#import "leGpuProfile.h"
+#import "leHash.h"
+#import "leHashMap.h"
+#import "leJobs.h"
+#import "leMetrics.h"
+#import "leProfile.h"
+#import "lePool.h"
+#import "leQueue.h"
+#import "leResources.h"
+#import "leWatchdog.h"
 
 using namespace le4;
 
@@ -9,6 +28,11 @@ using namespace le4;
 
 @implementation le4Tests
 
++ (void)setUp {
+    // before anything allocates through SDL, so every block carries an le4 header
+    patchSDLMemoryFuncs();
+}
+
 - (void)setUp {
     // Put setup code here. This method is called before the invocation of each test method in the class.
 }
@@ -62,5 +86,1368 @@ using namespace le4;
     XCTAssert(!p4.isInside(r));
 }
 
+-(void)testStrings {
+    static_assert(LE_SID("images/test.png") == hashDjb2("images/test.png"), "literal ids are hashed at compile time");
+
+    StringId id = stringIntern("images/test.png");
+    XCTAssert(id == LE_SID("images/test.png"));
+    XCTAssert(stringIntern("images/test.png") == id);
+    XCTAssert(!SDL_strcmp(stringLookup(id), "images/test.png"));
+    XCTAssert(stringLookup(LE_SID("never interned")) == NULL);
+
+    // "Ez" and "FY" hash the same, the second one doesn't get the id
+    StringId first, second;
+    XCTAssert(stringTryIntern("le4StringsEz", &first) && stringTryIntern("le4StringsEz", &second) && first == second);
+    XCTAssert(!stringTryIntern("le4StringsFY", &second) && second == first);
+    XCTAssert(!SDL_strcmp(stringLookup(first), "le4StringsEz"));
+
+    PathString path("resources");
+    path.appendPath("shaders/sprite").append(".vs");
+    XCTAssert(!SDL_strcmp(path, "resources/shaders/sprite.vs"));
+    XCTAssert(path.length == SDL_strlen("resources/shaders/sprite.vs"));
+    XCTAssert(path.id() == LE_SID("resources/shaders/sprite.vs"));
+
+    // paths that don't fit fail instead of asserting
+    std::string longName(sizeof(PathString::chars), 'x');
+    XCTAssert(!path.tryAppendPath(longName.c_str()));
+    XCTAssert(!SDL_strcmp(path, "resources/shaders/sprite.vs"));
+    XCTAssert(path.tryAppend(longName.c_str() + path.length + 1));
+    XCTAssert(path.length == sizeof(PathString::chars) - 1);
+    XCTAssert(!path.tryAppend("x"));
+    PathString absolute;
+    XCTAssert(!resourcePath(absolute, longName.c_str()));
+    Data data = fileLoadResource(longName.c_str());
+    XCTAssert(data.bytes == NULL);
+    XCTAssert(data.size == 0);
+    data.bytes = (u8*)"x";
+    data.size = 1;
+    XCTAssert(!fileSaveResource(longName.c_str(), data));
+}
+
+-(void)testAsyncLog {
+    LogStats before = logStats();
+    logInit(64*1024);
+    for(int i=0; i<1000; ++i) {
+        LELOG("message %d of %s, %.2f %5.*s %lld %%", i, "testAsyncLog", i * 0.5, 3, "unterminated", (long long)i << 40);
+    }
+    logFlush();
+    LogStats after = logStats();
+    logDeinit();
+    XCTAssert((after.numMessages - before.numMessages) + (after.numDropped - before.numDropped) == 1000);
+    XCTAssert(after.highWater <= 64*1024);
+}
+
+-(void)testLogFiltering {
+    __block int evaluations = 0;
+    int (^evaluate)() = ^{ return ++evaluations; };
+
+    logSetCategoryEnabled(LogCategoryAudio, false);
+    LELOG_ERROR(LogCategoryAudio, "disabled category %d", evaluate());
+    XCTAssert(evaluations == 0);
+    logSetCategoryEnabled(LogCategoryAudio, true);
+
+    static LogRateLimit limit;
+    u32 allowed = 0;
+    for(int i=0; i<1000; ++i) {
+        allowed += limit.allow(__FILE__, __LINE__, __FUNCTION__) ? 1 : 0;
+    }
+    XCTAssert(allowed == LE_LOG_RATE_LIMIT);
+    XCTAssert(limit.suppressed == 1000 - LE_LOG_RATE_LIMIT);
+}
+
+-(void)testHash64 {
+    static_assert(LE_HASH("shaders/sprite") == hash64Literal("shaders/sprite"), "literal hashes are computed at compile time");
+    XCTAssert(LE_HASH("shaders/sprite") == hash64("shaders/sprite"));
+    XCTAssert(hash64("a", 1) != hash64("b", 1));
+    XCTAssert(hash64("abc", 3, 1) != hash64("abc", 3, 2));
+
+    // the constexpr reader must agree with the SIMD path, including the bulk stripes
+    static char bytes[4096];
+    for(u32 i=0; i<sizeof(bytes); ++i) {
+        bytes[i] = (char)(i * 131 + 7);
+    }
+    for(size_t len=0; len<sizeof(bytes); len += len < 128 ? 1 : 61) {
+        XCTAssert(hash64(bytes, len, 42) == hash::wyhash<hash::ConstexprReader>((const char*)bytes, len, 42));
+    }
+
+    Hasher a;
+    a.init();
+    a.add(1.5f).add("blend").add(7);
+    Hasher b;
+    b.init();
+    b.add(1.5f).add("blend").add(8);
+    XCTAssert(a.finish() != b.finish());
+}
+
+- (void)testPerformanceHash64 {
+    u32 size = 16*1024*1024;
+    u8* bytes = (u8*)SDL_calloc(1, size);
+    [self measureBlock:^{
+        u64 h = 0;
+        for(u32 i=0; i<16; ++i) {
+            h ^= hash64(bytes, size, i);
+        }
+        XCTAssert(h != 0);
+    }];
+    SDL_free(bytes);
+}
+
+-(void)testHashMap {
+    HashMap<u32, u32> map;
+    map.init();
+    for(u32 i=0; i<1000; ++i) {
+        map.insert(i, i * 3);
+    }
+    XCTAssert(map.count() == 1000);
+    XCTAssert(*map.find(500) == 1500);
+    XCTAssert(map.find(1000) == NULL);
+
+    // removes leave tombstones or empties, neither may break later probes
+    for(u32 i=0; i<1000; i+=2) {
+        XCTAssert(map.remove(i));
+    }
+    XCTAssert(!map.remove(0));
+    XCTAssert(map.count() == 500);
+    for(u32 i=0; i<1000; ++i) {
+        XCTAssert((map.find(i) != NULL) == ((i & 1) != 0));
+    }
+    bool inserted;
+    *map.findOrInsert(2, &inserted) = 7;
+    XCTAssert(inserted && *map.find(2) == 7);
+    map.findOrInsert(2, &inserted);
+    XCTAssert(!inserted);
+
+    u32 sum = 0;
+    map.forEach([&](const u32&, u32& value) { sum += value; });
+    XCTAssert(sum == 7 + 3 * 250000);
+    map.deinit();
+
+    // string keys in a zone, looked up by a precomputed hash
+    Zone zone;
+    zone.init(64*1024);
+    HashMap<const char*, u32, ZoneAllocator> names;
+    names.init(ZoneAllocator(zone), 64);
+    names.insert("sprite", 1);
+    names.insert("text", 2);
+    char key[] = "text";
+    XCTAssert(*names.find(key) == 2);
+    XCTAssert(*names.find("sprite", LE_HASH("sprite")) == 1);
+    names.deinit();
+    zone.deinit();
+}
+
+- (void)testPerformanceHashMap {
+    [self measureBlock:^{
+        HashMap<u64, u64> map;
+        map.init();
+        for(u64 i=0; i<1000000; ++i) {
+            map.insert(i * 0x9e3779b97f4a7c15ull, i);
+        }
+        u64 sum = 0;
+        for(u64 i=0; i<4000000; ++i) {
+            sum += *map.find((i * 7919 % 1000000) * 0x9e3779b97f4a7c15ull);
+        }
+        XCTAssert(sum != 0);
+        map.deinit();
+    }];
+}
+
+- (void)testPerformanceStdUnorderedMap {
+    [self measureBlock:^{
+        std::unordered_map<u64, u64> map;
+        for(u64 i=0; i<1000000; ++i) {
+            map[i * 0x9e3779b97f4a7c15ull] = i;
+        }
+        u64 sum = 0;
+        for(u64 i=0; i<4000000; ++i) {
+            sum += map.find((i * 7919 % 1000000) * 0x9e3779b97f4a7c15ull)->second;
+        }
+        XCTAssert(sum != 0);
+    }];
+}
+
+-(void)testArray {
+    Array<u32> a;
+    a.init();
+    for(u32 i=0; i<100; ++i) {
+        a.push(i);
+    }
+    u32 more[3] = {1000, 1001, 1002};
+    a.insert(10, more, 3);
+    XCTAssert(a.count() == 103 && a[10] == 1000 && a[13] == 10 && a.last() == 99);
+    a.remove(10, 3);
+    XCTAssert(a.count() == 100 && a[10] == 10);
+    a.removeSwap(0);
+    XCTAssert(a[0] == 99);
+    a.append(more, 3);
+    a.resize(200);
+    XCTAssert(a[101] == 1002 && a[199] == 0);
+
+    Array<u32> b;
+    b.init();
+    b.moveFrom(a);
+    XCTAssert(b.count() == 200 && a.count() == 0);
+    a.deinit();
+    b.deinit();
+
+    // non trivial elements are moved one by one and destroyed exactly once
+    SmallArray<std::string, 4> s;
+    s.init();
+    s.push("a");
+    s.push("b");
+    XCTAssert(s.isInline());
+    for(u32 i=0; i<10; ++i) {
+        s.push(std::to_string(i));
+    }
+    s.insert(1, std::string("c"));
+    XCTAssert(!s.isInline() && s[1] == "c" && s[3] == "0");
+    SmallArray<std::string, 4> t;
+    t.init();
+    t.moveFrom(s);
+    XCTAssert(t.count() == 13 && t.last() == "9" && s.count() == 0);
+    XCTAssert(s.isInline() && s.capacity() == 4);
+    s.push("d");
+    XCTAssert(s.isInline() && s[0] == "d");
+    s.deinit();
+    t.deinit();
+
+    // growing an Array of inline SmallArrays keeps each one pointing into itself
+    Array<SmallArray<u32, 4>> nested;
+    nested.init();
+    for(u32 i=0; i<50; ++i) {
+        SmallArray<u32, 4> small;
+        small.init();
+        for(u32 j=0; j<i % 8; ++j) {
+            small.push(i + j);
+        }
+        nested.push(std::move(small));
+    }
+    for(u32 i=0; i<50; ++i) {
+        SmallArray<u32, 4>& small = nested[i];
+        XCTAssert(small.count() == i % 8 && small.isInline() == (i % 8 <= 4));
+        if(small.isInline()) {
+            XCTAssert((u8*)small.data() >= (u8*)&small && (u8*)small.data() < (u8*)(&small + 1));
+        }
+        for(u32 j=0; j<small.count(); ++j) {
+            XCTAssert(small[j] == i + j);
+        }
+        small.deinit();
+    }
+    nested.deinit();
+
+    Zone zone;
+    zone.init(4096);
+    Array<u64, ZoneAllocator> z;
+    z.init(ZoneAllocator(zone));
+    for(u64 i=0; i<1000; ++i) {
+        z.push(i);
+    }
+    XCTAssert(z[999] == 999);
+    z.deinit();
+    zone.deinit();
+}
+
+- (void)testPerformanceSmallArray {
+    [self measureBlock:^{
+        u64 sum = 0;
+        for(u32 r=0; r<10000; ++r) {
+            SmallArray<u32, 64, SlabAllocator> a;
+            a.init();
+            for(u32 i=0; i<1000; ++i) {
+                a.push(i);
+            }
+            sum += a[r % 1000];
+            a.deinit();
+        }
+        XCTAssert(sum != 0);
+    }];
+}
+
+-(void)testPool {
+    Pool<vec2> pool;
+    pool.init();
+
+    PoolHandle handles[100];
+    for(int i=0; i<100; ++i) {
+        vec2* v;
+        handles[i] = pool.create(&v);
+        XCTAssert(handles[i].valid());
+        *v = vec2(i, i);
+    }
+    XCTAssert(pool.count() == 100);
+    XCTAssert(*pool.get(handles[42]) == vec2(42, 42));
+
+    pool.destroy(handles[42]);
+    XCTAssert(!pool.alive(handles[42]));
+    XCTAssert(pool.get(handles[42]) == NULL);
+
+    // the freed slot is reused, but the old handle must stay stale
+    PoolHandle h = pool.create();
+    XCTAssert(h.index() == handles[42].index());
+    XCTAssert(!(h == handles[42]));
+    XCTAssert(pool.get(handles[42]) == NULL);
+
+    u32 n = 0;
+    pool.forEach([&](PoolHandle, vec2&) { n++; });
+    XCTAssert(n == 100);
+
+    PoolStats stats = pool.stats();
+    XCTAssert(stats.live == 100);
+    XCTAssert(stats.capacity == 128);
+
+    pool.deinit();
+}
+
+-(void)testAllocationGuard {
+    memoryGuardBegin();
+    void* p = SDL_malloc(32);
+    p = SDL_realloc(p, 64);
+    MemoryGuardReport report = memoryGuardEnd();
+    SDL_free(p);
+    XCTAssert(report.numAllocations == 2);
+    XCTAssert(report.bytes == 96);
+    XCTAssert(report.numFrames > 0);
+
+    memoryGuardBegin();
+    p = SDL_malloc(16);
+    SDL_free(p);
+    report = memoryGuardEnd();
+    XCTAssert(report.numAllocations == 1);
+}
+
+- (void)testMemoryAccounting {
+    MemoryStats before = memoryStats();
+    void* p = SDL_malloc(100);
+    void* q = SDL_calloc(4, 25);
+    MemoryStats stats = memoryStats();
+    XCTAssert(stats.numMalloc == before.numMalloc + 1);
+    XCTAssert(stats.numCalloc == before.numCalloc + 1);
+    XCTAssert(stats.liveBytes == before.liveBytes + 200);
+    XCTAssert(stats.liveAllocations == before.liveAllocations + 2);
+    XCTAssert(((u8*)q)[99] == 0);
+
+    SDL_memset(p, 0x5a, 100);
+    p = SDL_realloc(p, 300);
+    stats = memoryStats();
+    XCTAssert(((u8*)p)[99] == 0x5a);
+    XCTAssert(stats.numRealloc == before.numRealloc + 1);
+    XCTAssert(stats.liveBytes == before.liveBytes + 400);
+    XCTAssert(stats.liveAllocations == before.liveAllocations + 2);
+    XCTAssert(stats.peakBytes >= stats.liveBytes);
+
+    {
+        MemoryTagScope scope(MemoryTagAudio);
+        void* r = SDL_malloc(64);
+        stats = memoryStats();
+        XCTAssert(stats.tagLiveBytes[MemoryTagAudio] == before.tagLiveBytes[MemoryTagAudio] + 64);
+        XCTAssert(stats.tagAllocations[MemoryTagAudio] == before.tagAllocations[MemoryTagAudio] + 1);
+        SDL_free(r);
+    }
+    SDL_free(p);
+    SDL_free(q);
+    SDL_free(NULL);
+    stats = memoryStats();
+    XCTAssert(stats.numFree == before.numFree + 4);
+    XCTAssert(stats.liveBytes == before.liveBytes);
+    XCTAssert(stats.liveAllocations == before.liveAllocations);
+    XCTAssert(stats.tagLiveBytes[MemoryTagAudio] == before.tagLiveBytes[MemoryTagAudio]);
+}
+
+static __attribute__((noinline)) void trackedAllocs(void** ptrs, u32 count, u32 size) {
+    for(u32 i=0; i<count; ++i) {
+        ptrs[i] = SDL_malloc(size);
+    }
+}
+
+static __attribute__((noinline)) void trackedOtherAllocs(void** ptrs, u32 count, u32 size) {
+    for(u32 i=0; i<count; ++i) {
+        ptrs[i] = SDL_malloc(size);
+    }
+}
+
+- (void)testMemoryTracking {
+    memoryTrackingEnable(1, 0);
+    XCTAssert(memoryTrackingEnabled());
+    memoryTrackingEndFrame(); // whatever allocated before
+
+    void* ptrs[10];
+    trackedAllocs(ptrs, 10, 1000);
+    void* other[3];
+    trackedOtherAllocs(other, 3, 500);
+    memoryTrackingEndFrame();
+    MemorySite sites[4];
+    u32 numSites = memoryTrackingTopSites(sites, 4);
+    XCTAssert(numSites >= 2);
+    XCTAssert(sites[0].frameBytes == 10000);
+    XCTAssert(sites[0].frameAllocations == 10);
+    XCTAssert(sites[0].liveBytes == 10000);
+    XCTAssert(sites[0].numFrames > 0);
+    XCTAssert(sites[1].frameBytes == 1500);
+    XCTAssert(sites[1].frameAllocations == 3);
+
+    // a realloc stays with its site, frees reduce what is live
+    ptrs[0] = SDL_realloc(ptrs[0], 2000);
+    for(u32 i=5; i<10; ++i) {
+        SDL_free(ptrs[i]);
+    }
+    for(u32 i=0; i<3; ++i) {
+        SDL_free(other[i]);
+    }
+    void* p;
+    trackedOtherAllocs(&p, 1, 100); // another callstack, so another site
+    memoryTrackingEndFrame();
+    numSites = memoryTrackingTopSites(sites, 4);
+    XCTAssert(numSites >= 1);
+    XCTAssert(sites[0].frameBytes == 100);
+    XCTAssert(sites[0].frameAllocations == 1);
+    XCTAssert(sites[0].totalAllocations == 1);
+    SDL_free(p);
+
+    // only the site that still has live allocations is dumped, stdout goes to a file meanwhile
+    NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"le4MemoryTracking.txt"];
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int fd = open(path.UTF8String, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    memoryTrackingDumpLive();
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    NSString* dump = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:nil];
+    XCTAssert([dump containsString:@"live allocation site: 6000 bytes in 5 allocations"]);
+    XCTAssert(![dump containsString:@"live allocation site: 0 bytes"]);
+
+    for(u32 i=0; i<5; ++i) {
+        SDL_free(ptrs[i]);
+    }
+    memoryTrackingEnable(0, 0);
+    XCTAssert(!memoryTrackingEnabled());
+    memoryTrackingEndFrame();
+}
+
+- (void)testZone {
+    Zone zone;
+    zone.init(256);
+    XCTAssert(zone.numBlocks == 0);
+
+    // alignment, padding counts as allocated
+    u8* a = (u8*)zone.alloc(1, 1);
+    u8* b = (u8*)zone.alloc(8, 64);
+    XCTAssert(((uintptr_t)b & 63) == 0);
+    XCTAssert(zone.allocated == (size_t)(b + 8 - a));
+    u64* c = zone.alloc<u64>(3);
+    XCTAssert(((uintptr_t)c & (alignof(u64) - 1)) == 0);
+    XCTAssert(zone.numBlocks == 1);
+
+    // growth, the rest of a block is skipped, larger allocations get a dedicated block
+    SDL_memset(a, 0xab, 1);
+    u8* d = (u8*)zone.alloc(240, 16);
+    XCTAssert(zone.numBlocks == 2);
+    XCTAssert(*a == 0xab);
+    u8* e = (u8*)zone.alloc(1000, 16);
+    XCTAssert(zone.numBlocks == 3);
+    SDL_memset(d, 1, 240);
+    SDL_memset(e, 2, 1000);
+    XCTAssert(zone.highWater == zone.allocated);
+
+    // marker rollback, the same memory is handed out again
+    ZoneMarker marker = zone.mark();
+    size_t allocated = zone.allocated;
+    u8* f = (u8*)zone.alloc(32, 16);
+    zone.alloc(2000, 16);
+    XCTAssert(zone.numBlocks == 5);
+    zone.rewind(marker);
+    XCTAssert(zone.allocated == allocated);
+    XCTAssert(zone.alloc(32, 16) == f);
+    allocated = zone.allocated;
+    {
+        ZoneScope scope(zone);
+        XCTAssert(!SDL_strcmp(zone.strdup("scoped"), "scoped"));
+        XCTAssert(zone.allocated == allocated + 7);
+    }
+    XCTAssert(zone.allocated == allocated);
+
+    // reset keeps the blocks for reuse
+    size_t highWater = zone.highWater;
+    zone.reset();
+    XCTAssert(zone.allocated == 0);
+    XCTAssert(zone.highWater == highWater);
+    memoryGuardBegin();
+    XCTAssert(zone.alloc(1, 1) == a);
+    XCTAssert(zone.alloc(8, 64) == b);
+    XCTAssert(zone.alloc<u64>(3) == c);
+    XCTAssert(zone.alloc(240, 16) == d);
+    XCTAssert(zone.alloc(1000, 16) == e);
+    XCTAssert(zone.alloc(32, 16) == f);
+    zone.alloc(2000, 16);
+    MemoryGuardReport report = memoryGuardEnd();
+    XCTAssert(report.numAllocations == 0);
+    XCTAssert(zone.numBlocks == 5);
+
+    zone.deinit();
+    XCTAssert(zone.numBlocks == 0);
+    XCTAssert(zone.allocated == 0);
+}
+
+// simulated frames that build their strings in per frame scratch memory,
+// reports allocations per frame next to the timing and expects none after the first frame
+- (void)testPerformanceZoneFrame {
+    Zone temp;
+    temp.init(64*1024);
+    __block u64 allocations = 0;
+    __block u64 frames = 0;
+    [self measureBlock:^{
+        for(u32 f=0; f<1000; ++f) {
+            memoryGuardBegin();
+            for(u32 i=0; i<100; ++i) {
+                char* path = pathCat(temp, "resources", "images/test.png");
+                XCTAssert(path[0] == 'r');
+            }
+            temp.reset();
+            MemoryGuardReport report = memoryGuardEnd();
+            if(frames > 0) {
+                allocations += report.numAllocations;
+            }
+            frames++;
+        }
+    }];
+    NSLog(@"allocations per frame: %.3f", (f64)allocations / (f64)(frames - 1));
+    XCTAssert(allocations == 0);
+    temp.deinit();
+}
+
+// replays a synthetic allocation trace modelled after le4's size class histogram:
+// mostly small strings and structs, some file and vertex buffers, rare bitmap sized blocks
+static void replayAllocationTrace(void* (*allocFunc)(size_t), void (*freeFunc)(void*, size_t)) {
+    static void* slots[4096];
+    static u32 sizes[4096];
+    u32 seed = 12345;
+    for(u32 i=0; i<1000000; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        u32 r = seed >> 8;
+        u32 slot = (seed >> 3) % 4096;
+        if(slots[slot]) {
+            freeFunc(slots[slot], sizes[slot]);
+            slots[slot] = NULL;
+            continue;
+        }
+        u32 k = r % 100;
+        u32 size = k < 60 ? 16 + r % 112 : (k < 90 ? 128 + r % 1920 : (k < 99 ? 2048 + r % 30000 : 65536 + r % (3 << 20)));
+        slots[slot] = allocFunc(size);
+        *(u32*)slots[slot] = size;
+        sizes[slot] = size;
+    }
+    for(u32 i=0; i<4096; ++i) {
+        if(slots[i]) {
+            freeFunc(slots[i], sizes[i]);
+            slots[i] = NULL;
+        }
+    }
+}
+
+static void* systemAlloc(size_t size) { return malloc(size); }
+static void systemFree(void* ptr, size_t) { free(ptr); }
+
+- (void)testPerformanceSystemAllocator {
+    [self measureBlock:^{
+        replayAllocationTrace(systemAlloc, systemFree);
+    }];
+}
+
+- (void)testPerformanceSlabAllocator {
+    [self measureBlock:^{
+        replayAllocationTrace(slabAlloc, slabFree);
+    }];
+}
+
+// producer p pushes (p << 32) | i for i in [0, itemsPerProducer), in batches that must divide
+// itemsPerProducer. Every consumer stops at a ~0 sentinel.
+struct QueueStress {
+    MpmcQueue<u64>      queue;
+    u32                 itemsPerProducer;
+    u32                 batch;
+    std::atomic<u32>    nextProducer;
+    std::atomic<u64>    sum;
+    std::atomic<u64>    count;
+    std::atomic<u32>    orderErrors;
+};
+
+static int queueStressProducer(void* userData) {
+    QueueStress* stress = (QueueStress*)userData;
+    u64 producer = stress->nextProducer.fetch_add(1);
+    u64 items[64];
+    for(u32 i=0; i<stress->itemsPerProducer; i+=stress->batch) {
+        for(u32 k=0; k<stress->batch; ++k) {
+            items[k] = (producer << 32) | (i + k);
+        }
+        stress->queue.push(items, stress->batch);
+    }
+    return 0;
+}
+
+static int queueStressConsumer(void* userData) {
+    QueueStress* stress = (QueueStress*)userData;
+    u32 last[64];
+    SDL_memset(last, 0xff, sizeof(last));
+    u64 sum = 0;
+    u64 count = 0;
+    u64 items[64];
+    for(u32 sentinels = 0; !sentinels;) {
+        u32 n = stress->queue.pop(items, stress->batch);
+        for(u32 k=0; k<n; ++k) {
+            if(items[k] == ~0ull) {
+                sentinels++;
+                continue;
+            }
+            // items of one producer must arrive in order
+            u32 producer = (u32)(items[k] >> 32);
+            u32 i = (u32)items[k];
+            if((last[producer] != ~0u) && (i <= last[producer])) {
+                stress->orderErrors++;
+            }
+            last[producer] = i;
+            sum += i;
+            count++;
+        }
+        // sentinels meant for other consumers go back
+        for(u32 k=1; k<sentinels; ++k) {
+            stress->queue.push(~0ull);
+        }
+    }
+    stress->sum += sum;
+    stress->count += count;
+    return 0;
+}
+
+static bool runQueueStress(u32 numProducers, u32 numConsumers, u32 itemsPerProducer, u32 batch) {
+    QueueStress* stress = new QueueStress;
+    stress->queue.init(1024);
+    stress->itemsPerProducer = itemsPerProducer;
+    stress->batch = batch;
+    stress->nextProducer = 0;
+    stress->sum = 0;
+    stress->count = 0;
+    stress->orderErrors = 0;
+    SDL_Thread* threads[16];
+    for(u32 i=0; i<numConsumers; ++i) {
+        threads[i] = SDL_CreateThread(queueStressConsumer, "consumer", stress);
+    }
+    for(u32 i=0; i<numProducers; ++i) {
+        threads[numConsumers + i] = SDL_CreateThread(queueStressProducer, "producer", stress);
+    }
+    for(u32 i=0; i<numProducers; ++i) {
+        SDL_WaitThread(threads[numConsumers + i], NULL);
+    }
+    for(u32 i=0; i<numConsumers; ++i) {
+        stress->queue.push(~0ull);
+    }
+    for(u32 i=0; i<numConsumers; ++i) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+    bool ok = (stress->count == (u64)numProducers * itemsPerProducer) &&
+              (stress->sum == (u64)numProducers * ((u64)itemsPerProducer * (itemsPerProducer - 1) / 2)) &&
+              (stress->orderErrors == 0);
+    stress->queue.deinit();
+    delete stress;
+    return ok;
+}
+
+static int spscProducer(void* userData) {
+    SpscQueue<u32>* queue = (SpscQueue<u32>*)userData;
+    u32 items[16];
+    for(u32 i=0; i<1000000; i+=16) {
+        for(u32 k=0; k<16; ++k) {
+            items[k] = i + k;
+        }
+        if(i & 16) {
+            queue->push(items, 16);
+        } else {
+            for(u32 k=0; k<16; ++k) {
+                queue->push(items[k]);
+            }
+        }
+    }
+    return 0;
+}
+
+-(void)testSpscQueue {
+    SpscQueue<u32> queue;
+    queue.init(100);
+    XCTAssert(queue.tryPush(1) && queue.count() == 1);
+    u32 item;
+    XCTAssert(queue.tryPop(&item) && item == 1 && !queue.tryPop(&item));
+
+    SDL_Thread* producer = SDL_CreateThread(spscProducer, "producer", &queue);
+    u32 expected = 0;
+    u32 errors = 0;
+    while(expected < 1000000) {
+        u32 items[32];
+        u32 n = queue.pop(items, 32);
+        for(u32 k=0; k<n; ++k) {
+            errors += items[k] != expected++ ? 1 : 0;
+        }
+    }
+    SDL_WaitThread(producer, NULL);
+    XCTAssert(errors == 0);
+    queue.deinit();
+}
+
+-(void)testMpmcQueue {
+    MpmcQueue<u64> queue;
+    queue.init(4);
+    u64 items[6] = {1, 2, 3, 4, 5, 6};
+    XCTAssert(queue.tryPush(items, 6) == 4);
+    XCTAssert(!queue.tryPush(items[0]));
+    u64 out[6];
+    XCTAssert(queue.tryPop(out, 6) == 4 && out[3] == 4);
+    queue.deinit();
+
+    XCTAssert(runQueueStress(1, 1, 200000, 1));
+    XCTAssert(runQueueStress(4, 4, 200000, 8));
+    XCTAssert(runQueueStress(8, 2, 102400, 64));
+}
+
+- (void)testPerformanceMpmcQueue1x1 {
+    [self measureBlock:^{
+        XCTAssert(runQueueStress(1, 1, 1000000, 16));
+    }];
+}
+
+- (void)testPerformanceMpmcQueue2x2 {
+    [self measureBlock:^{
+        XCTAssert(runQueueStress(2, 2, 1000000, 16));
+    }];
+}
+
+- (void)testPerformanceMpmcQueue4x4 {
+    [self measureBlock:^{
+        XCTAssert(runQueueStress(4, 4, 1000000, 16));
+    }];
+}
+
+static std::atomic<u32> jobOrder;
+static u32 jobStages[2];
+static void jobStage0(void*) { jobStages[0] = jobOrder.fetch_add(1); }
+static void jobStage1(void*) { jobStages[1] = jobOrder.fetch_add(1); }
+
+static std::atomic<bool> jobGateStarted;
+static std::atomic<bool> jobGateOpen;
+static void jobGate(void*) {
+    jobGateStarted = true;
+    while(!jobGateOpen) {
+        SDL_Delay(1);
+    }
+}
+static void jobIncrement(void* userData) { (*(std::atomic<u32>*)userData)++; }
+
+static void nestedParallelFor(void* userData) {
+    std::atomic<u64>* sum = (std::atomic<u64>*)userData;
+    parallelFor(1000, 10, [sum](u32 begin, u32 end) {
+        for(u32 i=begin; i<end; ++i) {
+            *sum += i;
+        }
+    });
+}
+
+-(void)testJobs {
+    jobsInit(3, false);
+    XCTAssert(jobsNumWorkers() == 3);
+
+    static std::atomic<u32> hits[100000];
+    for(u32 i=0; i<100000; ++i) {
+        hits[i] = 0;
+    }
+    parallelFor(100000, 64, [](u32 begin, u32 end) {
+        for(u32 i=begin; i<end; ++i) {
+            hits[i]++;
+        }
+    });
+    u32 wrong = 0;
+    for(u32 i=0; i<100000; ++i) {
+        wrong += hits[i] != 1 ? 1 : 0;
+    }
+    XCTAssert(wrong == 0);
+
+    // stage 1 only starts once stage 0 is done
+    JobCounter first;
+    first.init();
+    JobCounter second;
+    second.init();
+    jobOrder = 0;
+    jobsRun(jobStage0, NULL, &first);
+    jobsRunAfter(&first, jobStage1, NULL, &second);
+    jobsWait(&second);
+    XCTAssert(first.done() && jobStages[0] == 0 && jobStages[1] == 1);
+
+    // jobs that wait for their own parallel loops help instead of blocking workers
+    std::atomic<u64> sum(0);
+    JobCounter nested;
+    nested.init();
+    for(u32 i=0; i<20; ++i) {
+        jobsRun(nestedParallelFor, &sum, &nested);
+    }
+    jobsWait(&nested);
+    XCTAssert(sum == 20 * 499500ull);
+
+    // a job waiting for a dependency keeps its slot while the main thread's ring wraps around
+    JobCounter gate;
+    gate.init();
+    JobCounter after;
+    after.init();
+    std::atomic<u32> count(0);
+    jobGateStarted = false;
+    jobGateOpen = false;
+    jobsRun(jobGate, NULL, &gate);
+    while(!jobGateStarted) {
+        SDL_Delay(1); // on a worker, so waiting below doesn't run it
+    }
+    jobsRunAfter(&gate, jobIncrement, &count, &after);
+    for(u32 batch=0; batch<3; ++batch) {
+        JobCounter batchDone;
+        batchDone.init();
+        for(u32 i=0; i<2000; ++i) {
+            jobsRun(jobIncrement, &count, &batchDone);
+        }
+        jobsWait(&batchDone);
+    }
+    XCTAssert(count == 6000);
+    jobGateOpen = true;
+    jobsWait(&after);
+    XCTAssert(count == 6001);
+
+    jobsDeinit();
+}
+
+- (void)testPerformanceParallelFor {
+    jobsInit(jobsDefaultNumWorkers(), false);
+    static f32 values[1 << 22];
+    [self measureBlock:^{
+        for(u32 r=0; r<20; ++r) {
+            parallelFor(1 << 22, 4096, [](u32 begin, u32 end) {
+                for(u32 i=begin; i<end; ++i) {
+                    values[i] = sqrtf(values[i] + i);
+                }
+            });
+        }
+    }];
+    jobsDeinit();
+}
+
+static void profiledWork(u32 depth) {
+    LE_PROFILE_SCOPE("profiledWork");
+    if(depth) {
+        profiledWork(depth - 1);
+    }
+}
+
+static const ProfileZoneStats* findZoneStats(const ProfileZoneStats* stats, u32 numStats, const char* name) {
+    for(u32 i=0; i<numStats; ++i) {
+        if(!strcmp(stats[i].name, name)) {
+            return &stats[i];
+        }
+    }
+    return NULL;
+}
+
+-(void)testProfiler {
+    profileInit();
+    jobsInit(2, false);
+    for(u64 frame=0; frame<4; ++frame) {
+        profileBeginFrame(frame);
+        LE_PROFILE_SCOPE("frame");
+        profiledWork(2);
+        parallelFor(1024, 64, [](u32 begin, u32 end) {
+            LE_PROFILE_SCOPE("range");
+        });
+    }
+    profileBeginFrame(4);
+
+    // zones of frame 3, from all threads
+    ProfileZoneStats stats[8];
+    u32 numStats = profileFrameStats(stats, 8);
+    XCTAssert(numStats == 3);
+    XCTAssert(!strcmp(stats[0].name, "frame"));
+    const ProfileZoneStats* work = findZoneStats(stats, numStats, "profiledWork");
+    const ProfileZoneStats* range = findZoneStats(stats, numStats, "range");
+    XCTAssert(work && work->count == 3 && work->maxMs <= stats[0].totalMs);
+    XCTAssert(range && range->count == 16);
+
+    NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"le4trace.json"];
+    XCTAssert(profileExportChromeTrace([path UTF8String], 1, 2));
+    XCTAssert(!profileExportChromeTrace([path UTF8String], 1000, 2));
+    XCTAssert(!profileExportChromeTrace("/nonexistent/le4trace.json", 1, 2));
+    Data trace = fileLoad([path UTF8String]);
+    std::string json((const char*)trace.bytes, trace.size);
+    XCTAssert(json.find("\"traceEvents\"") != std::string::npos);
+    XCTAssert(json.find("\"name\":\"range\",\"ph\":\"X\"") != std::string::npos);
+    XCTAssert(json.find("\"name\":\"Main\"") != std::string::npos);
+    XCTAssert(json.find("Frame 2") != std::string::npos && json.find("Frame 3") == std::string::npos);
+    trace.deinit();
+
+    jobsDeinit();
+    profileDeinit();
+}
+
+static SDL_sem* profiledThreadGo;
+static SDL_sem* profiledThreadDone;
+static std::atomic<bool> profiledThreadQuit;
+
+static int profiledThread(void*) {
+    for(;;) {
+        SDL_SemWait(profiledThreadGo);
+        if(profiledThreadQuit) {
+            break;
+        }
+        profiledWork(0);
+        SDL_SemPost(profiledThreadDone);
+    }
+    return 0;
+}
+
+// a thread that outlives the profiler records into a new ring once it runs again
+-(void)testProfilerRestart {
+    profiledThreadGo = SDL_CreateSemaphore(0);
+    profiledThreadDone = SDL_CreateSemaphore(0);
+    profiledThreadQuit = false;
+    SDL_Thread* thread = SDL_CreateThread(profiledThread, "profiled", NULL);
+    for(u32 run=0; run<2; ++run) {
+        profileInit();
+        profileBeginFrame(0);
+        SDL_SemPost(profiledThreadGo);
+        SDL_SemWait(profiledThreadDone);
+        profileBeginFrame(1);
+        ProfileZoneStats stats[4];
+        u32 numStats = profileFrameStats(stats, 4);
+        const ProfileZoneStats* work = findZoneStats(stats, numStats, "profiledWork");
+        XCTAssert(work && work->count == 1);
+        profileDeinit();
+    }
+    profiledThreadQuit = true;
+    SDL_SemPost(profiledThreadGo);
+    SDL_WaitThread(thread, NULL);
+    SDL_DestroySemaphore(profiledThreadDone);
+    SDL_DestroySemaphore(profiledThreadGo);
+}
+
+// lane zones recorded frames late still count towards the frame that issued them
+-(void)testProfilerLane {
+    profileInit();
+    ProfileThread* lane = profileLaneRegister("lane");
+    XCTAssert(lane != NULL);
+    for(u64 frame=0; frame<10; ++frame) {
+        profileBeginFrame(frame);
+        LE_PROFILE_SCOPE("cpu");
+        if(frame >= 3) {
+            // like GPU timings read back 3 frames late, taking issued + 1 ms
+            u64 issued = frame - 3;
+            u64 start = profileTicks();
+            profileLaneRecord(lane, issued, "lane", start, start + profileSecondsToTicks((issued + 1) * 0.001), 0);
+        }
+    }
+    profileBeginFrame(10);
+
+    // frame 6 was read back last, more of it could still come
+    ProfileZoneStats stats[4];
+    u64 statsFrame = 0;
+    u32 numStats = profileFrameStats(stats, 4, &statsFrame);
+    XCTAssert(statsFrame == 5);
+    const ProfileZoneStats* cpu = findZoneStats(stats, numStats, "cpu");
+    const ProfileZoneStats* laneStats = findZoneStats(stats, numStats, "lane");
+    XCTAssert(cpu && cpu->count == 1);
+    XCTAssert(laneStats && laneStats->count == 1 && fabs(laneStats->totalMs - 6.0) < 0.01);
+    profileDeinit();
+}
+
+// needs an OpenGL 3.3 context, skipped without one
+-(void)testGpuProfiler {
+    XCTAssert(SDL_Init(SDL_INIT_VIDEO) == 0);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    SDL_Window* window = SDL_CreateWindow("le4Tests", 0, 0, 64, 64, SDL_WINDOW_OPENGL|SDL_WINDOW_HIDDEN);
+    SDL_GLContext context = window ? SDL_GL_CreateContext(window) : NULL;
+    if((context == NULL) || !flextInit()) {
+        NSLog(@"no OpenGL 3.3 context, skipping: %s", SDL_GetError());
+    } else {
+        profileInit();
+        XCTAssert(gpuProfileInit());
+        for(u64 frame=0; frame<10; ++frame) {
+            profileBeginFrame(frame);
+            gpuProfileBeginFrame(frame);
+            {
+                LE_GPU_PROFILE_SCOPE("clear");
+                glClear(GL_COLOR_BUFFER_BIT);
+            }
+            gpuProfileEndFrame();
+            glFinish(); // so no frame is dropped
+        }
+        profileBeginFrame(10);
+
+        // frame 9 read back frame 5
+        GpuProfileRegion regions[4];
+        u64 gpuFrame = 0;
+        u32 numRegions = gpuProfileLastFrame(regions, 4, &gpuFrame);
+        XCTAssert(numRegions == 2 && gpuFrame == 5);
+        XCTAssert(!strcmp(regions[0].name, "GPU frame") && !strcmp(regions[1].name, "clear") && regions[1].depth == 1);
+        XCTAssert(regions[0].ms >= regions[1].ms);
+
+        // stats have the GPU zones in the frames that issued them, up to the one before the last read back
+        ProfileZoneStats stats[4];
+        u64 statsFrame = 0;
+        u32 numStats = profileFrameStats(stats, 4, &statsFrame);
+        const ProfileZoneStats* clear = findZoneStats(stats, numStats, "clear");
+        XCTAssert(statsFrame == 4 && clear && clear->count == 1);
+        gpuProfileDeinit();
+        profileDeinit();
+    }
+    if(context) {
+        SDL_GL_DeleteContext(context);
+    }
+    if(window) {
+        SDL_DestroyWindow(window);
+    }
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+}
+
+- (void)testPerformanceProfileScope {
+    profileInit();
+    [self measureBlock:^{
+        for(u32 i=0; i<1000000; ++i) {
+            LE_PROFILE_SCOPE("scope");
+        }
+    }];
+    profileDeinit();
+}
+
+-(void)testFrameStats {
+    static FrameStats stats;
+    stats.init();
+    FrameStatsSummary summary;
+    stats.summarize(&summary);
+    XCTAssert(summary.numFrames == 0 && summary.max == 0);
+
+    // 1 to 100 ms, shuffled
+    for(u32 i=0; i<100; ++i) {
+        stats.addFrame(i, (f32)((i * 37) % 100 + 1), i);
+    }
+    stats.summarize(&summary);
+    XCTAssert(summary.numFrames == 100);
+    XCTAssert(summary.p50 == 50.f && summary.p95 == 95.f && summary.p99 == 99.f && summary.max == 100.f);
+    XCTAssert(summary.lastMs == (f32)((99 * 37) % 100 + 1) && summary.lastAllocations == 99);
+    XCTAssert(summary.numGraph == 100 && summary.graph[99] == summary.lastMs);
+
+    // only the last LE_FRAME_STATS_FRAMES count
+    for(u32 i=100; i<100 + LE_FRAME_STATS_FRAMES; ++i) {
+        stats.addFrame(i, 5.f, 0);
+    }
+    RenderCounters counters = {1, 2, 3, 4, 5, 6};
+    stats.addRender(100 + LE_FRAME_STATS_FRAMES - 1, counters);
+    stats.summarize(&summary);
+    XCTAssert(summary.numFrames == LE_FRAME_STATS_FRAMES && summary.max == 5.f && summary.numGraph == LE_FRAME_STATS_GRAPH);
+
+    NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"le4stats.csv"];
+    XCTAssert(stats.writeCsv([path UTF8String]));
+    Data csv = fileLoad([path UTF8String]);
+    std::string text((const char*)csv.bytes, csv.size);
+    XCTAssert(text.find("frame,ms,allocations,") == 0);
+    XCTAssert(text.find("\n355,5.000,0,1,2,3,4,5,6\n") != std::string::npos);
+    csv.deinit();
+
+    // a frame that wasn't rendered doesn't keep the counters of the one its sample had before
+    for(u32 i=100 + LE_FRAME_STATS_FRAMES; i<100 + 2 * LE_FRAME_STATS_FRAMES; ++i) {
+        stats.addFrame(i, 5.f, 0);
+    }
+    XCTAssert(stats.writeCsv([path UTF8String]));
+    csv = fileLoad([path UTF8String]);
+    text.assign((const char*)csv.bytes, csv.size);
+    XCTAssert(text.find("\n611,5.000,0,0,0,0,0,0,0\n") != std::string::npos);
+    csv.deinit();
+}
+
+static int addMetrics(void* userData) {
+    for(u32 i=0; i<1000; ++i) {
+        LE_COUNTER_ADD(JobsRun, 1);
+    }
+    LE_HISTOGRAM_RECORD(FileLoadUs, 1000);
+    return 0;
+}
+
+-(void)testMetrics {
+    metricsInit();
+    XCTAssert(metricFind("jobs.run") == MetricJobsRun && metricFind("nope") == MetricCount);
+    XCTAssert(metricType(MetricInternedStrings) == MetricTypeGauge);
+
+    LE_COUNTER_ADD(JobsRun, 5);
+    LE_GAUGE_SET(InternedStrings, 42);
+    LE_HISTOGRAM_RECORD(FileLoadUs, 0);
+    LE_HISTOGRAM_RECORD(FileLoadUs, 3);
+    SDL_Thread* thread = SDL_CreateThread(addMetrics, "metrics", NULL);
+    SDL_WaitThread(thread, NULL);
+    metricsEndFrame(1);
+    XCTAssert(metricFrame(MetricJobsRun) == 1005 && metricTotal(MetricJobsRun) == 1005);
+    XCTAssert(metricGauge(MetricInternedStrings) == 42);
+    const MetricHistogram& histogram = metricHistogram(MetricFileLoadUs);
+    XCTAssert(histogram.count == 3 && histogram.sum == 1003);
+    XCTAssert(histogram.buckets[0] == 1 && histogram.buckets[2] == 1 && histogram.buckets[10] == 1);
+    XCTAssert(metricHistogramPercentile(histogram, 50) == 3 && metricHistogramPercentile(histogram, 99) == 1023);
+
+    // the thread exited, its counts stay in the totals
+    LE_COUNTER_ADD(JobsRun, 1);
+    metricsEndFrame(2);
+    XCTAssert(metricFrame(MetricJobsRun) == 1 && metricTotal(MetricJobsRun) == 1006);
+    XCTAssert(metricHistogram(MetricFileLoadUs).count == 0);
+
+    NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"le4metrics.jsonl"];
+    FILE* file = fopen([path UTF8String], "w");
+    XCTAssert(file != NULL && metricsWriteJsonLine(file));
+    fclose(file);
+    Data json = fileLoad([path UTF8String]);
+    std::string text((const char*)json.bytes, json.size);
+    XCTAssert(text.find("{\"frame\":2,") == 0);
+    XCTAssert(text.find("\"jobs.run\":1,") != std::string::npos && text.find("\"strings.interned\":42") != std::string::npos);
+    json.deinit();
+    metricsDeinit();
+}
+
+- (void)testPerformanceCounterAdd {
+    metricsInit();
+    [self measureBlock:^{
+        for(u32 i=0; i<10000000; ++i) {
+            LE_COUNTER_ADD(JobsRun, 1);
+        }
+    }];
+    metricsDeinit();
+}
+
+struct WriteRecord {
+    char            path[256];
+    FileWriteStatus status;
+};
+
+static WriteRecord writeRecords[8];
+static u32 numWriteRecords = 0;
+
+static void recordWrite(const char* path, FileWriteStatus status, const char* error, void* userData) {
+    if(numWriteRecords < 8) {
+        SDL_strlcpy(writeRecords[numWriteRecords].path, path, 256);
+        writeRecords[numWriteRecords].status = status;
+        numWriteRecords++;
+    }
+}
+
+-(void)testFileWriter {
+    NSString* directory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"le4filewriter"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    std::string blocked = std::string([directory UTF8String]) + "/blocked";
+    std::string a = std::string([directory UTF8String]) + "/a";
+    std::string b = std::string([directory UTF8String]) + "/b";
+    std::string c = std::string([directory UTF8String]) + "/c";
+    unlink((blocked + ".tmp").c_str());
+    // the writer thread blocks opening the fifo until it's read, everything queued after stays pending
+    XCTAssert(mkfifo((blocked + ".tmp").c_str(), 0600) == 0);
+
+    static FileWriter writer;
+    writer.init(16, 3);
+    numWriteRecords = 0;
+    Data data;
+    data.bytes = (u8*)"0123456789abcdefghij";
+    data.size = 4;
+    XCTAssert(writer.write(blocked.c_str(), data, recordWrite, NULL, false));
+    XCTAssert(writer.write(a.c_str(), data, recordWrite, NULL, false));
+    data.size = 6;
+    XCTAssert(writer.write(a.c_str(), data, recordWrite, NULL, false)); // coalesced
+    data.size = 4;
+    XCTAssert(writer.write(b.c_str(), data, recordWrite, NULL, false));
+    // 3 writes pending
+    XCTAssert(!writer.write(c.c_str(), data, recordWrite, NULL, false));
+    // 4 + 6 + 4 bytes pending, replacing b's 4 with 8 would exceed 16
+    data.size = 8;
+    XCTAssert(!writer.write(b.c_str(), data, recordWrite, NULL, false));
+    // "<path>.tmp" wouldn't fit into a PathString
+    std::string longName(sizeof(PathString::chars) - 4, 'x');
+    XCTAssert(!writer.write(longName.c_str(), data, recordWrite, NULL, true));
+    XCTAssert(!writer.writeResource(longName.c_str(), data, recordWrite, NULL, true));
+
+    int fifo = open((blocked + ".tmp").c_str(), O_RDONLY);
+    char buffer[16];
+    while(read(fifo, buffer, sizeof(buffer)) > 0) {
+    }
+    close(fifo);
+    writer.flush();
+    writer.dispatch();
+
+    // coalesced writes report right away, the others in queue order
+    XCTAssert(numWriteRecords == 4);
+    XCTAssert(a == writeRecords[0].path && writeRecords[0].status == FileWriteCoalesced);
+    XCTAssert(blocked == writeRecords[1].path);
+    XCTAssert(a == writeRecords[2].path && writeRecords[2].status == FileWriteOk);
+    XCTAssert(b == writeRecords[3].path && writeRecords[3].status == FileWriteOk);
+    Data written = fileLoad(a.c_str());
+    XCTAssert(written.size == 6 && !SDL_memcmp(written.bytes, "012345", 6));
+    written.deinit();
+    XCTAssert(access((a + ".tmp").c_str(), F_OK) != 0);
+
+    // waits for space instead
+    data.size = 12;
+    XCTAssert(writer.write(c.c_str(), data, recordWrite, NULL, true));
+    XCTAssert(writer.write(c.c_str(), data, recordWrite, NULL, true));
+    writer.deinit();
+    written = fileLoad(c.c_str());
+    XCTAssert(written.size == 12);
+    written.deinit();
+    unlink(blocked.c_str());
+
+    // the blocking save fails instead of aborting
+    XCTAssert(fileSave(a.c_str(), data));
+    XCTAssert(!fileSave("/nonexistent/le4filewriter", data));
+    XCTAssert(!fileSaveResource(longName.c_str(), data));
+}
+
+static void saveText(const char* relativeFilePath, const char* text) {
+    Data data;
+    data.bytes = (u8*)text;
+    data.size = (u32)SDL_strlen(text);
+    fileSaveResource(relativeFilePath, data);
+}
+
+-(void)testResourceManager {
+    NSString* directory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"le4resources"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    const char* previousResPath = resPath();
+    setResPath([directory UTF8String]);
+    // same djb2 hash, only le4Ez.txt is ever interned
+    XCTAssert(hashDjb2("le4Ez.txt") == hashDjb2("le4FY.txt"));
+    saveText("le4Ez.txt", "first");
+    saveText("le4FY.txt", "second");
+
+    static ResourceManager resources;
+    resources.init(0, 0);
+    DataHandle a = resources.loadData("le4Ez.txt");
+    XCTAssert(a.valid() && a->size == 5 && !SDL_memcmp(a->bytes, "first", 5));
+    DataHandle b = resources.loadData(stringIntern("le4Ez.txt"));
+    XCTAssert(b.entry == a.entry && resources.stats.hits == 1 && resources.stats.misses == 1);
+    XCTAssert(!resources.loadData("le4Missing.txt").valid());
+
+    // a different path with the same id doesn't get the cached entry
+    DataHandle collision = resources.loadData("le4FY.txt");
+    XCTAssert(!collision.valid() && resources.stats.numEntries == 1);
+    // nor as another type
+    XCTAssert(!resources.loadBitmap("le4FY.txt").valid());
+
+    resources.release(a);
+    resources.release(b);
+    XCTAssert(resources.stats.numUnreferenced == 1);
+
+    // unreferenced entries stay cached until evicted, then load again
+    saveText("le4Ez.txt", "changed");
+    DataHandle cached = resources.loadData("le4Ez.txt");
+    XCTAssert(cached->size == 5 && resources.stats.hits == 2);
+    resources.release(cached);
+    resources.purge();
+    XCTAssert(resources.stats.numEntries == 0 && resources.stats.evictions == 1 && resources.stats.cpuBytes == 0);
+    // nor once nothing is cached
+    XCTAssert(!resources.loadData("le4FY.txt").valid());
+    DataHandle reloaded = resources.loadData("le4Ez.txt");
+    XCTAssert(reloaded.valid() && reloaded->size == 7 && !SDL_memcmp(reloaded->bytes, "changed", 7));
+    resources.release(reloaded);
+
+    // budgets evict the least recently used entries
+    resources.setBudget(1, 0);
+    XCTAssert(resources.stats.numEntries == 0);
+    resources.deinit();
+    setResPath(previousResPath);
+}
+
+-(void)testFrameWatchdog {
+    NSString* directory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"le4watchdog"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    profileInit();
+    metricsInit();
+    static FrameWatchdog watchdog;
+    watchdog.init(20.f, 4, [directory UTF8String], 0.f);
+    for(u64 frame=0; frame<12; ++frame) {
+        profileBeginFrame(frame);
+        if(frame > 0) {
+            // the frame after a snapshot isn't checked
+            bool stall = watchdog.endFrame(frame - 1, (frame == 7 || frame == 8) ? 50.f : 5.f);
+            XCTAssert(stall == (frame == 7));
+        }
+        {
+            LE_PROFILE_SCOPE("work");
+            LE_COUNTER_ADD(JobsRun, frame);
+        }
+        memoryFrameSnapshot();
+        metricsEndFrame(frame);
+    }
+    watchdog.deinit();
+    profileDeinit();
+    XCTAssert(watchdog.numStalls == 1 && watchdog.numSnapshots == 1);
+
+    Data snapshot = fileLoad([[directory stringByAppendingPathComponent:@"stall-6.jsonl"] UTF8String]);
+    std::string text((const char*)snapshot.bytes, snapshot.size);
+    XCTAssert(text.find("{\"frame\":2,\"ms\":5.000,") == 0);
+    XCTAssert(text.find("{\"frame\":6,\"ms\":50.000,") != std::string::npos && text.find("\"jobs.run\":6,") != std::string::npos);
+    snapshot.deinit();
+    Data trace = fileLoad([[directory stringByAppendingPathComponent:@"stall-6.trace.json"] UTF8String]);
+    XCTAssert(trace.size > 0);
+    trace.deinit();
+}
+
+// counts the callbacks of App, runs headless with LE4_DT=0.02
+struct HeadlessTestApp : App {
+    u32 numFixedUpdates;
+    u32 numUpdates;
+    u32 numRenders;
+    bool ok;
+
+    virtual void configure() {
+        fixedTimestep = 0.01f;
+    }
+    virtual void startup() {
+        numFixedUpdates = 0;
+        numUpdates = 0;
+        numRenders = 0;
+        ok = true;
+    }
+    virtual void fixedUpdate() {
+        numFixedUpdates++;
+    }
+    virtual void update() {
+        numUpdates++;
+        // two fixed steps a frame, none carried over
+        ok = ok && (dt == 0.02f) && (alpha == 0.f) && (numFixedUpdates == 2 * numUpdates);
+        ok = ok && (simSlot == (frame & 1));
+        u64* data = frameData[simSlot].alloc<u64>(1);
+        *data = frame;
+    }
+    virtual void render(u32 slot) {
+        numRenders++;
+    }
+};
+
+-(void)testHeadlessApp {
+    setenv("LE4_HEADLESS", "1", 1);
+    setenv("LE4_FRAMES", "100", 1);
+    setenv("LE4_DT", "0.02", 1);
+    setenv("LE4_JOB_WORKERS", "1", 1);
+    setenv("LE4_PROFILE", "0", 1);
+    for(int pipelined=0; pipelined<2; ++pipelined) {
+        setenv("LE4_PIPELINED", pipelined ? "1" : "0", 1);
+        static HeadlessTestApp app;
+        XCTAssert(app.run("le4Tests", 320, 240, "le4", "le4Tests") == 0);
+        XCTAssert(app.pipelined == (pipelined != 0));
+        XCTAssert(app.frame == 100 && app.numUpdates == 100 && app.numFixedUpdates == 200);
+        XCTAssert(app.ok);
+        // frames still go through the render stage, without render()
+        XCTAssert(app.numRenders == 0 && app.frameLatency > 0);
+    }
+    unsetenv("LE4_HEADLESS");
+    unsetenv("LE4_FRAMES");
+    unsetenv("LE4_DT");
+    unsetenv("LE4_JOB_WORKERS");
+    unsetenv("LE4_PROFILE");
+    unsetenv("LE4_PIPELINED");
+}
 
 @end
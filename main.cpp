@@ -9,14 +9,21 @@ using namespace le4;
 struct TestApp : App {
     Bitmap bmp;
     SokolGl3Renderer tr;
+    vec2 drawSize[2]; // per frame slot, see App::pipelined
 
     void startup() {
         bmp.init(fileLoadResource("resources/testbutton.png"));
-        tr.init();
+        if(!headless) {
+            tr.init();
+        }
     }
 
     void update() {
-        tr.draw(windowSize.x, windowSize.y);
+        drawSize[simSlot] = windowSize;
+    }
+
+    void render(u32 slot) {
+        tr.draw(drawSize[slot].x, drawSize[slot].y);
     }
 
     void shutdown() {
@@ -27,6 +34,5 @@ struct TestApp : App {
 int main(int argc, const char * argv[])
 {
     TestApp app;
-    app.run("Testing", 640, 480, "com.lobotony", "le4");
-    return 0;
+    return app.run("Testing", 640, 480, "com.lobotony", "le4");
 }